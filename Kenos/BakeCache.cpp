@@ -0,0 +1,332 @@
+#include "pch.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "BakeCache.h"
+
+using namespace std;
+
+namespace
+{
+	const char bakeMagic[8] = { 'K', 'S', 'B', 'A', 'K', 'E', 0, 0 };
+
+	// 2^64 / golden ratio, odd so the multiply in HashBytes loses nothing
+	const uint64_t hashMultiplier = 0x9e3779b97f4a7c15ull;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	size_t i = 0;
+
+	// 32 bytes at a time in 4 independent lanes so the multiplies overlap, each lane takes a word per
+	// multiply and the fold brings the high bits of the product back down so every input bit reaches
+	// the whole hash. memcpy because data does not have to be aligned. The lanes are separate variables,
+	// kept in an array the compiler leaves them in memory and the loop runs at half the speed.
+	if (size >= 32) {
+		uint64_t lane0 = hash;
+		uint64_t lane1 = hash ^ 0x6a09e667f3bcc908ull;
+		uint64_t lane2 = hash ^ 0xbb67ae8584caa73bull;
+		uint64_t lane3 = hash ^ 0x3c6ef372fe94f82bull;
+
+		for (; i + 32 <= size; i += 32) {
+			uint64_t words[4];
+			memcpy(words, bytes + i, sizeof(words));
+
+			lane0 = (lane0 ^ words[0]) * hashMultiplier;
+			lane1 = (lane1 ^ words[1]) * hashMultiplier;
+			lane2 = (lane2 ^ words[2]) * hashMultiplier;
+			lane3 = (lane3 ^ words[3]) * hashMultiplier;
+
+			lane0 ^= lane0 >> 32;
+			lane1 ^= lane1 >> 32;
+			lane2 ^= lane2 >> 32;
+			lane3 ^= lane3 >> 32;
+		}
+
+		uint64_t lanes[4] = { lane0, lane1, lane2, lane3 };
+		for (uint64_t lane : lanes) {
+			hash = (hash ^ lane) * hashMultiplier;
+			hash ^= hash >> 32;
+		}
+	}
+
+	// The last few bytes one at a time, FNV-1a
+	for (; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+bool HashFile(const string& path, uint64_t& hash) {
+	ifstream f(path, ios::binary);
+	if (!f.good()) {
+		return false;
+	}
+
+	// Large reads so the copy out of the stream does not hold the hash back
+	vector<char> buffer(1 << 20);
+
+	while (f) {
+		f.read(buffer.data(), buffer.size());
+		hash = HashBytes(buffer.data(), (size_t)f.gcount(), hash);
+	}
+
+	return f.eof();
+}
+
+BakeFileWriter::BakeFileWriter() :
+	key(0),
+	offset(0),
+	failed(true)
+{
+}
+
+BakeFileWriter::~BakeFileWriter() {
+	if (file.is_open()) {
+		file.close();
+		remove(tempPath.c_str());
+	}
+}
+
+bool BakeFileWriter::Open(const string& newPath, uint64_t newKey) {
+	path = newPath;
+	tempPath = newPath + ".tmp";
+	key = newKey;
+	sections.clear();
+
+	file.open(tempPath, ios::binary | ios::trunc);
+	failed = !file.good();
+
+	// The header is written for real by Close once the table is known
+	BakeFileHeader header = {};
+	file.write((const char*)&header, sizeof(header));
+	offset = sizeof(header);
+
+	return !failed;
+}
+
+void BakeFileWriter::Pad() {
+	static const char zeros[KS_BAKE_ALIGNMENT] = {};
+
+	uint64_t padding = (KS_BAKE_ALIGNMENT - offset % KS_BAKE_ALIGNMENT) % KS_BAKE_ALIGNMENT;
+	file.write(zeros, padding);
+	offset += padding;
+}
+
+void BakeFileWriter::WriteSection(uint32_t id, const void* data, uint32_t elementSize, uint64_t count) {
+	Pad();
+
+	BakeSectionEntry entry = { id, elementSize, offset, count };
+	sections.push_back(entry);
+
+	uint64_t bytes = (uint64_t)elementSize * count;
+	if (bytes > 0) {
+		file.write((const char*)data, bytes);
+	}
+
+	offset += bytes;
+}
+
+bool BakeFileWriter::Close() {
+	if (!file.is_open()) {
+		return false;
+	}
+
+	Pad();
+
+	BakeFileHeader header = {};
+	memcpy(header.magic, bakeMagic, sizeof(bakeMagic));
+	header.version = KS_BAKE_VERSION;
+	header.sectionCount = (uint32_t)sections.size();
+	header.key = key;
+	header.tableOffset = offset;
+	header.fileSize = offset + sections.size() * sizeof(BakeSectionEntry);
+
+	file.write((const char*)sections.data(), sections.size() * sizeof(BakeSectionEntry));
+
+	file.seekp(0);
+	file.write((const char*)&header, sizeof(header));
+
+	failed = failed || !file.good();
+	file.close();
+
+	if (failed) {
+		remove(tempPath.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	failed = !MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	failed = rename(tempPath.c_str(), path.c_str()) != 0;
+#endif
+
+	if (failed) {
+		remove(tempPath.c_str());
+	}
+
+	return !failed;
+}
+
+BakeFile::BakeFile() :
+	data(nullptr),
+	size(0),
+	header(nullptr),
+	table(nullptr),
+#ifdef _WIN32
+	fileHandle(INVALID_HANDLE_VALUE),
+	mappingHandle(nullptr)
+#else
+	fileHandle(-1)
+#endif
+{
+}
+
+BakeFile::~BakeFile() {
+	Close();
+}
+
+bool BakeFile::Open(const string& path, uint64_t key) {
+	Close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(BakeFileHeader)) {
+		Close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr) {
+		Close();
+		return false;
+	}
+
+	data = (const uint8_t*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	size = (uint64_t)fileSize.QuadPart;
+#else
+	fileHandle = open(path.c_str(), O_RDONLY);
+	if (fileHandle < 0) {
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fileHandle, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(BakeFileHeader)) {
+		Close();
+		return false;
+	}
+
+	void* mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fileHandle, 0);
+	data = mapping == MAP_FAILED ? nullptr : (const uint8_t*)mapping;
+	size = (uint64_t)fileStat.st_size;
+#endif
+
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+
+	header = (const BakeFileHeader*)data;
+
+	bool valid = memcmp(header->magic, bakeMagic, sizeof(bakeMagic)) == 0 &&
+		header->version == KS_BAKE_VERSION &&
+		header->key == key &&
+		header->fileSize == size &&
+		header->tableOffset <= size &&
+		header->tableOffset % KS_BAKE_ALIGNMENT == 0 &&
+		(size - header->tableOffset) / sizeof(BakeSectionEntry) >= header->sectionCount;
+
+	if (valid) {
+		table = (const BakeSectionEntry*)(data + header->tableOffset);
+
+		// Every section has to be inside the file, after this GetSection does not need to check
+		for (uint32_t i = 0; i < header->sectionCount && valid; i++) {
+			const BakeSectionEntry& entry = table[i];
+
+			valid = entry.offset % KS_BAKE_ALIGNMENT == 0 &&
+				entry.offset <= header->tableOffset &&
+				(entry.elementSize == 0 || entry.count <= (header->tableOffset - entry.offset) / entry.elementSize);
+		}
+	}
+
+	if (!valid) {
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void BakeFile::Close() {
+#ifdef _WIN32
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+	}
+	if (mappingHandle != nullptr) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+	}
+
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (data != nullptr) {
+		munmap((void*)data, (size_t)size);
+	}
+	if (fileHandle >= 0) {
+		close(fileHandle);
+	}
+
+	fileHandle = -1;
+#endif
+
+	data = nullptr;
+	size = 0;
+	header = nullptr;
+	table = nullptr;
+}
+
+bool BakeFile::IsOpen() const {
+	return data != nullptr;
+}
+
+const void* BakeFile::GetSection(uint32_t id, uint32_t elementSize, uint64_t& count) const {
+	count = 0;
+
+	if (header == nullptr) {
+		return nullptr;
+	}
+
+	for (uint32_t i = 0; i < header->sectionCount; i++) {
+		if (table[i].id != id) {
+			continue;
+		}
+
+		if (table[i].elementSize != elementSize) {
+			return nullptr;
+		}
+
+		count = table[i].count;
+		return data + table[i].offset;
+	}
+
+	return nullptr;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+* Kenos bake cache, binary files that hold a baked light tree so it does not have to be rebuilt on
+* every launch.
+*
+* A bake file is a header, a list of sections and a section table at the end. Every section is a flat
+* array of one trivially copyable type, stored exactly as it is laid out in memory and aligned to
+* KS_BAKE_ALIGNMENT, so the file can be mapped and the arrays read in place or copied out in one go.
+* There is nothing to parse. Every file carries the key it was baked for, opening it with any other key
+* fails so a stale bake is never used.
+*/
+
+// Bump this whenever the layout of a section changes
+#define KS_BAKE_VERSION 2
+
+// Alignment of every section in a bake file, a cache line so SIMD loads on mapped data are fine
+#define KS_BAKE_ALIGNMENT 64
+
+// Bake files are saved next to the scene file with this appended to its name
+#define KS_BAKE_EXTENSION ".ksbake"
+
+// Start value of HashBytes, the 64 bit FNV-1a offset basis
+#define KS_HASH_SEED 0xcbf29ce484222325ull
+
+// Ids of the sections in a bake file. Structures that save more than one array take a range of ids
+// starting at their base.
+enum BakeSectionId {
+	KS_BAKESECTION_META = 0x001,
+
+	// SceneLightingInformation
+	KS_BAKESECTION_DIRECTORIES = 0x010,
+	KS_BAKESECTION_SURFLIGHT_OFFSETS,
+	KS_BAKESECTION_SURFLIGHTS,
+	KS_BAKESECTION_NORMALS,
+	KS_BAKESECTION_EMISSIVE,
+	KS_BAKESECTION_LIGHTTREE,
+	KS_BAKESECTION_STATS_CREATED,
+	KS_BAKESECTION_STATS_PRUNED,
+	KS_BAKESECTION_PACKED_DIRECTORIES,
+	KS_BAKESECTION_PACKED_LIGHT_OFFSETS,
+	KS_BAKESECTION_PACKED_LIGHTS,
+
+	// VisibilityStore, 4 sections each
+	KS_BAKESECTION_VISIBLE_SURFACES = 0x100,
+	KS_BAKESECTION_VISIBLE_OBJECTS = 0x110,
+
+	// RDFPool, 14 sections
+	KS_BAKESECTION_RDFS = 0x200,
+
+	// Mesh caches, see MeshCache.h
+	KS_BAKESECTION_MESH_META = 0x300,
+	KS_BAKESECTION_MESH_VERTICES,
+	KS_BAKESECTION_MESH_INDICES,
+	KS_BAKESECTION_MESH_INDICES16
+};
+
+// 64 bit hash of size bytes, 32 bytes at a time (about 10 GB/s on one core) with the last few bytes
+// FNV-1a. Pass the previous result as hash to chain several buffers, the result depends on how the data
+// is split so always hash the same buffers the same way. Not stable across endianness.
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = KS_HASH_SEED);
+
+// Chain the contents of a file into hash. Returns false if the file could not be read.
+bool HashFile(const std::string& path, uint64_t& hash);
+
+struct BakeFileHeader {
+	// "KSBAKE" followed by two zero bytes
+	char magic[8];
+	uint32_t version;
+	uint32_t sectionCount;
+
+	// Key the file was baked for, see SceneLightingInformation::ComputeBakeKey
+	uint64_t key;
+
+	// Offset of the section table, an array of sectionCount BakeSectionEntry
+	uint64_t tableOffset;
+
+	// Size of the whole file, a truncated file is rejected
+	uint64_t fileSize;
+};
+
+struct BakeSectionEntry {
+	uint32_t id;
+	uint32_t elementSize;
+	uint64_t offset;
+	uint64_t count;
+};
+
+/*
+* Writes a bake file section by section. Everything goes to a temporary file next to the target, Close()
+* moves it over the target only once it is complete so a crash never leaves a half written bake behind.
+*/
+class BakeFileWriter
+{
+public:
+	BakeFileWriter();
+	~BakeFileWriter();
+
+	bool Open(const std::string& path, uint64_t key);
+
+	// Append a section of count elements of elementSize bytes
+	void WriteSection(uint32_t id, const void* data, uint32_t elementSize, uint64_t count);
+
+	template <typename T>
+	void WriteSection(uint32_t id, const std::vector<T>& values) {
+		WriteSection(id, values.data(), sizeof(T), values.size());
+	}
+
+	// Write the section table and header and move the file into place. Returns false if anything
+	// failed since Open, the target is left alone in that case.
+	bool Close();
+
+private:
+	std::ofstream file;
+
+	std::string path;
+	std::string tempPath;
+
+	uint64_t key;
+	uint64_t offset;
+
+	std::vector<BakeSectionEntry> sections;
+
+	bool failed;
+
+	void Pad();
+};
+
+/*
+* A bake file mapped read only. Section data points straight into the mapping and is only valid while
+* the file is open.
+*/
+class BakeFile
+{
+public:
+	BakeFile();
+	~BakeFile();
+
+	// Map the file and check the header, version, key and section table. Returns false and leaves the
+	// file closed if any of it does not match.
+	bool Open(const std::string& path, uint64_t key);
+	void Close();
+
+	bool IsOpen() const;
+
+	// Pointer to the data of section id, nullptr if there is no such section or its elements are not
+	// elementSize bytes. count is set to the number of elements.
+	const void* GetSection(uint32_t id, uint32_t elementSize, uint64_t& count) const;
+
+	template <typename T>
+	const T* GetSection(uint32_t id, uint64_t& count) const {
+		return (const T*)GetSection(id, sizeof(T), count);
+	}
+
+	// Copy section id into out. Returns false if the section is missing or the wrong type.
+	template <typename T>
+	bool ReadSection(uint32_t id, std::vector<T>& out) const {
+		uint64_t count;
+		const T* data = GetSection<T>(id, count);
+
+		if (data == nullptr) {
+			return false;
+		}
+
+		out.assign(data, data + count);
+		return true;
+	}
+
+private:
+	const uint8_t* data;
+	uint64_t size;
+
+	const BakeFileHeader* header;
+	const BakeSectionEntry* table;
+
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#else
+	int fileHandle;
+#endif
+};
@@ -0,0 +1,286 @@
+//
+// BakeMain.cpp
+//
+// Entry point of kenos-bake, the headless baker. Loads a scene, builds the light tree and packs the
+// final buffers without a window or a Direct3D device, then writes the packed buffers and the bake
+// stats to disk. Only built by CMake (see CMakeLists.txt), the Visual Studio project builds the game.
+//
+
+#include "pch.h"
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "SceneInformation.h"
+#include "SceneLightingInformation.h"
+#include "CoreFuncsLib.h"
+#include "DocumentFormat.h"
+#include "ProfilingLib.h"
+
+using json = nlohmann::json;
+
+using namespace std;
+
+namespace
+{
+	struct BakeOptions {
+		string scenePath;
+		string outputDir = ".";
+
+		int threads = KS_BAKE_THREADS;
+		int bounces = KS_MAX_RAY_BOUNCES;
+		float minLightness = KS_MIN_LIGHTNESS;
+		VisibilityMode mode = (VisibilityMode)KS_VISIBILITY_MODE;
+		LightPackingMode packing = (LightPackingMode)KS_LIGHT_PACKING_MODE;
+
+		// Also save the bake cache next to the scene so the game can start from it
+		bool writeCache = false;
+
+		// Format of the bake stats file, it is named bake_stats with the extension of the format
+		DocumentFormat statsFormat = KS_DOCFORMAT_JSON;
+
+		// Chrome trace of the bake, only written when profiling is compiled in
+		string tracePath;
+	};
+
+	void PrintUsage() {
+		fprintf(stderr,
+			"usage: kenos-bake <scene> [options]\n"
+			"  -o, --output <dir>          directory for the packed buffers and stats (default .)\n"
+			"  -t, --threads <n>           bake threads, 0 uses every hardware thread\n"
+			"  -m, --mode <mode>           visibility mode: bruteforce or bvh\n"
+			"  -b, --bounces <n>           maximum light bounces\n"
+			"  -l, --min-lightness <f>     lightness below which RDFs get no children\n"
+			"  -p, --packing <mode>        light order per surface: creation or importance\n"
+			"  -c, --cache                 also write the bake cache next to the scene\n"
+			"  -s, --stats-format <fmt>    format of the bake stats: json, cbor or msgpack\n"
+			"      --trace <file>          write a Chrome trace of the bake (needs KENOS_PROFILING)\n");
+	}
+
+	const char* ModeName(VisibilityMode mode) {
+		switch (mode) {
+		case KS_VISMODE_BRUTEFORCE:
+			return "bruteforce";
+		case KS_VISMODE_BVH:
+			return "bvh";
+		}
+		return "unknown";
+	}
+
+	bool ParseOptions(int argc, char** argv, BakeOptions& options) {
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+
+			if ((arg == "-o" || arg == "--output") && hasValue) {
+				options.outputDir = argv[++i];
+			}
+			else if ((arg == "-t" || arg == "--threads") && hasValue) {
+				options.threads = atoi(argv[++i]);
+			}
+			else if ((arg == "-b" || arg == "--bounces") && hasValue) {
+				options.bounces = atoi(argv[++i]);
+			}
+			else if ((arg == "-l" || arg == "--min-lightness") && hasValue) {
+				options.minLightness = (float)atof(argv[++i]);
+			}
+			else if ((arg == "-p" || arg == "--packing") && hasValue) {
+				string packing = argv[++i];
+
+				if (packing == "creation") {
+					options.packing = KS_LIGHTPACK_CREATION_ORDER;
+				}
+				else if (packing == "importance") {
+					options.packing = KS_LIGHTPACK_IMPORTANCE;
+				}
+				else {
+					return false;
+				}
+			}
+			else if ((arg == "-m" || arg == "--mode") && hasValue) {
+				string mode = argv[++i];
+
+				if (mode == "bruteforce") {
+					options.mode = KS_VISMODE_BRUTEFORCE;
+				}
+				else if (mode == "bvh") {
+					options.mode = KS_VISMODE_BVH;
+				}
+				else {
+					return false;
+				}
+			}
+			else if ((arg == "-s" || arg == "--stats-format") && hasValue) {
+				if (!ParseDocumentFormat(argv[++i], options.statsFormat)) {
+					return false;
+				}
+			}
+			else if (arg == "-c" || arg == "--cache") {
+				options.writeCache = true;
+			}
+			else if (arg == "--trace" && hasValue) {
+				options.tracePath = argv[++i];
+			}
+			else if (!arg.empty() && arg[0] != '-' && options.scenePath.empty()) {
+				options.scenePath = arg;
+			}
+			else {
+				return false;
+			}
+		}
+
+		return !options.scenePath.empty();
+	}
+
+	void WriteFile(const string& path, const void* data, size_t size) {
+		ofstream f(path, ios::binary | ios::trunc);
+		f.write((const char*)data, size);
+
+		if (!f.good()) {
+			FatalError("Could not write '" + path + "'!");
+		}
+	}
+
+	double SecondsSince(chrono::steady_clock::time_point start) {
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// Total bytes of every category with its children nested under it
+	json MemoryUsageToJson(const MemoryUsage& usage) {
+		json node;
+		node["bytes"] = usage.GetTotalBytes();
+
+		for (const MemoryUsage& child : usage.children) {
+			node["children"][child.name] = MemoryUsageToJson(child);
+		}
+
+		return node;
+	}
+}
+
+int main(int argc, char** argv) {
+	BakeOptions options;
+
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return 2;
+	}
+
+	if (!options.tracePath.empty() && !IsProfilingEnabled()) {
+		fprintf(stderr, "kenos-bake was built without profiling (configure with -DKENOS_PROFILING=ON), no trace will be written\n");
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	SceneInformation scene(options.scenePath);
+	double loadSeconds = SecondsSince(start);
+
+	SceneLightingInformation lighting(scene);
+	lighting.SetThreadCount(options.threads);
+	lighting.SetVisibilityMode(options.mode);
+	lighting.SetMaxBounces(options.bounces);
+	lighting.SetMinLightness(options.minLightness);
+	lighting.SetLightPackingMode(options.packing);
+
+	start = chrono::steady_clock::now();
+	lighting.BuildLightTree();
+	double buildSeconds = SecondsSince(start);
+
+	start = chrono::steady_clock::now();
+	lighting.UpdateFinalRDFBuffer();
+	double packSeconds = SecondsSince(start);
+
+	// Same layouts as the structured buffers Game uploads, the lightmap has KS_MAX_SURFACE_LIGHTS
+	// slots per surface and unused slots are zero.
+	start = chrono::steady_clock::now();
+
+	KS_PROFILE_ZONE("WriteBuffers");
+
+	int polyCount = scene.getGlobalPolyCount();
+
+	const vector<SurfaceLightmapDirectoryPacked>& directories = lighting.GetDirectoryBufferView();
+	WriteFile(options.outputDir + "/directories.bin", directories.data(), directories.size() * sizeof(SurfaceLightmapDirectoryPacked));
+
+	vector<SurfLight> lightSlots((size_t)polyCount * KS_MAX_SURFACE_LIGHTS);
+	lighting.PackLightmapBuffer(lightSlots.data(), sizeof(SurfLight) * KS_MAX_SURFACE_LIGHTS);
+
+	long long packedLights = 0;
+	for (int i = 0; i < polyCount; i++) {
+		packedLights += min(lighting.GetFinalLights(i).size(), KS_MAX_SURFACE_LIGHTS);
+	}
+
+	WriteFile(options.outputDir + "/lightmap.bin", lightSlots.data(), lightSlots.size() * sizeof(SurfLight));
+
+	bool cacheWritten = options.writeCache && lighting.SaveBake(options.scenePath + KS_BAKE_EXTENSION);
+	double writeSeconds = SecondsSince(start);
+
+	// Stats for tracking bakes over time
+	const LightTreeStats& treeStats = lighting.GetLightTreeStats();
+	const VisibilityStore& visibleSurfaces = lighting.GetVisibleSurfaces();
+
+	long long visiblePairs = 0;
+	for (int i = 0; i < visibleSurfaces.GetRowCount(); i++) {
+		visiblePairs += visibleSurfaces.GetRowSize(i);
+	}
+
+	long long rdfCount = 0;
+	for (int created : treeStats.created) {
+		rdfCount += created;
+	}
+
+	json stats;
+	stats["scene"] = options.scenePath;
+	stats["triangles"] = polyCount;
+	stats["objects"] = scene.getSceneObjects().size();
+	stats["threads"] = options.threads;
+	stats["visibilityMode"] = ModeName(options.mode);
+	stats["maxBounces"] = options.bounces;
+	stats["minLightness"] = options.minLightness;
+	stats["lightPacking"] = options.packing == KS_LIGHTPACK_IMPORTANCE ? "importance" : "creation";
+
+	stats["seconds"]["load"] = loadSeconds;
+	stats["seconds"]["build"] = buildSeconds;
+	stats["seconds"]["pack"] = packSeconds;
+	stats["seconds"]["write"] = writeSeconds;
+
+	stats["visiblePairs"] = visiblePairs;
+	stats["rdfs"] = rdfCount;
+	stats["rdfsCreated"] = treeStats.created;
+	stats["rdfsPruned"] = treeStats.pruned;
+	stats["packedLights"] = packedLights;
+
+	// Estimated light lost to surfaces with more than KS_MAX_SURFACE_LIGHTS lights
+	const LightPackingStats& packingStats = lighting.GetLightPackingStats();
+	stats["truncatedSurfaces"] = packingStats.truncatedSurfaces;
+	stats["droppedEnergy"] = packingStats.droppedEnergy;
+	stats["droppedEnergyFraction"] = packingStats.totalEnergy > 0.0 ? packingStats.droppedEnergy / packingStats.totalEnergy : 0.0;
+	stats["maxSurfaceDroppedFraction"] = packingStats.maxDroppedFraction;
+	stats["visibilityBytes"] = visibleSurfaces.GetMemoryUsage() + lighting.GetVisibleObjects().GetMemoryUsage();
+	stats["cacheWritten"] = cacheWritten;
+
+	stats["memory"] = MemoryUsageToJson(lighting.GetMemoryUsageTree());
+	stats["memoryHighWater"] = lighting.GetMemoryHighWater();
+
+	if (IsProfilingEnabled()) {
+		stats["counters"] = GetProfileCounters();
+	}
+
+	string statsPath = options.outputDir + "/bake_stats" + GetDocumentFormatExtension(options.statsFormat);
+	string statsError;
+
+	if (!WriteDocument(statsPath, stats, options.statsFormat, statsError)) {
+		FatalError(statsError);
+	}
+
+	printf("%s\n", stats.dump(4).c_str());
+
+	if (!options.tracePath.empty() && IsProfilingEnabled() && !WriteProfileTrace(options.tracePath)) {
+		FatalError("Could not write '" + options.tracePath + "'!");
+	}
+
+	return 0;
+}
@@ -0,0 +1,771 @@
+//
+// BenchMain.cpp
+//
+// Entry point of kenos-bench, benchmarks of the hot paths of the light transport: the global index
+// lookups, the triangle math, the visibility pass, BuildLightTree and UpdateFinalRDFBuffer. Every
+// benchmark runs on generated scenes for each combination of triangle count, object count and thread
+// count and the results are printed as JSON so they can be tracked over time. --check runs consistency
+// checks of the visibility pass and the incremental updates on the same scenes instead. Only built by
+// CMake.
+//
+
+#include "pch.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <nlohmann/json.hpp>
+
+#include "ClippingLib.h"
+#include "CoreFuncsLib.h"
+#include "SceneInformation.h"
+#include "SceneGenerators.h"
+#include "SceneLightingInformation.h"
+#include "ThreadingLib.h"
+#include "VisibilityKernels.h"
+
+using json = nlohmann::json;
+
+using namespace std;
+using namespace DirectX;
+using namespace DirectX::SimpleMath;
+
+// Bump this whenever the meaning of a field in the output changes
+#define KS_BENCH_VERSION 1
+
+// Items handed to a thread at a time by the micro benchmarks
+#define KS_BENCH_CHUNK_SIZE 256
+
+namespace
+{
+	struct BenchOptions {
+		vector<int> triangleCounts = { 1024, 4096 };
+		vector<int> objectCounts = { 8 };
+		vector<int> threadCounts = { 1, 0 };
+
+		VisibilityMode mode = (VisibilityMode)KS_VISIBILITY_MODE;
+
+		// Object counts are only used by the object field, the other generators pick their own
+		SceneGeneratorType generator = KS_SCENEGEN_OBJECT_FIELD;
+		unsigned int seed = 1;
+
+		// Every benchmark is repeated until it ran for at least this long
+		double minSeconds = 0.5;
+		int maxRepetitions = 1000;
+
+		// Only run benchmarks whose name contains this
+		string filter;
+		string outputPath;
+
+		// Run the consistency checks instead of the benchmarks
+		bool check = false;
+	};
+
+	// One run of a benchmark body. ops is how many of the unit the body did, pairs how many
+	// caster/receiver pairs it covered if that makes sense for it.
+	struct BenchRun {
+		long long ops;
+		long long pairs;
+	};
+
+	struct Benchmark {
+		string name;
+
+		// What a single op is, "call", "triangle" or "pair"
+		string opUnit;
+
+		// Set up before the first repetition, not timed
+		function<void()> setup;
+		function<BenchRun()> body;
+	};
+
+	// Keeps results alive so the compiler cant drop the loops being timed
+	volatile double benchSink = 0.0;
+
+	void PrintUsage() {
+		fprintf(stderr,
+			"usage: kenos-bench [options]\n"
+			"  -n, --tris <list>           comma separated triangle counts (default 1024,4096)\n"
+			"  -j, --objects <list>        comma separated object counts (default 8)\n"
+			"  -t, --threads <list>        comma separated thread counts, 0 uses every hardware thread (default 1,0)\n"
+			"  -m, --mode <mode>           visibility mode: bruteforce or bvh\n"
+			"  -g, --generator <name>      scene generator: icospheres, cornell, soup or field (default field)\n"
+			"  -s, --seed <n>              seed of the generated scenes\n"
+			"      --min-time <seconds>    minimum time per benchmark (default 0.5)\n"
+			"  -f, --filter <text>         only run benchmarks whose name contains text\n"
+			"  -o, --output <file>         write the JSON results to a file instead of stdout\n"
+			"      --check                 check the visibility pass and the incremental updates instead of benchmarking\n");
+	}
+
+	const char* ModeName(VisibilityMode mode) {
+		switch (mode) {
+		case KS_VISMODE_BRUTEFORCE:
+			return "bruteforce";
+		case KS_VISMODE_BVH:
+			return "bvh";
+		}
+		return "unknown";
+	}
+
+	bool ParseList(const string& text, vector<int>& out) {
+		out.clear();
+
+		stringstream stream(text);
+		string item;
+
+		while (getline(stream, item, ',')) {
+			if (item.empty()) {
+				return false;
+			}
+			out.push_back(atoi(item.c_str()));
+		}
+
+		return !out.empty();
+	}
+
+	bool ParseOptions(int argc, char** argv, BenchOptions& options) {
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+
+			if ((arg == "-n" || arg == "--tris") && hasValue) {
+				if (!ParseList(argv[++i], options.triangleCounts)) {
+					return false;
+				}
+			}
+			else if ((arg == "-j" || arg == "--objects") && hasValue) {
+				if (!ParseList(argv[++i], options.objectCounts)) {
+					return false;
+				}
+			}
+			else if ((arg == "-t" || arg == "--threads") && hasValue) {
+				if (!ParseList(argv[++i], options.threadCounts)) {
+					return false;
+				}
+			}
+			else if ((arg == "-m" || arg == "--mode") && hasValue) {
+				string mode = argv[++i];
+
+				if (mode == "bruteforce") {
+					options.mode = KS_VISMODE_BRUTEFORCE;
+				}
+				else if (mode == "bvh") {
+					options.mode = KS_VISMODE_BVH;
+				}
+				else {
+					return false;
+				}
+			}
+			else if ((arg == "-g" || arg == "--generator") && hasValue) {
+				if (!ParseSceneGeneratorType(argv[++i], options.generator)) {
+					return false;
+				}
+			}
+			else if ((arg == "-s" || arg == "--seed") && hasValue) {
+				options.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+			}
+			else if (arg == "--min-time" && hasValue) {
+				options.minSeconds = atof(argv[++i]);
+			}
+			else if ((arg == "-f" || arg == "--filter") && hasValue) {
+				options.filter = argv[++i];
+			}
+			else if ((arg == "-o" || arg == "--output") && hasValue) {
+				options.outputPath = argv[++i];
+			}
+			else if (arg == "--check") {
+				options.check = true;
+			}
+			else {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Peak resident set size of the process so far in bytes
+	size_t GetPeakRss() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return counters.PeakWorkingSetSize;
+		}
+		return 0;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) {
+			return 0;
+		}
+#ifdef __APPLE__
+		return (size_t)usage.ru_maxrss;
+#else
+		// kilobytes on linux
+		return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+	}
+
+	// Everything the micro benchmarks read, built once per scene so only the function itself is timed
+	struct MicroInputs {
+		// Triangle indices in a random order so lookups dont just stream through memory
+		vector<int> order;
+
+		// World space triangle corners and a point inside each
+		vector<Vector3> tris3;
+		vector<Vector3> points3;
+
+		// The same triangles in their own plane and a point inside each, plus a second triangle
+		// overlapping each one for ClipTri. Every triangle takes 4 slots with the first corner repeated.
+		vector<Vector2> tris2;
+		vector<Vector2> clipTris2;
+		vector<Vector2> points2;
+
+		vector<XMFLOAT4> planes;
+		vector<Vector3> ups;
+	};
+
+	void BuildMicroInputs(const SceneInformation& scene, unsigned int seed, MicroInputs& in) {
+		const CompiledSceneGeometry& geo = scene.getCompiledGeometry();
+		int triCount = geo.triCount();
+
+		mt19937 rng(seed);
+		uniform_real_distribution<float> weight(0.05f, 1.0f);
+
+		in.order.resize(triCount);
+		for (int i = 0; i < triCount; i++) {
+			in.order[i] = i;
+		}
+		shuffle(in.order.begin(), in.order.end(), rng);
+
+		in.tris3.resize(triCount * 3);
+		in.points3.resize(triCount);
+		in.tris2.resize(triCount * 4);
+		in.clipTris2.resize(triCount * 4);
+		in.points2.resize(triCount);
+		in.planes.assign(geo.planes.begin(), geo.planes.end());
+		in.ups.resize(triCount);
+
+		for (int i = 0; i < triCount; i++) {
+			Vector3 verts[3];
+			geo.getTri(verts, i);
+
+			float w[3] = { weight(rng), weight(rng), weight(rng) };
+			float total = w[0] + w[1] + w[2];
+
+			Vector3 point = (verts[0] * w[0] + verts[1] * w[1] + verts[2] * w[2]) / total;
+
+			in.ups[i] = verts[0] - verts[1];
+
+			XMMATRIX to2D = CreateTransformTo2D(XMLoadFloat4(&geo.planes[i]), in.ups[i]);
+			Vector2 centre;
+
+			for (int k = 0; k < 3; k++) {
+				in.tris3[i * 3 + k] = verts[k];
+
+				XMVECTOR flat = XMVector3Transform(verts[k], to2D);
+				in.tris2[i * 4 + k] = Vector2(XMVectorGetX(flat), XMVectorGetY(flat));
+				centre += in.tris2[i * 4 + k] * (1.0f / 3.0f);
+			}
+			in.tris2[i * 4 + 3] = in.tris2[i * 4];
+
+			// The triangle turned half way around its centre, the two always overlap
+			for (int k = 0; k < 3; k++) {
+				in.clipTris2[i * 4 + k] = centre * 2.0f - in.tris2[i * 4 + k];
+			}
+			in.clipTris2[i * 4 + 3] = in.clipTris2[i * 4];
+
+			in.points3[i] = point;
+
+			XMVECTOR flatPoint = XMVector3Transform(point, to2D);
+			in.points2[i] = Vector2(XMVectorGetX(flatPoint), XMVectorGetY(flatPoint));
+		}
+	}
+
+	// Run body for every triangle of the scene split between threads. Each thread sums what body
+	// returns on its own so the threads never share a cache line.
+	BenchRun ForEachTriangle(int triCount, int threads, const function<double(int)>& body) {
+		const int stride = 8;
+		vector<double> sums((size_t)ResolveThreadCount(threads) * stride, 0.0);
+
+		ParallelFor(triCount, KS_BENCH_CHUNK_SIZE, threads, [&](int chunkStart, int chunkEnd, int threadIdx) {
+			double sum = 0.0;
+			for (int i = chunkStart; i < chunkEnd; i++) {
+				sum += body(i);
+			}
+			sums[threadIdx * stride] += sum;
+		});
+
+		double total = 0.0;
+		for (double sum : sums) {
+			total += sum;
+		}
+		benchSink = benchSink + total;
+
+		BenchRun run = { triCount, 0 };
+		return run;
+	}
+
+	vector<Benchmark> CreateBenchmarks(SceneInformation& scene, SceneLightingInformation& lighting,
+		const MicroInputs& in, int threads) {
+
+		int triCount = scene.getGlobalPolyCount();
+		long long pairCount = (long long)triCount * triCount;
+
+		vector<Benchmark> benchmarks;
+
+		benchmarks.push_back({ "getTribyGlobalIndex", "triangle", nullptr, [&scene, &in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				tuple<DXVector3, DXVector3, DXVector3> tri = scene.getTribyGlobalIndex(in.order[i]);
+				return (double)(get<0>(tri).x + get<1>(tri).y + get<2>(tri).z);
+			});
+		} });
+
+		benchmarks.push_back({ "getTribyGlobalIndexFast", "triangle", nullptr, [&scene, &in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				DXVector3 verts[3];
+				scene.getTribyGlobalIndexFast(verts, in.order[i]);
+				return (double)(verts[0].x + verts[1].y + verts[2].z);
+			});
+		} });
+
+		benchmarks.push_back({ "CartesianToBaryocentric3", "triangle", nullptr, [&in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				const Vector3* tri = &in.tris3[i * 3];
+				return (double)CartesianToBaryocentric3(tri[0], tri[1], tri[2], in.points3[i]).x;
+			});
+		} });
+
+		benchmarks.push_back({ "CartesianToBaryocentric2", "triangle", nullptr, [&in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				const Vector2* tri = &in.tris2[i * 4];
+				return (double)CartesianToBaryocentric2(tri[0], tri[1], tri[2], in.points2[i]).x;
+			});
+		} });
+
+		benchmarks.push_back({ "IsWithinTriangle2", "triangle", nullptr, [&in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				const Vector2* tri = &in.tris2[i * 4];
+				return IsWithinTriangle2(tri[0], tri[1], tri[2], in.points2[i]) ? 1.0 : 0.0;
+			});
+		} });
+
+		benchmarks.push_back({ "ClipTri", "triangle", nullptr, [&in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				// ClipTri takes non const arrays but does not write to them
+				Vector2 tri1[4];
+				Vector2 tri2[4];
+				copy(&in.tris2[i * 4], &in.tris2[i * 4] + 4, tri1);
+				copy(&in.clipTris2[i * 4], &in.clipTris2[i * 4] + 4, tri2);
+
+				Vector2* clipped = ClipTri(tri1, tri2);
+				double result = clipped[0].x;
+				delete[] clipped;
+
+				return result;
+			});
+		} });
+
+		benchmarks.push_back({ "CreateTransformTo2D", "triangle", nullptr, [&in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				XMMATRIX m = CreateTransformTo2D(XMLoadFloat4(&in.planes[i]), in.ups[i]);
+				return (double)XMVectorGetX(m.r[0]);
+			});
+		} });
+
+		benchmarks.push_back({ "CreateTransformTo3D", "triangle", nullptr, [&in, triCount, threads]() {
+			return ForEachTriangle(triCount, threads, [&](int i) {
+				XMMATRIX m = CreateTransformTo3D(XMLoadFloat4(&in.planes[i]), in.ups[i]);
+				return (double)XMVectorGetX(m.r[0]);
+			});
+		} });
+
+		benchmarks.push_back({ "visibility", "pair", nullptr, [&lighting, pairCount]() {
+			lighting.BuildSceneVisibility();
+
+			BenchRun run = { pairCount, pairCount };
+			return run;
+		} });
+
+		benchmarks.push_back({ "BuildLightTree", "call", nullptr, [&lighting, pairCount]() {
+			lighting.BuildLightTree();
+
+			BenchRun run = { 1, pairCount };
+			return run;
+		} });
+
+		// Packs the tree built by the setup, every repetition packs every surface of the same tree
+		benchmarks.push_back({ "UpdateFinalRDFBuffer", "call", [&lighting]() { lighting.BuildLightTree(); }, [&lighting]() {
+			lighting.MarkAllSurfacesDirty();
+			lighting.UpdateFinalRDFBuffer();
+
+			BenchRun run = { 1, 0 };
+			return run;
+		} });
+
+		return benchmarks;
+	}
+
+	// Check that two visibility builds hold the same rows. Returns what differs, or an empty string.
+	string CompareVisibility(const SceneLightingInformation& reference, const SceneLightingInformation& lighting) {
+		const VisibilityStore* stores[2][2] = {
+			{ &reference.GetVisibleSurfaces(), &lighting.GetVisibleSurfaces() },
+			{ &reference.GetVisibleObjects(), &lighting.GetVisibleObjects() }
+		};
+		const char* names[2] = { "visible surfaces", "visible objects" };
+
+		vector<int> expected;
+		vector<int> actual;
+
+		for (int s = 0; s < 2; s++) {
+			const VisibilityStore& a = *stores[s][0];
+			const VisibilityStore& b = *stores[s][1];
+
+			if (a.GetRowCount() != b.GetRowCount() || a.GetColumnCount() != b.GetColumnCount()) {
+				return string(names[s]) + " have a different shape";
+			}
+
+			for (int row = 0; row < a.GetRowCount(); row++) {
+				a.GetRowValues(row, expected);
+				b.GetRowValues(row, actual);
+
+				if (expected != actual) {
+					return string(names[s]) + " of surface " + to_string(row) + " differ";
+				}
+			}
+		}
+
+		return string();
+	}
+
+	// Build the visibility on threads threads in every visibility mode with every kernel level this cpu
+	// supports and check it row by row against a single threaded brute force build with the scalar
+	// kernel. Returns what is wrong, or an empty string.
+	string CheckVisibility(SceneInformation& scene, int threads) {
+		VisKernelLevel previousLevel = GetVisKernelLevel();
+		SetVisKernelLevel(KS_VISKERNEL_SCALAR);
+
+		SceneLightingInformation reference(scene);
+		reference.SetThreadCount(1);
+		reference.SetVisibilityMode(KS_VISMODE_BRUTEFORCE);
+		reference.BuildSceneVisibility();
+
+		string error;
+
+		const VisibilityMode modes[] = { KS_VISMODE_BRUTEFORCE, KS_VISMODE_BVH };
+
+		for (int level = KS_VISKERNEL_SCALAR; level <= GetSupportedVisKernelLevel() && error.empty(); level++) {
+			SetVisKernelLevel((VisKernelLevel)level);
+
+			for (int m = 0; m < 2 && error.empty(); m++) {
+				SceneLightingInformation lighting(scene);
+				lighting.SetThreadCount(threads);
+				lighting.SetVisibilityMode(modes[m]);
+				lighting.BuildSceneVisibility();
+
+				error = CompareVisibility(reference, lighting);
+				if (!error.empty()) {
+					error = string(ModeName(modes[m])) + " kernel level " + to_string(level) + ": " + error;
+				}
+			}
+		}
+
+		SetVisKernelLevel(previousLevel);
+		return error;
+	}
+
+	// Move the last object that has triangles, then check that UpdateLightTree and UpdateFinalRDFBuffer
+	// end up with the same visibility, directories and lights as a fresh BuildLightTree. The lights of
+	// each surface are compared sorted, lights of the same importance can be packed in a different
+	// order since the update creates the RDFs in a different order. The object is moved back after.
+	// Returns what is wrong, or an empty string.
+	string CheckIncrementalUpdate(SceneInformation& scene, SceneLightingInformation& lighting) {
+		vector<SceneObject>& objects = scene.getSceneObjects();
+
+		int objIdx = -1;
+		for (int i = (int)objects.size() - 1; i >= 0 && objIdx < 0; i--) {
+			if (objects[i].GetFaceCount() > 0) {
+				objIdx = i;
+			}
+		}
+
+		if (objIdx < 0) {
+			return string();
+		}
+
+		lighting.BuildLightTree();
+		lighting.UpdateFinalRDFBuffer();
+
+		Vector3 position = objects[objIdx].GetPosition();
+		objects[objIdx].SetPosition(position + Vector3(0.1f, 0.05f, -0.1f));
+		lighting.UpdateLightTree(objIdx);
+		lighting.UpdateFinalRDFBuffer();
+
+		bool fullRebuild = lighting.GetLightTreeUpdateStats().fullRebuild;
+
+		SceneLightingInformation reference(scene);
+		reference.SetThreadCount(lighting.GetThreadCount());
+		reference.SetVisibilityMode(lighting.GetVisibilityMode());
+		reference.BuildLightTree();
+		reference.UpdateFinalRDFBuffer();
+
+		objects[objIdx].SetPosition(position);
+
+		if (fullRebuild) {
+			return "UpdateLightTree fell back to a full rebuild for object " + to_string(objIdx);
+		}
+
+		string error = CompareVisibility(reference, lighting);
+		if (!error.empty()) {
+			return error;
+		}
+
+		const vector<SurfaceLightmapDirectoryPacked>& expected = reference.GetDirectoryBufferView();
+		const vector<SurfaceLightmapDirectoryPacked>& actual = lighting.GetDirectoryBufferView();
+
+		if (expected.size() != actual.size()) {
+			return "the directory buffers have a different size";
+		}
+
+		// Orders lights by every field, only used to compare them as a set
+		auto lightLess = [](const SurfLight& a, const SurfLight& b) {
+			return make_tuple(a.casterIdx, a.lightBrightness, a.color.x, a.color.y, a.color.z) <
+				make_tuple(b.casterIdx, b.lightBrightness, b.color.x, b.color.y, b.color.z);
+		};
+
+		vector<SurfLight> expectedLights;
+		vector<SurfLight> actualLights;
+
+		for (int i = 0; i < (int)expected.size(); i++) {
+			if (memcmp(&expected[i], &actual[i], sizeof(SurfaceLightmapDirectoryPacked)) != 0) {
+				return "directory " + to_string(i) + " differs";
+			}
+
+			SurfLightRange expectedRange = reference.GetFinalLights(i);
+			SurfLightRange actualRange = lighting.GetFinalLights(i);
+
+			expectedLights.assign(expectedRange.begin(), expectedRange.end());
+			actualLights.assign(actualRange.begin(), actualRange.end());
+
+			sort(expectedLights.begin(), expectedLights.end(), lightLess);
+			sort(actualLights.begin(), actualLights.end(), lightLess);
+
+			bool same = expectedLights.size() == actualLights.size();
+			for (int k = 0; k < (int)expectedLights.size() && same; k++) {
+				same = !lightLess(expectedLights[k], actualLights[k]) && !lightLess(actualLights[k], expectedLights[k]);
+			}
+
+			if (!same) {
+				return "the lights of surface " + to_string(i) + " differ";
+			}
+		}
+
+		return string();
+	}
+
+	// Give the first object that has triangles and is not a light a new emissive material, then check
+	// that UpdateLightTree and UpdateFinalRDFBuffer pack its surfaces with it. The object gets its old
+	// material back after. Returns what is wrong, or an empty string.
+	string CheckMaterialUpdate(SceneInformation& scene, SceneLightingInformation& lighting) {
+		vector<SceneObject>& objects = scene.getSceneObjects();
+
+		int objIdx = -1;
+		for (int i = 0; i < (int)objects.size() && objIdx < 0; i++) {
+			if (objects[i].GetFaceCount() > 0 && objects[i].GetMaterial().GetEmissiveIntensity() <= 0.1f) {
+				objIdx = i;
+			}
+		}
+
+		if (objIdx < 0) {
+			return string();
+		}
+
+		lighting.BuildLightTree();
+		lighting.UpdateFinalRDFBuffer();
+
+		Material previousMaterial = objects[objIdx].GetMaterial();
+		int previousMaterialId = objects[objIdx].GetMaterialId();
+
+		Material material = previousMaterial;
+		material.SetAlbedo(Color(51, 102, 204));
+		material.SetEmissiveIntensity(5.0f);
+
+		objects[objIdx].SetMaterial(material);
+		lighting.UpdateLightTree(objIdx);
+		lighting.UpdateFinalRDFBuffer();
+
+		const vector<SurfaceLightmapDirectoryPacked>& directories = lighting.GetDirectoryBufferView();
+		string error;
+
+		for (int tri : scene.getObjectTris(objIdx)) {
+			const SurfaceLightmapDirectoryPacked& dir = directories[tri];
+
+			if (fabsf(dir.color.x - 0.2f) > 1e-5f || fabsf(dir.color.y - 0.4f) > 1e-5f ||
+				fabsf(dir.color.z - 0.8f) > 1e-5f || dir.emmissiveStrength != 5.0f) {
+				error = "surface " + to_string(tri) + " of object " + to_string(objIdx) +
+					" was not packed with the material set by SetMaterial";
+				break;
+			}
+		}
+
+		objects[objIdx].SetMaterial(previousMaterial);
+		objects[objIdx].SetMaterialId(previousMaterialId);
+
+		return error;
+	}
+
+	json RunBenchmark(const Benchmark& benchmark, const BenchOptions& options) {
+		if (benchmark.setup) {
+			benchmark.setup();
+		}
+
+		vector<double> nsPerOp;
+		long long ops = 0;
+		long long pairs = 0;
+		double totalSeconds = 0.0;
+
+		while ((totalSeconds < options.minSeconds || nsPerOp.empty()) && (int)nsPerOp.size() < options.maxRepetitions) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			BenchRun run = benchmark.body();
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			nsPerOp.push_back(seconds * 1e9 / max(run.ops, 1LL));
+			ops += run.ops;
+			pairs += run.pairs;
+			totalSeconds += seconds;
+		}
+
+		vector<double> sorted = nsPerOp;
+		sort(sorted.begin(), sorted.end());
+
+		json result;
+		result["name"] = benchmark.name;
+		result["opUnit"] = benchmark.opUnit;
+		result["repetitions"] = nsPerOp.size();
+		result["ops"] = ops;
+		result["seconds"] = totalSeconds;
+		result["nsPerOp"] = sorted[sorted.size() / 2];
+		result["nsPerOpMin"] = sorted.front();
+		result["nsPerOpMax"] = sorted.back();
+		result["opsPerSecond"] = totalSeconds > 0.0 ? ops / totalSeconds : 0.0;
+
+		if (pairs > 0) {
+			result["pairsPerSecond"] = totalSeconds > 0.0 ? pairs / totalSeconds : 0.0;
+		}
+
+		result["peakRssBytes"] = GetPeakRss();
+
+		return result;
+	}
+}
+
+int main(int argc, char** argv) {
+	BenchOptions options;
+
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return 2;
+	}
+
+	json results = json::array();
+	int checkFailures = 0;
+
+	for (int triangleCount : options.triangleCounts) {
+		for (int objectCount : options.objectCounts) {
+			SceneInformation scene;
+			GenerateScene(scene, options.generator, triangleCount, options.seed, objectCount);
+
+			MicroInputs inputs;
+			BuildMicroInputs(scene, options.seed, inputs);
+
+			for (int threads : options.threadCounts) {
+				SceneLightingInformation lighting(scene);
+				lighting.SetThreadCount(threads);
+				lighting.SetVisibilityMode(options.mode);
+
+				if (options.check) {
+					vector<pair<string, function<string()>>> checks = {
+						{ "CheckVisibility", [&]() { return CheckVisibility(scene, threads); } },
+						{ "CheckIncrementalUpdate", [&]() { return CheckIncrementalUpdate(scene, lighting); } },
+						{ "CheckMaterialUpdate", [&]() { return CheckMaterialUpdate(scene, lighting); } }
+					};
+
+					for (const pair<string, function<string()>>& check : checks) {
+						string error = check.second();
+
+						fprintf(stderr, "%-26s tris %7d objects %4d threads %3d  %s\n", check.first.c_str(),
+							scene.getGlobalPolyCount(), (int)scene.getSceneObjects().size(), ResolveThreadCount(threads),
+							error.empty() ? "ok" : error.c_str());
+
+						if (!error.empty()) {
+							checkFailures++;
+						}
+					}
+					continue;
+				}
+
+				vector<Benchmark> benchmarks = CreateBenchmarks(scene, lighting, inputs, threads);
+
+				for (const Benchmark& benchmark : benchmarks) {
+					if (!options.filter.empty() && benchmark.name.find(options.filter) == string::npos) {
+						continue;
+					}
+
+					json result = RunBenchmark(benchmark, options);
+					result["triangles"] = scene.getGlobalPolyCount();
+					result["objects"] = scene.getSceneObjects().size();
+					result["threads"] = ResolveThreadCount(threads);
+
+					fprintf(stderr, "%-26s tris %7d objects %4d threads %3d  %14.1f ns/%s\n",
+						benchmark.name.c_str(), scene.getGlobalPolyCount(), (int)scene.getSceneObjects().size(),
+						ResolveThreadCount(threads), result["nsPerOp"].get<double>(), benchmark.opUnit.c_str());
+
+					results.push_back(result);
+				}
+			}
+		}
+	}
+
+	if (options.check) {
+		return checkFailures == 0 ? 0 : 1;
+	}
+
+	json report;
+	report["version"] = KS_BENCH_VERSION;
+	report["visibilityMode"] = ModeName(options.mode);
+	report["generator"] = GetSceneGeneratorName(options.generator);
+	report["visKernelLevel"] = (int)GetVisKernelLevel();
+	report["hardwareThreads"] = ResolveThreadCount(0);
+	report["seed"] = options.seed;
+	report["minSeconds"] = options.minSeconds;
+	report["peakRssBytes"] = GetPeakRss();
+	report["results"] = results;
+
+	string reportText = report.dump(4);
+
+	if (options.outputPath.empty()) {
+		printf("%s\n", reportText.c_str());
+	}
+	else {
+		ofstream f(options.outputPath, ios::trunc);
+		f << reportText << "\n";
+
+		if (!f.good()) {
+			FatalError("Could not write '" + options.outputPath + "'!");
+		}
+	}
+
+	return 0;
+}
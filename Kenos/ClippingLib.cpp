@@ -12,8 +12,6 @@ using namespace std;
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
-using Microsoft::WRL::ComPtr;
-
 /* Clip point p into triangle tri
 * 1. Check if the point to clip is within the triangle, if it is then 
 	just return the point.
@@ -25,8 +23,8 @@ using Microsoft::WRL::ComPtr;
 */
 Vector2 ClipVector(Vector2 tri[], Vector2 p) {
 	// This isnt used for now so ill implement it later if needed
-	tri;
-	p;
+	(void)tri;
+	(void)p;
 	return Vector2();
 }
 
@@ -50,7 +48,7 @@ Vector2* ClipTri(Vector2 tri1[], Vector2 tri2[]) {
 
 	// 1. Check if any b verts are inside of a, if they are append to outlist
 	for (int i = 0; i < 3; i++) {
-		if (IsWithinTriangle2(tri1[0], tri1[1], tri1[2], tri2[i])) {
+		if (IsWithinTriangle2(tri1[0], tri1[1], tri1[2], tri2[i]) && outlistLength < 6) {
 			outlist[outlistLength] = tri2[i];
 			outlistLength++;
 		}
@@ -58,7 +56,7 @@ Vector2* ClipTri(Vector2 tri1[], Vector2 tri2[]) {
 
 	// 2. Check if any a verts are inside of b, if they are append to outlist
 	for (int i = 0; i < 3; i++) {
-		if (IsWithinTriangle2(tri2[0], tri2[1], tri2[2], tri1[i])) {
+		if (IsWithinTriangle2(tri2[0], tri2[1], tri2[2], tri1[i]) && outlistLength < 6) {
 			outlist[outlistLength] = tri1[i];
 			outlistLength++;
 		}
@@ -66,15 +64,15 @@ Vector2* ClipTri(Vector2 tri1[], Vector2 tri2[]) {
 
 	// 3. Calculate intersections of each edge on triangle a for each edge of triangle b
 	// iniitalize intersection arrays:
-	Vector2* intersectionsA = new Vector2[3];
-	Vector2* intersectionsB = new Vector2[3];
-	Vector2* intersectionsC = new Vector2[3];
+	Vector2 intersectionsA[3];
+	Vector2 intersectionsB[3];
+	Vector2 intersectionsC[3];
 
 	// calculate intersections:
 	for (int i = 0; i < 3; i++) { // loop over every edge in tri 1
-		intersectionsA[i] = IntersectLinears(tri1[0], tri1[1], tri2[i], tri2[(i % 3) + 1]);
-		intersectionsB[i] = IntersectLinears(tri1[1], tri1[2], tri2[i], tri2[(i % 3) + 1]);
-		intersectionsC[i] = IntersectLinears(tri1[2], tri1[0], tri2[i], tri2[(i % 3) + 1]);
+		intersectionsA[i] = IntersectLinears(tri1[0], tri1[1], tri2[i], tri2[(i + 1) % 3]);
+		intersectionsB[i] = IntersectLinears(tri1[1], tri1[2], tri2[i], tri2[(i + 1) % 3]);
+		intersectionsC[i] = IntersectLinears(tri1[2], tri1[0], tri2[i], tri2[(i + 1) % 3]);
 	}
 
 	// 4. Check if each intersection is on an edge of both triangle a and b, if they are append to outlist
@@ -86,24 +84,26 @@ Vector2* ClipTri(Vector2 tri1[], Vector2 tri2[]) {
 	
 	// calculate weather the intersections are within line segments of tri2
 	for (int i = 0; i < 3; i++) {
-		isIn1[0][i] = IsWithinLineSegment(tri2[i], tri2[(i % 3) + 1], intersectionsA[i]);
-		isIn1[1][i] = IsWithinLineSegment(tri2[i], tri2[(i % 3) + 1], intersectionsB[i]);
-		isIn1[2][i] = IsWithinLineSegment(tri2[i], tri2[(i % 3) + 1], intersectionsC[i]);
+		isIn1[0][i] = IsWithinLineSegment(tri2[i], tri2[(i + 1) % 3], intersectionsA[i]);
+		isIn1[1][i] = IsWithinLineSegment(tri2[i], tri2[(i + 1) % 3], intersectionsB[i]);
+		isIn1[2][i] = IsWithinLineSegment(tri2[i], tri2[(i + 1) % 3], intersectionsC[i]);
 	}
 	
 	// calculate weather the intersections are within line segments of tri1
 	for (int i = 0; i < 3; i++) {
 		isIn2[0][i] = IsWithinLineSegment(tri1[0], tri1[1], intersectionsA[i]);
-		isIn2[1][i] = IsWithinLineSegment(tri1[1], tri1[3], intersectionsB[i]);
+		isIn2[1][i] = IsWithinLineSegment(tri1[1], tri1[2], intersectionsB[i]);
 		isIn2[2][i] = IsWithinLineSegment(tri1[2], tri1[0], intersectionsC[i]);
 	}
 
-	// apply AND to the two arrays to get the final result
+	// apply AND to the two arrays to get the final result, row i is edge i of tri1 and column j
+	// is edge j of tri2
+	const Vector2* intersections[3] = { intersectionsA, intersectionsB, intersectionsC };
 	for (int i = 0; i < 3; i++) {
 		for (int j = 0; j < 3; j++) {
 			// if both are true then add to outlist
-			if (isIn1[i][j] && isIn2[i][j]) {
-				outlist[outlistLength] = intersectionsA[i];
+			if (isIn1[i][j] && isIn2[i][j] && outlistLength < 6) {
+				outlist[outlistLength] = intersections[i][j];
 				outlistLength++;
 			}
 		}
@@ -134,8 +134,9 @@ Vector2* ClipTri(Vector2 tri1[], Vector2 tri2[]) {
 	}
 	
 	// repopulate the outlist in order
+	int orderedLength = 0;
 	for (auto const& x : outlistMap) {
-		outlist[outlistLength] = x.second;
+		outlist[orderedLength++] = x.second;
 	}
 	
 	// return ordered outlist
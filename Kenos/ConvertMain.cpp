@@ -0,0 +1,154 @@
+//
+// ConvertMain.cpp
+//
+// Entry point of kenos-convert, converts scene files and bake stats between text JSON, CBOR and
+// MessagePack. The input format is detected from the file, the output format is given or taken from the
+// extension of the output. Every key is kept, scene files are checked against the scene schema after
+// they are written. Only built by CMake (see CMakeLists.txt).
+//
+
+#include "pch.h"
+
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "DocumentFormat.h"
+#include "SceneDescription.h"
+
+using json = nlohmann::json;
+
+using namespace std;
+
+namespace
+{
+	struct ConvertOptions {
+		string inputPath;
+		string outputPath;
+
+		bool hasFormat = false;
+		DocumentFormat format = KS_DOCFORMAT_JSON;
+
+		// Keep numbers that do not fit a float as doubles in binary output
+		bool keepDoubles = false;
+	};
+
+	void PrintUsage() {
+		fprintf(stderr,
+			"usage: kenos-convert <input> <output> [options]\n"
+			"  -f, --format <fmt>          output format: json, cbor or msgpack (default from the output\n"
+			"                              extension, .json, .cbor or .msgpack)\n"
+			"      --keep-doubles          keep double precision numbers in binary output, by default they\n"
+			"                              are rounded to floats like the engine reads them\n");
+	}
+
+	bool ParseOptions(int argc, char** argv, ConvertOptions& options) {
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+
+			if ((arg == "-f" || arg == "--format") && hasValue) {
+				if (!ParseDocumentFormat(argv[++i], options.format)) {
+					return false;
+				}
+				options.hasFormat = true;
+			}
+			else if (arg == "--keep-doubles") {
+				options.keepDoubles = true;
+			}
+			else if (!arg.empty() && arg[0] != '-' && options.inputPath.empty()) {
+				options.inputPath = arg;
+			}
+			else if (!arg.empty() && arg[0] != '-' && options.outputPath.empty()) {
+				options.outputPath = arg;
+			}
+			else {
+				return false;
+			}
+		}
+
+		return !options.inputPath.empty() && !options.outputPath.empty();
+	}
+
+	bool EndsWith(const string& s, const string& suffix) {
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	bool FormatFromExtension(const string& path, DocumentFormat& format) {
+		const DocumentFormat formats[] = { KS_DOCFORMAT_JSON, KS_DOCFORMAT_CBOR, KS_DOCFORMAT_MSGPACK };
+
+		for (DocumentFormat f : formats) {
+			if (EndsWith(path, GetDocumentFormatExtension(f))) {
+				format = f;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Numbers the engine reads as floats. Binary output rounds them to floats so they are stored in 4
+	// bytes, text output writes the floats among them (like those from a binary file) as short decimals.
+	void NormalizeFloats(json& node, DocumentFormat format, bool keepDoubles) {
+		if (node.is_number_float()) {
+			double value = node.get<double>();
+			bool isFloat = (double)(float)value == value;
+
+			if (isFloat || (format != KS_DOCFORMAT_JSON && !keepDoubles)) {
+				node = MakeDocumentFloat((float)value, format);
+			}
+		}
+		else if (node.is_structured()) {
+			for (json& child : node) {
+				NormalizeFloats(child, format, keepDoubles);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	ConvertOptions options;
+
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return 2;
+	}
+
+	if (!options.hasFormat && !FormatFromExtension(options.outputPath, options.format)) {
+		fprintf(stderr, "Can not tell the format of '%s' from its extension, pass --format\n", options.outputPath.c_str());
+		return 2;
+	}
+
+	json doc;
+	string error;
+
+	if (!ReadDocument(options.inputPath, doc, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	NormalizeFloats(doc, options.format, options.keepDoubles);
+
+	if (!WriteDocument(options.outputPath, doc, options.format, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	// Make sure a converted scene still loads
+	if (doc.is_object() && doc.contains("sceneName")) {
+		SceneDescription scene;
+
+		if (!ReadSceneDescription(options.outputPath, scene, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+
+		printf("%s: scene '%s', %zu meshes, %zu materials, %zu objects\n", options.outputPath.c_str(),
+			scene.sceneName.c_str(), scene.meshes.size(), scene.materials.size(), scene.objects.size());
+	}
+	else {
+		printf("%s: %s\n", options.outputPath.c_str(), GetDocumentFormatName(options.format));
+	}
+
+	return 0;
+}
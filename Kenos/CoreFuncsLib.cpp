@@ -16,7 +16,15 @@ using namespace std;
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
-using Microsoft::WRL::ComPtr;
+void FatalError(const string& message) {
+#ifdef KS_HEADLESS
+	fprintf(stderr, "Fatal error: %s\n", message.c_str());
+	exit(1);
+#else
+	MessageBoxA(NULL, message.c_str(), "Fatal error", MB_ICONERROR | MB_OK);
+	exit(0);
+#endif
+}
 
 bool BVHintesects(const Ray& ray, const Vector3& Vmin, const Vector3& Vmax) {
 	float tmin, tmax, tymin, tymax, tzmin, tzmax;
@@ -75,9 +83,9 @@ XMMATRIX CreateTransformTo2D(XMVECTOR planeCoefficients, Vector3 upDirection) {
 
 	// Create the transformation matrix using the right, up, and normal vectors, along with the translation components
 	XMMATRIX transformMatrix = {
-		right.m128_f32[0], up.m128_f32[0], normal.m128_f32[0], translationRight,
-		right.m128_f32[1], up.m128_f32[1], normal.m128_f32[1], translationUp,
-		right.m128_f32[2], up.m128_f32[2], normal.m128_f32[2], translationNormal,
+		XMVectorGetX(right), XMVectorGetX(up), XMVectorGetX(normal), translationRight,
+		XMVectorGetY(right), XMVectorGetY(up), XMVectorGetY(normal), translationUp,
+		XMVectorGetZ(right), XMVectorGetZ(up), XMVectorGetZ(normal), translationNormal,
 		0.0f, 0.0f, 0.0f, 1.0f
 	};
 
@@ -11,9 +11,14 @@
 #include <DirectXMath.h>
 #include <vector>
 #include <algorithm>
+#include <string>
 
 using DXVector3 = DirectX::SimpleMath::Vector3;
 
+// Report an error the engine cannot recover from and exit. Shows a message box in the windowed
+// build and prints to stderr in headless builds (KS_HEADLESS).
+[[noreturn]] void FatalError(const std::string& message);
+
 bool BVHintesects(const DirectX::SimpleMath::Ray& ray, const DXVector3& min, const DXVector3& max);
 
 DirectX::XMMATRIX CreateTransformTo3D(DirectX::XMVECTOR planeCoefficients, DXVector3 upDirection);
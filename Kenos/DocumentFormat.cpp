@@ -0,0 +1,180 @@
+#include "pch.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+#include "DocumentFormat.h"
+
+using json = nlohmann::json;
+
+using namespace std;
+
+DocumentFormat DetectDocumentFormat(const uint8_t* data, size_t size, size_t& headerSize) {
+	headerSize = 0;
+
+	if (size == 0) {
+		return KS_DOCFORMAT_JSON;
+	}
+
+	// CBOR files may start with the self-describe tag 55799 before the map
+	if (size >= 3 && data[0] == 0xd9 && data[1] == 0xd9 && data[2] == 0xf7) {
+		headerSize = 3;
+		return KS_DOCFORMAT_CBOR;
+	}
+
+	uint8_t first = data[0];
+
+	// CBOR maps are major type 5, 0xa0 to 0xbf with 0xbf the indefinite length one
+	if (first >= 0xa0 && first <= 0xbf) {
+		return KS_DOCFORMAT_CBOR;
+	}
+
+	// MessagePack fixmap, map 16 and map 32
+	if ((first >= 0x80 && first <= 0x8f) || first == 0xde || first == 0xdf) {
+		return KS_DOCFORMAT_MSGPACK;
+	}
+
+	// Anything else is left to the JSON parser, '{', whitespace or a byte order mark
+	return KS_DOCFORMAT_JSON;
+}
+
+bool ParseDocumentFormat(const string& name, DocumentFormat& format) {
+	if (name == "json") {
+		format = KS_DOCFORMAT_JSON;
+	}
+	else if (name == "cbor") {
+		format = KS_DOCFORMAT_CBOR;
+	}
+	else if (name == "msgpack") {
+		format = KS_DOCFORMAT_MSGPACK;
+	}
+	else {
+		return false;
+	}
+
+	return true;
+}
+
+const char* GetDocumentFormatName(DocumentFormat format) {
+	switch (format) {
+	case KS_DOCFORMAT_CBOR:
+		return "cbor";
+	case KS_DOCFORMAT_MSGPACK:
+		return "msgpack";
+	default:
+		return "json";
+	}
+}
+
+const char* GetDocumentFormatExtension(DocumentFormat format) {
+	switch (format) {
+	case KS_DOCFORMAT_CBOR:
+		return ".cbor";
+	case KS_DOCFORMAT_MSGPACK:
+		return ".msgpack";
+	default:
+		return ".json";
+	}
+}
+
+json MakeDocumentFloat(float value, DocumentFormat format) {
+	if (format != KS_DOCFORMAT_JSON || !isfinite(value)) {
+		return (double)value;
+	}
+
+	char text[32];
+	for (int digits = 6; digits <= 9; digits++) {
+		snprintf(text, sizeof(text), "%.*g", digits, value);
+
+		if (strtof(text, nullptr) == value) {
+			return strtod(text, nullptr);
+		}
+	}
+
+	return (double)value;
+}
+
+bool ReadDocumentFile(const string& path, vector<uint8_t>& data) {
+	ifstream f(path, ios::binary | ios::ate);
+	if (!f.good()) {
+		return false;
+	}
+
+	streamoff size = f.tellg();
+	if (size < 0) {
+		return false;
+	}
+
+	data.resize((size_t)size);
+
+	f.seekg(0);
+	f.read((char*)data.data(), size);
+
+	return f.good() || (size == 0 && f.eof());
+}
+
+bool ReadDocument(const string& path, json& doc, string& error) {
+	vector<uint8_t> data;
+
+	if (!ReadDocumentFile(path, data)) {
+		error = "File '" + path + "' does not exist!";
+		return false;
+	}
+
+	size_t headerSize;
+	DocumentFormat format = DetectDocumentFormat(data.data(), data.size(), headerSize);
+
+	const uint8_t* begin = data.data() + headerSize;
+	const uint8_t* end = data.data() + data.size();
+
+	try {
+		switch (format) {
+		case KS_DOCFORMAT_CBOR:
+			doc = json::from_cbor(begin, end);
+			break;
+		case KS_DOCFORMAT_MSGPACK:
+			doc = json::from_msgpack(begin, end);
+			break;
+		default:
+			doc = json::parse(begin, end);
+			break;
+		}
+	}
+	catch (const json::exception& ex) {
+		error = "File '" + path + "' is not valid " + GetDocumentFormatName(format) + ": " + ex.what();
+		return false;
+	}
+
+	return true;
+}
+
+vector<uint8_t> EncodeDocument(const json& doc, DocumentFormat format) {
+	switch (format) {
+	case KS_DOCFORMAT_CBOR:
+		return json::to_cbor(doc);
+	case KS_DOCFORMAT_MSGPACK:
+		return json::to_msgpack(doc);
+	default: {
+		string text = doc.dump(4);
+		text += '\n';
+		return vector<uint8_t>(text.begin(), text.end());
+	}
+	}
+}
+
+bool WriteDocument(const string& path, const json& doc, DocumentFormat format, string& error) {
+	vector<uint8_t> data = EncodeDocument(doc, format);
+
+	ofstream f(path, ios::binary | ios::trunc);
+	f.write((const char*)data.data(), data.size());
+
+	if (!f.good()) {
+		error = "Could not write '" + path + "'!";
+		return false;
+	}
+
+	return true;
+}
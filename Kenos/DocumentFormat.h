@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <nlohmann/json_fwd.hpp>
+
+/*
+* Kenos documents, scene files and bake stats, in text JSON or in one of the binary encodings of
+* nlohmann::json.
+*
+* Every document has a map at the top level. CBOR and MessagePack maps start with bytes no JSON text
+* starts with, so readers tell the formats apart by the first byte and files can be given any name.
+* Numbers in binary documents are stored as binary floats, there is no text to parse, and floats that
+* fit in 32 bits take 4 bytes.
+*/
+
+enum DocumentFormat {
+	KS_DOCFORMAT_JSON,
+	KS_DOCFORMAT_CBOR,
+	KS_DOCFORMAT_MSGPACK
+};
+
+// Format of the document in data from its first bytes. headerSize is set to the bytes in front of the
+// document that readers have to skip, the CBOR self-describe tag.
+DocumentFormat DetectDocumentFormat(const uint8_t* data, size_t size, size_t& headerSize);
+
+// The format called name, "json", "cbor" or "msgpack". Returns false for anything else.
+bool ParseDocumentFormat(const std::string& name, DocumentFormat& format);
+const char* GetDocumentFormatName(DocumentFormat format);
+
+// File extension with the dot, ".json", ".cbor" or ".msgpack"
+const char* GetDocumentFormatExtension(DocumentFormat format);
+
+// A float as a document number. Binary formats store it exactly in 4 bytes. Text gets the shortest
+// decimal that reads back as the same float, so 0.1f is written as 0.1 and not 0.10000000149011612.
+nlohmann::json MakeDocumentFloat(float value, DocumentFormat format);
+
+// Read the whole file at path into data. Returns false if it could not be read.
+bool ReadDocumentFile(const std::string& path, std::vector<uint8_t>& data);
+
+// Read the document at path in whatever format it is. Returns false with the reason in error if the
+// file could not be read or is not a valid document.
+bool ReadDocument(const std::string& path, nlohmann::json& doc, std::string& error);
+
+// Encode doc in format, text JSON is indented by 4 spaces
+std::vector<uint8_t> EncodeDocument(const nlohmann::json& doc, DocumentFormat format);
+
+// Write doc to path in format. Returns false with the reason in error if the file could not be written.
+bool WriteDocument(const std::string& path, const nlohmann::json& doc, DocumentFormat format, std::string& error);
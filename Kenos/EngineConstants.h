@@ -43,4 +43,43 @@
 #define KS_MIN_LIGHTNESS 0.1f
 
 // Side length of sample grid for shadows. Compute time expands KS_SHADOW_SAMPLES^2
-#define KS_SHADOW_SAMPLES 10
\ No newline at end of file
+#define KS_SHADOW_SAMPLES 10
+
+// Number of threads used to bake the light tree. 0 uses every hardware thread.
+#define KS_BAKE_THREADS 0
+
+// Number of threads importing meshes and building objects when a scene file is loaded. 0 uses every
+// hardware thread.
+#define KS_LOAD_THREADS 0
+
+// OBJ files are split into chunks of about this many bytes that are parsed in parallel, see ObjLoader.h.
+// Files smaller than a chunk are parsed on the calling thread.
+#define KS_OBJ_CHUNK_BYTES (4 << 20)
+
+// Number of caster surfaces tested together against each tile of recievers in the visibility pass.
+#define KS_VIS_CASTER_TILE 64
+
+// Number of reciever surfaces per visibility tile. Each reciever takes 36 bytes so this should keep
+// a tile in L2.
+#define KS_VIS_RECEIVER_TILE 4096
+
+// Default VisibilityMode of the visibility pass, 1 is KS_VISMODE_BVH.
+#define KS_VISIBILITY_MODE 1
+
+// Default LightPackingMode of UpdateFinalRDFBuffer, 1 is KS_LIGHTPACK_IMPORTANCE.
+#define KS_LIGHT_PACKING_MODE 1
+
+// UpdateFinalRDFBuffer hands out one range over every surface once more than this fraction of them is
+// dirty, a single upload of the whole buffer is cheaper than that many small ones.
+#define KS_FULL_UPLOAD_FRACTION 0.25f
+
+// Dirty surfaces at most this many clean surfaces apart end up in the same dirty range, uploading a few
+// clean surfaces costs less than an extra upload call.
+#define KS_DIRTY_RANGE_MERGE_GAP 16
+
+// Maximum number of triangles in a leaf of the visibility BVH.
+#define KS_BVH_LEAF_SIZE 32
+
+// UpdateLightTree compacts the jumble map once more than this fraction of it has been released, and
+// the visibility stores once this fraction of them is garbage.
+#define KS_RDF_COMPACT_FRACTION 0.25f
\ No newline at end of file
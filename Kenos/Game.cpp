@@ -4,6 +4,7 @@
 
 #include "pch.h"
 #include "Game.h"
+#include "ProfilingLib.h"
 
 extern void ExitGame() noexcept;
 
@@ -61,7 +62,18 @@ void Game::Initialize(HWND window, int width, int height)
 
     InitStructuredBuffers();
 
-    localSceneLightingInformation.BuildLightTree();
+    // Reuse the bake from the last run if nothing it depends on has changed, otherwise bake now and
+    // save it for next time.
+    string bakePath = localSceneInformation.getScenePath() + KS_BAKE_EXTENSION;
+
+    if (!localSceneLightingInformation.LoadBake(bakePath)) {
+        localSceneLightingInformation.BuildLightTree();
+        localSceneLightingInformation.SaveBake(bakePath);
+    }
+
+    // Debug builds keep a trace of the startup next to the scene, open it in chrome://tracing
+    WriteProfileTrace(localSceneInformation.getScenePath() + ".trace.json");
+
 	buffer_should_update = true;
 
     // TODO: Change the timer settings if you want something other than the default variable timestep mode.
@@ -82,10 +94,12 @@ void Game::Initialize(HWND window, int width, int height)
 void Game::InitStructuredBuffers() {
 
     // Lightmap directory buffer
+    // Default usage so UpdateStructuredBuffers can update only the ranges that changed, a dynamic buffer
+    // can only be mapped whole with WRITE_DISCARD
     D3D11_BUFFER_DESC sbDesc;
     sbDesc.ByteWidth = sizeof(SurfaceLightmapDirectoryPacked) * localSceneInformation.getGlobalPolyCount();
-    sbDesc.Usage = D3D11_USAGE_DYNAMIC;
-    sbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    sbDesc.Usage = D3D11_USAGE_DEFAULT;
+    sbDesc.CPUAccessFlags = 0;
     sbDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
     sbDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
     sbDesc.StructureByteStride = sizeof(SurfaceLightmapDirectoryPacked);
@@ -206,28 +220,17 @@ void Game::InitVertexBuffer() {
     XMFLOAT4X4 projDebug;
     XMStoreFloat4x4(&projDebug, XMMatrixTranspose(localCam.projectionMatrix));
 
+    // world space geometry was already transformed when the scene was compiled
+    const CompiledSceneGeometry& geo = localSceneInformation.getCompiledGeometry();
+
     // load vertex data into buffer
     for (int i = 0; i < faceCount; i++) {
-		// get the vertex data from the scene
-        tuple<Vector3, Vector3, Vector3> face = localSceneInformation.getTribyGlobalIndex(i);
-
-        // temp debug transforms
-        Vector3 v1 = get<0>(face);
-        v1 = XMVector3Transform(v1, localCam.viewMatrix);
-        v1 = XMVector3Transform(v1, localCam.projectionMatrix);
-
 		// store the vertex data in the buffer
-        init_vertex_data[(9 * i) + 0] = get<0>(face).x;
-        init_vertex_data[(9 * i) + 1] = get<0>(face).y;
-        init_vertex_data[(9 * i) + 2] = get<0>(face).z;
-
-        init_vertex_data[(9 * i) + 3] = get<1>(face).x;
-        init_vertex_data[(9 * i) + 4] = get<1>(face).y;
-        init_vertex_data[(9 * i) + 5] = get<1>(face).z;
-
-        init_vertex_data[(9 * i) + 6] = get<2>(face).x;
-        init_vertex_data[(9 * i) + 7] = get<2>(face).y;
-        init_vertex_data[(9 * i) + 8] = get<2>(face).z;
+        for (int k = 0; k < 3; k++) {
+            init_vertex_data[(9 * i) + (3 * k) + 0] = geo.cornerX[k][i];
+            init_vertex_data[(9 * i) + (3 * k) + 1] = geo.cornerY[k][i];
+            init_vertex_data[(9 * i) + (3 * k) + 2] = geo.cornerZ[k][i];
+        }
 	}
 
     D3D11_SUBRESOURCE_DATA vertexBufferData;
@@ -336,66 +339,32 @@ void Game::SetShouldUpdate(bool should) {
 }
 
 void Game::UpdateStructuredBuffers() {
+    // Only the surfaces packed since the last upload are sent, once enough of them changed the lighting
+    // hands out one range over every surface. UpdateSubresource copies the source right away so the
+    // scratch buffer can be reused for the next range.
+    size_t dirStride = sizeof(SurfaceLightmapDirectoryPacked);
+    size_t lightmapStride = sizeof(SurfLight) * KS_MAX_SURFACE_LIGHTS;
+
+    const std::vector<SurfaceLightmapDirectoryPacked>& directories = localSceneLightingInformation.GetDirectoryBufferView();
+
+    for (const PackedSurfaceRange& range : localSceneLightingInformation.GetDirtyRanges()) {
+        //  1. Update lightmap directory buffer, the packed directories already have the GPU layout
+        D3D11_BOX dirBox = { (UINT)(range.first * dirStride), 0, 0, (UINT)((range.first + range.count) * dirStride), 1, 1 };
+        m_d3dContext->UpdateSubresource(lightmapDirBufferPtr, 0, &dirBox, directories.data() + range.first, 0, 0);
+
+        //  2. Update lightmap data buffer, KS_MAX_SURFACE_LIGHTS slots per surface
+        size_t bytes = range.count * lightmapStride;
+        if (lightmapUploadBuffer.size() < bytes) {
+            lightmapUploadBuffer.resize(bytes);
+        }
 
-    //  1. Update lightmap directory buffer
-    vector<SurfaceLightmapDirectoryPacked> newDirs = localSceneLightingInformation.GetDirectoryBuffer();
-
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    ZeroMemory(&mappedResource, sizeof(D3D11_MAPPED_SUBRESOURCE));
-
-    int lightmapCount = newDirs.size();
-
-    SurfaceLightmapDirectoryPacked* dataPtr = new SurfaceLightmapDirectoryPacked[lightmapCount];
-
-    ZeroMemory(dataPtr, sizeof(SurfaceLightmapDirectoryPacked) * lightmapCount);
-
-    for (int i = 0; i < lightmapCount; i++) {
-		dataPtr[i] = newDirs[i];
-	}
-
-    m_d3dContext->Map(lightmapDirBufferPtr, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-
-    memcpy(mappedResource.pData, dataPtr, sizeof(SurfaceLightmapDirectoryPacked) * lightmapCount);
-
-    m_d3dContext->Unmap(lightmapDirBufferPtr, 0);
-
-    delete[] dataPtr;
-
-
-
-    //  2. Update lightmap data buffer
-    map<int, vector<SurfLight>> newLightmap = localSceneLightingInformation.GetFinalLightmapBuffer();
-
-    D3D11_MAPPED_SUBRESOURCE mappedResource2; // no idea if we can reuse the old one or not
-    ZeroMemory(&mappedResource2, sizeof(D3D11_MAPPED_SUBRESOURCE));
-
-    int pcount = localSceneInformation.getGlobalPolyCount();
-
-    SurfLight* dataPtr2 = new SurfLight[pcount * KS_MAX_SURFACE_LIGHTS];
-
-    ZeroMemory(dataPtr2, sizeof(SurfLight) * pcount * KS_MAX_SURFACE_LIGHTS);
-
-    for (int i = 0; i < pcount; i++) {
-        vector<SurfLight> currSurfLights = newLightmap[i];
-        int lightCount = currSurfLights.size();
+        localSceneLightingInformation.PackLightmapBuffer(lightmapUploadBuffer.data(), lightmapStride, range);
 
-        for (int j = 0; j < KS_MAX_SURFACE_LIGHTS; j++) {
-			// Check if the surface light exists
-            if (j < lightCount) {
-                dataPtr2[i * KS_MAX_SURFACE_LIGHTS + j] = currSurfLights[j];
-            }
-            // Otherwise we could add an empty light, but we can just leave it as
-            // random garbage since the shader will ignore it anyway
-		}
+        D3D11_BOX lightmapBox = { (UINT)(range.first * lightmapStride), 0, 0, (UINT)(range.first * lightmapStride + bytes), 1, 1 };
+        m_d3dContext->UpdateSubresource(lightMapBufferPtr, 0, &lightmapBox, lightmapUploadBuffer.data(), 0, 0);
     }
 
-    m_d3dContext->Map(lightMapBufferPtr, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource2);
-
-    memcpy(mappedResource2.pData, dataPtr2, sizeof(SurfLight) * pcount * KS_MAX_SURFACE_LIGHTS);
-
-    m_d3dContext->Unmap(lightMapBufferPtr, 0);
-
-    delete[] dataPtr2;
+    localSceneLightingInformation.ClearDirtyRanges();
 }
 
 // Get the current camera matrices and map into constant buffer
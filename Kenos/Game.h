@@ -134,6 +134,10 @@ private:
     // does vertex buffer need to be rewritten? saves time when camera isnt moved
     bool buffer_should_update;
 
+    // The dirty lightmap ranges are packed in here before they are uploaded, sized for the largest
+    // range so far
+    std::vector<uint8_t> lightmapUploadBuffer;
+
     // Flags used for internal stuff
     UINT flags;
     
@@ -1,5 +1,3 @@
-#pragma once
-
 #include "pch.h"
 #include <DirectXMath.h>
 #include <SimpleMath.h>
@@ -7,8 +5,6 @@
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
-using Microsoft::WRL::ComPtr;
-
 #include "Material.h"
 
 Material::Material() {
@@ -0,0 +1,86 @@
+#include "pch.h"
+
+#include <cstdio>
+
+#include "MemoryUsage.h"
+
+using namespace std;
+
+namespace
+{
+	void AppendLines(const MemoryUsage& usage, int depth, string& out) {
+		char line[64];
+		snprintf(line, sizeof(line), "%14zu  ", usage.GetTotalBytes());
+
+		out += line;
+		out.append(depth * 2, ' ');
+		out += usage.name;
+		out += '\n';
+
+		for (const MemoryUsage& child : usage.children) {
+			AppendLines(child, depth + 1, out);
+		}
+	}
+}
+
+MemoryUsage::MemoryUsage() :
+	bytes(0)
+{
+}
+
+MemoryUsage::MemoryUsage(const string& name, size_t bytes) :
+	name(name),
+	bytes(bytes)
+{
+}
+
+size_t MemoryUsage::GetTotalBytes() const {
+	size_t total = bytes;
+
+	for (const MemoryUsage& child : children) {
+		total += child.GetTotalBytes();
+	}
+
+	return total;
+}
+
+MemoryUsage& MemoryUsage::Add(const string& childName, size_t childBytes) {
+	children.push_back(MemoryUsage(childName, childBytes));
+	return children.back();
+}
+
+MemoryUsage& MemoryUsage::Add(const MemoryUsage& child) {
+	children.push_back(child);
+	return children.back();
+}
+
+const MemoryUsage* MemoryUsage::Find(const string& path) const {
+	size_t split = path.find('/');
+	string first = path.substr(0, split);
+
+	for (const MemoryUsage& child : children) {
+		if (child.name == first) {
+			return split == string::npos ? &child : child.Find(path.substr(split + 1));
+		}
+	}
+
+	return nullptr;
+}
+
+string MemoryUsage::ToString() const {
+	string out;
+	AppendLines(*this, 0, out);
+	return out;
+}
+
+size_t StringBytes(const string& s) {
+	// Short strings live inside the object, only count the buffer when it is somewhere else
+	const char* data = s.data();
+	const char* object = (const char*)&s;
+
+	if (data >= object && data < object + sizeof(string)) {
+		return 0;
+	}
+
+	return s.capacity() + 1;
+}
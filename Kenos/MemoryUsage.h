@@ -0,0 +1,59 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+* Kenos memory accounting, a tree of named categories with the bytes each one holds.
+*
+* Sizes are the bytes asked of the allocator: vector capacities (not sizes), heap buffers of strings,
+* and map nodes with KS_MAP_NODE_OVERHEAD added for the links of every node. What the allocator adds on
+* top of that is not counted. The bytes of the objects themselves are counted by whatever holds them,
+* a vector of vectors counts sizeof(vector) per element and then the buffer of every element.
+*/
+
+// Links and colour of a std::map node, three pointers and a flag padded to a pointer in both MSVC and
+// libstdc++
+#define KS_MAP_NODE_OVERHEAD (4 * sizeof(void*))
+
+struct MemoryUsage {
+	std::string name;
+
+	// Bytes of this category itself, not counting the children
+	size_t bytes;
+
+	std::vector<MemoryUsage> children;
+
+	MemoryUsage();
+	explicit MemoryUsage(const std::string& name, size_t bytes = 0);
+
+	// bytes plus the total of every child
+	size_t GetTotalBytes() const;
+
+	// Add a child category and return it, the reference is only valid until the next Add
+	MemoryUsage& Add(const std::string& childName, size_t childBytes = 0);
+	MemoryUsage& Add(const MemoryUsage& child);
+
+	// Category under this one by a path of names separated by '/', like "jumbleMap/childArena".
+	// nullptr if there is none.
+	const MemoryUsage* Find(const std::string& path) const;
+
+	// One line per category with its total, children indented under their parent
+	std::string ToString() const;
+};
+
+// Bytes of the buffer of v, the vector object itself is counted by whatever holds it
+template <typename T>
+size_t VectorBytes(const std::vector<T>& v) {
+	return v.capacity() * sizeof(T);
+}
+
+// Bytes of the heap buffer of s, 0 while the string fits in the object itself
+size_t StringBytes(const std::string& s);
+
+// Bytes of the nodes of m, what the keys and values point to is not included
+template <typename K, typename V>
+size_t MapNodeBytes(const std::map<K, V>& m) {
+	return m.size() * (sizeof(typename std::map<K, V>::value_type) + KS_MAP_NODE_OVERHEAD);
+}
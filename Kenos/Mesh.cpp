@@ -1,6 +1,7 @@
 #include "pch.h"
 #include <DirectXMath.h>
 #include <SimpleMath.h>
+#include <utility>
 #include <vector>
 
 #include "Mesh.h"
@@ -9,19 +10,17 @@ using namespace std;
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
-using Microsoft::WRL::ComPtr;
-
 // Default constructor
 Mesh::Mesh()
 {
 	// Default implementation
 }
 
-Mesh::Mesh(vector<Vector3> vertices, vector<Vector3> indices)
+Mesh::Mesh(vector<Vector3> vertices, vector<uint32_t> indices)
 {
 	// Set member variables
-	m_vertices = vertices;
-	m_indices = indices;
+	m_vertices = std::move(vertices);
+	SetIndices(std::move(indices));
     
 }
 
@@ -51,23 +50,49 @@ int Mesh::GetVertexCount() const
     return m_vertices.size();
 }
 
-void Mesh::SetIndices(const Vector3 indices[])
+void Mesh::SetIndices(vector<uint32_t> indices)
 {
-    m_indices.clear();
+    uint32_t maxIndex = 0;
+    for (uint32_t index : indices)
+    {
+        maxIndex = max(maxIndex, index);
+    }
 
-    // Assuming the indices array is null-terminated
-    for (int i = 0; indices[i].x != 0.0f || indices[i].y != 0.0f || indices[i].z != 0.0f; ++i)
+    if (maxIndex <= UINT16_MAX)
     {
-        m_indices.push_back(indices[i]);
+        SetIndices(vector<uint16_t>(indices.begin(), indices.end()));
+        return;
     }
+
+    m_indices16.clear();
+    m_indices16.shrink_to_fit();
+    m_indices32 = std::move(indices);
 }
 
-const Vector3 Mesh::GetIndex(int idx) const
+void Mesh::SetIndices(vector<uint16_t> indices)
 {
-    return m_indices[idx];
+    m_indices32.clear();
+    m_indices32.shrink_to_fit();
+    m_indices16 = std::move(indices);
 }
 
 int Mesh::GetFaceCount() const
 {
-	return m_indices.size();
+	return (int)((m_indices16.size() + m_indices32.size()) / 3);
+}
+
+const vector<uint16_t>& Mesh::GetIndices16() const
+{
+    return m_indices16;
+}
+
+const vector<uint32_t>& Mesh::GetIndices32() const
+{
+    return m_indices32;
+}
+
+size_t Mesh::GetMemoryUsage() const
+{
+    return m_vertices.capacity() * sizeof(Vector3) + m_indices16.capacity() * sizeof(uint16_t) +
+        m_indices32.capacity() * sizeof(uint32_t);
 }
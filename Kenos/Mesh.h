@@ -1,27 +1,64 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <DirectXMath.h>
 
+// The vertex indices of a triangle
+struct MeshFace {
+    uint32_t indices[3];
+
+    uint32_t operator[](int k) const { return indices[k]; }
+};
+
+/*
+* Faces are stored as 3 indices each, packed as uint16 when every index fits (meshes with up to 65536
+* vertices) and as uint32 otherwise. SetIndices picks the width, exactly one of the two buffers holds
+* the faces of a mesh.
+*/
 class Mesh
 {
 public:
 	Mesh();
-    Mesh(std::vector<DirectX::SimpleMath::Vector3> vertices, std::vector<DirectX::SimpleMath::Vector3> indices);
+    Mesh(std::vector<DirectX::SimpleMath::Vector3> vertices, std::vector<uint32_t> indices);
     ~Mesh();
 
+    // The destructor would otherwise hide the moves, meshes are moved into the scene after loading
+    Mesh(const Mesh&) = default;
+    Mesh(Mesh&&) = default;
+    Mesh& operator=(const Mesh&) = default;
+    Mesh& operator=(Mesh&&) = default;
+
     void SetVertices(const DirectX::SimpleMath::Vector3 vertices[]);
     const DirectX::SimpleMath::Vector3 GetVert(int idx) const;
     int GetVertexCount() const;
 
-    void SetIndices(const DirectX::SimpleMath::Vector3 indices[]);
-    const DirectX::SimpleMath::Vector3 GetIndex(int idx) const;
+    // Set the faces, 3 indices per face. Stored as uint16 if every index fits.
+    void SetIndices(std::vector<uint32_t> indices);
+    void SetIndices(std::vector<uint16_t> indices);
+
+    MeshFace GetIndex(int idx) const {
+        if (!m_indices16.empty()) {
+            const uint16_t* face = &m_indices16[idx * 3];
+            return MeshFace{ { face[0], face[1], face[2] } };
+        }
+
+        const uint32_t* face = &m_indices32[idx * 3];
+        return MeshFace{ { face[0], face[1], face[2] } };
+    }
+
     int GetFaceCount() const;
 
+    // The index buffers, 3 per face. One of them is always empty.
+    const std::vector<uint16_t>& GetIndices16() const;
+    const std::vector<uint32_t>& GetIndices32() const;
+
+    // Bytes of the vertex and index buffers
+    size_t GetMemoryUsage() const;
+
     std::vector<DirectX::SimpleMath::Vector3> m_vertices;
-    std::vector<DirectX::SimpleMath::Vector3> m_indices;
 
 private:
-    // The vertices and indeces should probably be private but i dont want to 
-    // engage in pointer shenaningans right now for the sake of optimization
-};
\ No newline at end of file
+    std::vector<uint16_t> m_indices16;
+    std::vector<uint32_t> m_indices32;
+};
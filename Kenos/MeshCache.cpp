@@ -0,0 +1,111 @@
+#include "pch.h"
+
+#include <vector>
+
+#include "BakeCache.h"
+#include "MeshCache.h"
+#include "ProfilingLib.h"
+
+using namespace std;
+using namespace DirectX::SimpleMath;
+
+namespace
+{
+	struct MeshCacheMeta {
+		uint64_t vertexCount;
+		uint64_t faceCount;
+
+		// HashBytes of the vertex array and then the index array, a damaged cache is not loaded
+		uint64_t contentHash;
+	};
+
+	uint64_t HashMeshContent(const Vector3* vertices, uint64_t vertexCount, const void* indices, size_t indexBytes) {
+		uint64_t hash = HashBytes(vertices, vertexCount * sizeof(Vector3));
+		return HashBytes(indices, indexBytes, hash);
+	}
+}
+
+uint64_t ComputeMeshCacheKey(const string& path, uint32_t importFlags, uint64_t& fileHash) {
+	fileHash = KS_HASH_SEED;
+	if (!HashFile(path, fileHash)) {
+		fileHash = 0;
+		return 0;
+	}
+
+	uint32_t settings[2] = { importFlags, KS_MESH_CACHE_VERSION };
+	uint64_t key = HashBytes(settings, sizeof(settings), fileHash);
+
+	// 0 is kept for no key
+	return key == 0 ? 1 : key;
+}
+
+bool LoadMeshCache(const string& cachePath, uint64_t key, Mesh& mesh) {
+	KS_PROFILE_ZONE("LoadMeshCache");
+
+	BakeFile in;
+	if (!in.Open(cachePath, key)) {
+		return false;
+	}
+
+	uint64_t metaCount;
+	uint64_t vertexCount;
+	uint64_t indexCount16;
+	uint64_t indexCount32;
+	const MeshCacheMeta* meta = in.GetSection<MeshCacheMeta>(KS_BAKESECTION_MESH_META, metaCount);
+	const Vector3* vertices = in.GetSection<Vector3>(KS_BAKESECTION_MESH_VERTICES, vertexCount);
+	const uint16_t* indices16 = in.GetSection<uint16_t>(KS_BAKESECTION_MESH_INDICES16, indexCount16);
+	const uint32_t* indices32 = in.GetSection<uint32_t>(KS_BAKESECTION_MESH_INDICES, indexCount32);
+
+	// The indices are saved in the width the mesh stores them in, one of the two sections
+	if (meta == nullptr || metaCount != 1 || vertices == nullptr || (indices16 == nullptr) == (indices32 == nullptr)) {
+		return false;
+	}
+
+	uint64_t indexCount = indices16 != nullptr ? indexCount16 : indexCount32;
+	size_t indexBytes = indices16 != nullptr ? indexCount * sizeof(uint16_t) : indexCount * sizeof(uint32_t);
+	const void* indices = indices16 != nullptr ? (const void*)indices16 : (const void*)indices32;
+
+	if (meta->vertexCount != vertexCount || meta->faceCount * 3 != indexCount ||
+		meta->contentHash != HashMeshContent(vertices, vertexCount, indices, indexBytes)) {
+		return false;
+	}
+
+	// Copied straight out of the mapping into presized storage
+	mesh.m_vertices.assign(vertices, vertices + vertexCount);
+	if (indices16 != nullptr) {
+		mesh.SetIndices(vector<uint16_t>(indices16, indices16 + indexCount));
+	}
+	else {
+		mesh.SetIndices(vector<uint32_t>(indices32, indices32 + indexCount));
+	}
+
+	return true;
+}
+
+bool SaveMeshCache(const string& cachePath, uint64_t key, const Mesh& mesh) {
+	BakeFileWriter out;
+	if (!out.Open(cachePath, key)) {
+		return false;
+	}
+
+	const vector<uint16_t>& indices16 = mesh.GetIndices16();
+	const vector<uint32_t>& indices32 = mesh.GetIndices32();
+	bool is16 = indices32.empty();
+
+	const void* indices = is16 ? (const void*)indices16.data() : (const void*)indices32.data();
+	size_t indexBytes = is16 ? indices16.size() * sizeof(uint16_t) : indices32.size() * sizeof(uint32_t);
+
+	MeshCacheMeta meta = { mesh.m_vertices.size(), (uint64_t)mesh.GetFaceCount(),
+		HashMeshContent(mesh.m_vertices.data(), mesh.m_vertices.size(), indices, indexBytes) };
+
+	out.WriteSection(KS_BAKESECTION_MESH_META, &meta, sizeof(meta), 1);
+	out.WriteSection(KS_BAKESECTION_MESH_VERTICES, mesh.m_vertices);
+	if (is16) {
+		out.WriteSection(KS_BAKESECTION_MESH_INDICES16, indices16);
+	}
+	else {
+		out.WriteSection(KS_BAKESECTION_MESH_INDICES, indices32);
+	}
+
+	return out.Close();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Mesh.h"
+
+/*
+* Kenos mesh cache, imported meshes saved in a binary form that loads without Assimp.
+*
+* A mesh cache is a bake file (see BakeCache.h) next to the mesh file with KS_MESH_CACHE_EXTENSION
+* appended to its name. It holds the vertex and index arrays of the Mesh exactly as they are in memory,
+* the indices as uint16 or uint32 like the mesh stores them, aligned to KS_BAKE_ALIGNMENT, so loading
+* it is mapping the file and copying each array out in one go, plus a hash of both arrays that is
+* checked on load. Its key is a hash of the contents of the mesh file, so the cache is only used while
+* the mesh file is unchanged and is silently replaced otherwise.
+*/
+
+// Mesh caches are saved next to the mesh file with this appended to its name
+#define KS_MESH_CACHE_EXTENSION ".ksmesh"
+
+// Bump this whenever the Mesh arrays change layout or the import changes what it produces
+#define KS_MESH_CACHE_VERSION 3
+
+// Key of the cache of the mesh file at path, from its contents, the flags it is imported with and
+// KS_MESH_CACHE_VERSION. 0 if the file could not be read. fileHash is set to the HashFile of the mesh file,
+// so it can be reused instead of reading the file again (the bake key does).
+uint64_t ComputeMeshCacheKey(const std::string& path, uint32_t importFlags, uint64_t& fileHash);
+
+// Load the cache at cachePath into mesh. Returns false and leaves mesh alone if there is no cache or it
+// was saved for another key.
+bool LoadMeshCache(const std::string& cachePath, uint64_t key, Mesh& mesh);
+
+// Save mesh as the cache at cachePath for key. Returns false if the file could not be written.
+bool SaveMeshCache(const std::string& cachePath, uint64_t key, const Mesh& mesh);
@@ -0,0 +1,545 @@
+#include "pch.h"
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ObjLoader.h"
+#include "EngineConstants.h"
+#include "ProfilingLib.h"
+#include "ThreadingLib.h"
+
+using namespace std;
+using namespace DirectX::SimpleMath;
+
+namespace
+{
+	// A whole file mapped read only, the same way BakeFile maps bake files
+	class MappedFile
+	{
+	public:
+		const char* data;
+		size_t size;
+
+		MappedFile() :
+			data(nullptr),
+			size(0),
+#ifdef _WIN32
+			fileHandle(INVALID_HANDLE_VALUE),
+			mappingHandle(nullptr)
+#else
+			fileHandle(-1)
+#endif
+		{
+		}
+
+		~MappedFile() {
+			Close();
+		}
+
+		bool Open(const string& path) {
+			Close();
+
+#ifdef _WIN32
+			fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (fileHandle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+				Close();
+				return false;
+			}
+
+			mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mappingHandle == nullptr) {
+				Close();
+				return false;
+			}
+
+			data = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+			size = (size_t)fileSize.QuadPart;
+#else
+			fileHandle = open(path.c_str(), O_RDONLY);
+			if (fileHandle < 0) {
+				return false;
+			}
+
+			struct stat fileStat;
+			if (fstat(fileHandle, &fileStat) != 0 || fileStat.st_size == 0) {
+				Close();
+				return false;
+			}
+
+			void* mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fileHandle, 0);
+			data = mapping == MAP_FAILED ? nullptr : (const char*)mapping;
+			size = (size_t)fileStat.st_size;
+
+			// The chunks are read front to back
+			if (data != nullptr) {
+				madvise(mapping, size, MADV_SEQUENTIAL);
+			}
+#endif
+
+			if (data == nullptr) {
+				Close();
+				return false;
+			}
+
+			return true;
+		}
+
+		void Close() {
+#ifdef _WIN32
+			if (data != nullptr) {
+				UnmapViewOfFile(data);
+			}
+			if (mappingHandle != nullptr) {
+				CloseHandle(mappingHandle);
+			}
+			if (fileHandle != INVALID_HANDLE_VALUE) {
+				CloseHandle(fileHandle);
+			}
+
+			mappingHandle = nullptr;
+			fileHandle = INVALID_HANDLE_VALUE;
+#else
+			if (data != nullptr) {
+				munmap((void*)data, size);
+			}
+			if (fileHandle >= 0) {
+				close(fileHandle);
+			}
+
+			fileHandle = -1;
+#endif
+
+			data = nullptr;
+			size = 0;
+		}
+
+	private:
+#ifdef _WIN32
+		void* fileHandle;
+		void* mappingHandle;
+#else
+		int fileHandle;
+#endif
+	};
+
+	// Everything parsed from one chunk of the file
+	struct ObjChunk {
+		std::vector<Vector3> positions;
+
+		// 1 based position indices, 3 per triangle
+		std::vector<uint32_t> faces;
+
+		// File offsets of the first face and the last o, g or usemtl line of the chunk
+		size_t firstFace = SIZE_MAX;
+		size_t lastGroup = 0;
+		bool hasGroup = false;
+
+		// What the chunk uses that the fast path does not handle, empty if nothing
+		string unsupported;
+	};
+
+	// Powers of 10 that are exact in a double
+	const double exactPowersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	inline bool IsBlank(char c) {
+		return c == ' ' || c == '\t';
+	}
+
+	inline bool IsLineEnd(const char* p, const char* end) {
+		return p == end || *p == '\n' || *p == '\r';
+	}
+
+	inline bool IsDigit(char c) {
+		return (unsigned)(c - '0') < 10;
+	}
+
+	inline void SkipBlanks(const char*& p, const char* end) {
+		while (p < end && IsBlank(*p)) {
+			p++;
+		}
+	}
+
+	// Parse the float at p and move p past it. Numbers with up to 19 significant digits and a power of 10
+	// up to 22 take one exact multiply or divide in double, which rounds correctly, the rest go through
+	// strtod. Returns false if there is no number at p or it does not end at a blank or the line end.
+	bool ParseFloat(const char*& p, const char* end, float& value) {
+		const char* start = p;
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative = *p == '-';
+			p++;
+		}
+
+		uint64_t mantissa = 0;
+		int significantDigits = 0;
+		int exponent = 0;
+		bool hasDigits = false;
+		bool truncated = false;
+
+		for (; p < end && IsDigit(*p); p++) {
+			hasDigits = true;
+
+			if (significantDigits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				significantDigits += mantissa != 0;
+			}
+			else {
+				exponent++;
+				truncated |= *p != '0';
+			}
+		}
+
+		if (p < end && *p == '.') {
+			p++;
+
+			for (; p < end && IsDigit(*p); p++) {
+				hasDigits = true;
+
+				if (significantDigits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					significantDigits += mantissa != 0;
+					exponent--;
+				}
+				else {
+					truncated |= *p != '0';
+				}
+			}
+		}
+
+		if (!hasDigits) {
+			p = start;
+			return false;
+		}
+
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* exponentStart = p++;
+
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+')) {
+				negativeExponent = *p == '-';
+				p++;
+			}
+
+			if (p < end && IsDigit(*p)) {
+				int written = 0;
+				for (; p < end && IsDigit(*p); p++) {
+					// Anything this large is out of range of a float either way
+					written = min(written * 10 + (*p - '0'), 100000);
+				}
+
+				exponent += negativeExponent ? -written : written;
+			}
+			else {
+				// "1e" is the number 1 followed by junk, which is caught below
+				p = exponentStart;
+			}
+		}
+
+		if (!(p == end || IsBlank(*p) || *p == '\n' || *p == '\r')) {
+			p = start;
+			return false;
+		}
+
+		double result;
+
+		if (!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+			result = (double)mantissa;
+			result = exponent < 0 ? result / exactPowersOf10[-exponent] : result * exactPowersOf10[exponent];
+			result = negative ? -result : result;
+		}
+		else {
+			char text[128];
+			size_t length = (size_t)(p - start);
+
+			if (length >= sizeof(text)) {
+				p = start;
+				return false;
+			}
+
+			memcpy(text, start, length);
+			text[length] = 0;
+			result = strtod(text, nullptr);
+		}
+
+		value = (float)result;
+		return true;
+	}
+
+	// Parse one vertex of a face, "v", "v/vt", "v//vn" or "v/vt/vn", and keep the position index. Only
+	// positive indices are handled.
+	bool ParseFaceVertex(const char*& p, const char* end, uint32_t& index) {
+		uint64_t position = 0;
+		bool hasDigits = false;
+
+		for (; p < end && IsDigit(*p); p++) {
+			position = position * 10 + (*p - '0');
+			hasDigits = true;
+
+			if (position > UINT32_MAX) {
+				return false;
+			}
+		}
+
+		if (!hasDigits || position == 0) {
+			return false;
+		}
+
+		// Texture and normal indices are not needed
+		for (int k = 0; k < 2 && p < end && *p == '/'; k++) {
+			p++;
+			while (p < end && IsDigit(*p)) {
+				p++;
+			}
+		}
+
+		index = (uint32_t)position;
+		return p == end || IsBlank(*p) || *p == '\n' || *p == '\r';
+	}
+
+	bool KeywordIs(const char* keyword, size_t length, const char* name) {
+		return strlen(name) == length && memcmp(keyword, name, length) == 0;
+	}
+
+	// Parse the lines in [begin, end) of data into chunk. Stops at the first line the fast path does not
+	// handle.
+	void ParseChunk(const char* data, size_t begin, size_t end, ObjChunk& chunk) {
+		const char* p = data + begin;
+		const char* stop = data + end;
+
+		// About 30 bytes per line, most of them vertices or faces
+		chunk.positions.reserve((end - begin) / 64);
+		chunk.faces.reserve((end - begin) / 20);
+
+		while (p < stop) {
+			const char* line = p;
+
+			SkipBlanks(p, stop);
+
+			const char* keyword = p;
+			while (p < stop && !IsBlank(*p) && *p != '\n' && *p != '\r') {
+				p++;
+			}
+
+			size_t keywordLength = (size_t)(p - keyword);
+
+			if (keywordLength == 0 || keyword[0] == '#') {
+				// Blank line or comment
+			}
+			else if (KeywordIs(keyword, keywordLength, "v")) {
+				Vector3 position;
+
+				SkipBlanks(p, stop);
+				bool parsed = ParseFloat(p, stop, position.x);
+				SkipBlanks(p, stop);
+				parsed = parsed && ParseFloat(p, stop, position.y);
+				SkipBlanks(p, stop);
+				parsed = parsed && ParseFloat(p, stop, position.z);
+
+				if (!parsed) {
+					chunk.unsupported = "a vertex that is not 3 numbers";
+					return;
+				}
+
+				chunk.positions.push_back(position);
+			}
+			else if (KeywordIs(keyword, keywordLength, "f")) {
+				int corners = 0;
+
+				for (;;) {
+					SkipBlanks(p, stop);
+
+					if (IsLineEnd(p, stop)) {
+						break;
+					}
+
+					uint32_t index;
+					if (corners == 3 || !ParseFaceVertex(p, stop, index)) {
+						chunk.unsupported = corners == 3 ? "a face that is not a triangle" : "a face with relative or broken indices";
+						return;
+					}
+
+					chunk.faces.push_back(index);
+					corners++;
+				}
+
+				if (corners != 3) {
+					chunk.unsupported = "a face that is not a triangle";
+					return;
+				}
+
+				chunk.firstFace = min(chunk.firstFace, (size_t)(line - data));
+			}
+			else if (KeywordIs(keyword, keywordLength, "o") || KeywordIs(keyword, keywordLength, "g") ||
+				KeywordIs(keyword, keywordLength, "usemtl")) {
+
+				chunk.lastGroup = (size_t)(line - data);
+				chunk.hasGroup = true;
+			}
+			else if (!KeywordIs(keyword, keywordLength, "vt") && !KeywordIs(keyword, keywordLength, "vn") &&
+				!KeywordIs(keyword, keywordLength, "s") && !KeywordIs(keyword, keywordLength, "mtllib")) {
+
+				chunk.unsupported = "'" + string(keyword, keywordLength) + "' lines";
+				return;
+			}
+
+			// Skip the rest of the line
+			const char* lineEnd = (const char*)memchr(p, '\n', (size_t)(stop - p));
+			if (lineEnd == nullptr) {
+				lineEnd = stop;
+			}
+
+			// A backslash at the end joins the next line to this one
+			const char* last = lineEnd - 1;
+			if (last >= line && *last == '\r') {
+				last--;
+			}
+			if (last >= line && *last == '\\') {
+				chunk.unsupported = "line continuations";
+				return;
+			}
+
+			p = lineEnd < stop ? lineEnd + 1 : stop;
+		}
+	}
+}
+
+bool LoadObjFast(const string& path, Mesh& mesh, int threadCount, string& reason) {
+	KS_PROFILE_ZONE("LoadObjFast");
+
+	MappedFile file;
+	if (!file.Open(path)) {
+		reason = "the file could not be mapped";
+		return false;
+	}
+
+	// Every chunk after the first starts right after a line break
+	vector<size_t> chunkStarts = { 0 };
+
+	for (size_t next = KS_OBJ_CHUNK_BYTES; next < file.size; next = chunkStarts.back() + KS_OBJ_CHUNK_BYTES) {
+		const char* lineBreak = (const char*)memchr(file.data + next, '\n', file.size - next);
+		if (lineBreak == nullptr || lineBreak + 1 == file.data + file.size) {
+			break;
+		}
+
+		chunkStarts.push_back((size_t)(lineBreak + 1 - file.data));
+	}
+
+	chunkStarts.push_back(file.size);
+
+	int chunkCount = (int)chunkStarts.size() - 1;
+	vector<ObjChunk> chunks(chunkCount);
+
+	ParallelFor(chunkCount, 1, threadCount, [&](int chunkStart, int chunkEnd, int) {
+		for (int c = chunkStart; c < chunkEnd; c++) {
+			ParseChunk(file.data, chunkStarts[c], chunkStarts[c + 1], chunks[c]);
+		}
+	});
+
+	// Faces of every chunk go after those of the chunks before it
+	vector<size_t> faceOffsets(chunkCount + 1, 0);
+	size_t positionCount = 0;
+	size_t firstFace = SIZE_MAX;
+	size_t lastGroup = 0;
+	bool hasGroup = false;
+
+	for (int c = 0; c < chunkCount; c++) {
+		const ObjChunk& chunk = chunks[c];
+
+		if (!chunk.unsupported.empty()) {
+			reason = "the file has " + chunk.unsupported;
+			return false;
+		}
+
+		faceOffsets[c + 1] = faceOffsets[c] + chunk.faces.size() / 3;
+		positionCount += chunk.positions.size();
+
+		firstFace = min(firstFace, chunk.firstFace);
+		if (chunk.hasGroup) {
+			lastGroup = max(lastGroup, chunk.lastGroup);
+			hasGroup = true;
+		}
+	}
+
+	size_t faceCount = faceOffsets[chunkCount];
+
+	if (faceCount == 0) {
+		reason = "the file has no faces";
+		return false;
+	}
+
+	// Assimp makes a mesh for every object, group and material, only one that comes before every face
+	// keeps it at one mesh
+	if (hasGroup && lastGroup > firstFace) {
+		reason = "the file has several objects, groups or materials";
+		return false;
+	}
+
+	vector<Vector3> positions;
+	positions.reserve(positionCount);
+
+	for (ObjChunk& chunk : chunks) {
+		positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+		vector<Vector3>().swap(chunk.positions);
+	}
+
+	// Same layout as the Assimp import: 3 vertices per face, z negated and the winding reversed
+	vector<Vector3> vertices(faceCount * 3);
+	vector<uint32_t> indices(faceCount * 3);
+	vector<char> brokenChunks(chunkCount, 0);
+
+	ParallelFor(chunkCount, 1, threadCount, [&](int chunkStart, int chunkEnd, int) {
+		for (int c = chunkStart; c < chunkEnd; c++) {
+			const vector<uint32_t>& faces = chunks[c].faces;
+			size_t face = faceOffsets[c];
+
+			for (size_t i = 0; i < faces.size(); i += 3, face++) {
+				for (int k = 0; k < 3; k++) {
+					uint32_t index = faces[i + k];
+
+					if (index > positionCount) {
+						brokenChunks[c] = 1;
+						break;
+					}
+
+					Vector3 v = positions[index - 1];
+					vertices[face * 3 + k] = Vector3(v.x, v.y, -v.z);
+				}
+
+				indices[face * 3] = (uint32_t)(face * 3 + 2);
+				indices[face * 3 + 1] = (uint32_t)(face * 3 + 1);
+				indices[face * 3 + 2] = (uint32_t)(face * 3);
+			}
+		}
+	});
+
+	for (int c = 0; c < chunkCount; c++) {
+		if (brokenChunks[c]) {
+			reason = "the file has faces using vertices it does not have";
+			return false;
+		}
+	}
+
+	mesh.m_vertices = std::move(vertices);
+	mesh.SetIndices(std::move(indices));
+
+	KS_PROFILE_COUNT("objFastPathBytes", file.size);
+	return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "Mesh.h"
+
+/*
+* Kenos OBJ loader, a fast path for the large triangulated OBJ files most of our meshes are.
+*
+* The file is mapped and split into chunks of about KS_OBJ_CHUNK_BYTES at line boundaries. Every chunk
+* is parsed on its own thread into its own position and face lists, then the chunks are merged into
+* the Mesh in file order. The mesh is laid out like the Assimp import with aiProcess_Triangulate |
+* aiProcess_ConvertToLeftHanded lays it out: every face gets its own 3 vertices, z is negated and the
+* winding is reversed. So a mesh is the same whichever path loaded it, apart from float parsing:
+* numbers are rounded correctly here, Assimp can be off by an ulp.
+*
+* Only the common subset of OBJ is handled: v (extra components are ignored), vt, vn, triangles in
+* any of the v, v/vt, v//vn and v/vt/vn forms with positive indices, s, mtllib, comments, and o, g and
+* usemtl before the first face (after it Assimp would split the file into several meshes). Anything else
+* makes LoadObjFast fail so the caller can fall back to Assimp.
+*/
+
+// Load the OBJ file at path into mesh on up to threadCount threads (see ResolveThreadCount). Returns
+// false with the reason in reason and leaves mesh alone if the file could not be mapped or uses
+// anything the fast path does not handle.
+bool LoadObjFast(const std::string& path, Mesh& mesh, int threadCount, std::string& reason);
@@ -0,0 +1,252 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ProfilingLib.h"
+
+using namespace std;
+
+#ifdef KS_PROFILING
+
+namespace
+{
+	struct ProfileEvent {
+		const char* name;
+		// Nanoseconds since the profile was reset
+		int64_t start;
+		// Duration in nanoseconds for zones, the amount added for counters
+		int64_t value;
+		bool counter;
+	};
+
+	// Events of one thread. Threads that exit hand their buffer back so the next new thread records
+	// into it, ParallelFor starts new threads on every call and this keeps the trace to one row per
+	// thread that was running at the same time instead of one per thread ever started.
+	struct ThreadBuffer {
+		int threadId;
+		bool inUse;
+		vector<ProfileEvent> events;
+	};
+
+	struct Profiler {
+		mutex lock;
+		vector<unique_ptr<ThreadBuffer>> buffers;
+		chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+	};
+
+	Profiler& GetProfiler() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	int64_t Now() {
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - GetProfiler().epoch).count();
+	}
+
+	struct ThreadSlot {
+		ThreadBuffer* buffer = nullptr;
+
+		~ThreadSlot() {
+			if (buffer != nullptr) {
+				lock_guard<mutex> guard(GetProfiler().lock);
+				buffer->inUse = false;
+			}
+		}
+	};
+
+	thread_local ThreadSlot threadSlot;
+
+	ThreadBuffer& GetThreadBuffer() {
+		if (threadSlot.buffer != nullptr) {
+			return *threadSlot.buffer;
+		}
+
+		Profiler& profiler = GetProfiler();
+		lock_guard<mutex> guard(profiler.lock);
+
+		for (unique_ptr<ThreadBuffer>& buffer : profiler.buffers) {
+			if (!buffer->inUse) {
+				threadSlot.buffer = buffer.get();
+				break;
+			}
+		}
+
+		if (threadSlot.buffer == nullptr) {
+			profiler.buffers.emplace_back(new ThreadBuffer());
+			threadSlot.buffer = profiler.buffers.back().get();
+			threadSlot.buffer->threadId = (int)profiler.buffers.size();
+		}
+
+		threadSlot.buffer->inUse = true;
+		return *threadSlot.buffer;
+	}
+
+	// Names are our own literals but keep the JSON valid whatever they contain
+	void WriteJsonString(FILE* f, const char* text) {
+		fputc('"', f);
+
+		for (const char* c = text; *c != 0; c++) {
+			if (*c == '"' || *c == '\\') {
+				fputc('\\', f);
+				fputc(*c, f);
+			}
+			else if ((unsigned char)*c < 0x20) {
+				fprintf(f, "\\u%04x", (unsigned char)*c);
+			}
+			else {
+				fputc(*c, f);
+			}
+		}
+
+		fputc('"', f);
+	}
+}
+
+ProfileZone::ProfileZone(const char* name) :
+	name(name),
+	start(Now())
+{
+}
+
+ProfileZone::~ProfileZone() {
+	int64_t end = Now();
+
+	ProfileEvent event = { name, start, end - start, false };
+	GetThreadBuffer().events.push_back(event);
+}
+
+void AddProfileCount(const char* name, int64_t delta) {
+	ProfileEvent event = { name, Now(), delta, true };
+	GetThreadBuffer().events.push_back(event);
+}
+
+bool IsProfilingEnabled() {
+	return true;
+}
+
+void ResetProfile() {
+	Profiler& profiler = GetProfiler();
+	lock_guard<mutex> guard(profiler.lock);
+
+	for (unique_ptr<ThreadBuffer>& buffer : profiler.buffers) {
+		buffer->events.clear();
+	}
+
+	profiler.epoch = chrono::steady_clock::now();
+}
+
+map<string, int64_t> GetProfileCounters() {
+	Profiler& profiler = GetProfiler();
+	lock_guard<mutex> guard(profiler.lock);
+
+	map<string, int64_t> counters;
+
+	for (unique_ptr<ThreadBuffer>& buffer : profiler.buffers) {
+		for (const ProfileEvent& event : buffer->events) {
+			if (event.counter) {
+				counters[event.name] += event.value;
+			}
+		}
+	}
+
+	return counters;
+}
+
+bool WriteProfileTrace(const string& path) {
+	Profiler& profiler = GetProfiler();
+	lock_guard<mutex> guard(profiler.lock);
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (f == nullptr) {
+		return false;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	bool first = true;
+
+	// Counter events from every thread, written as running totals in time order below
+	vector<ProfileEvent> counterEvents;
+
+	for (unique_ptr<ThreadBuffer>& buffer : profiler.buffers) {
+		if (buffer->events.empty()) {
+			continue;
+		}
+
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+			first ? "" : ",\n", buffer->threadId, buffer->threadId);
+		first = false;
+
+		for (const ProfileEvent& event : buffer->events) {
+			if (event.counter) {
+				counterEvents.push_back(event);
+				continue;
+			}
+
+			fprintf(f, ",\n{\"name\":");
+			WriteJsonString(f, event.name);
+			fprintf(f, ",\"cat\":\"kenos\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				buffer->threadId, event.start / 1000.0, event.value / 1000.0);
+		}
+	}
+
+	stable_sort(counterEvents.begin(), counterEvents.end(), [](const ProfileEvent& a, const ProfileEvent& b) {
+		return a.start < b.start;
+	});
+
+	map<string, int64_t> totals;
+
+	for (const ProfileEvent& event : counterEvents) {
+		int64_t& total = totals[event.name];
+		total += event.value;
+
+		fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+		WriteJsonString(f, event.name);
+		fprintf(f, ",\"cat\":\"kenos\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+			event.start / 1000.0, (long long)total);
+		first = false;
+	}
+
+	// Final counter totals, shown as metadata by the trace viewers
+	fprintf(f, "\n],\"otherData\":{");
+
+	bool firstCounter = true;
+	for (auto& counter : totals) {
+		fprintf(f, "%s", firstCounter ? "" : ",");
+		WriteJsonString(f, counter.first.c_str());
+		fprintf(f, ":%lld", (long long)counter.second);
+		firstCounter = false;
+	}
+
+	fprintf(f, "}}\n");
+
+	bool good = ferror(f) == 0;
+	good = fclose(f) == 0 && good;
+
+	return good;
+}
+
+#else
+
+bool IsProfilingEnabled() {
+	return false;
+}
+
+void ResetProfile() {
+}
+
+map<string, int64_t> GetProfileCounters() {
+	return map<string, int64_t>();
+}
+
+bool WriteProfileTrace(const string& path) {
+	(void)path;
+	return false;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+/*
+* Kenos profiling library, scoped zones and named counters for seeing where bake time goes.
+*
+* KS_PROFILE_ZONE("Name") times the rest of the enclosing scope and KS_PROFILE_COUNT("name", n) adds n
+* to a named counter. Both record into a buffer owned by the calling thread so they never take a lock,
+* nested zones show up nested. WriteProfileTrace writes everything recorded as a Chrome trace_event
+* file, open it in chrome://tracing or ui.perfetto.dev. Names have to be string literals, only the
+* pointer is kept.
+*
+* Profiling is compiled in when KS_PROFILING is defined, debug builds define it by default. Without it
+* the macros compile to nothing, their arguments are never evaluated, and the functions below do nothing.
+*/
+
+#if defined(_DEBUG) && !defined(KS_PROFILING) && !defined(KS_NO_PROFILING)
+#define KS_PROFILING
+#endif
+
+#ifdef KS_PROFILING
+
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char* name);
+	~ProfileZone();
+
+	ProfileZone(const ProfileZone&) = delete;
+	ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+	const char* name;
+	int64_t start;
+};
+
+void AddProfileCount(const char* name, int64_t delta);
+
+#define KS_PROFILE_CONCAT_INNER(a, b) a##b
+#define KS_PROFILE_CONCAT(a, b) KS_PROFILE_CONCAT_INNER(a, b)
+
+#define KS_PROFILE_ZONE(name) ProfileZone KS_PROFILE_CONCAT(ksProfileZone, __LINE__)(name)
+#define KS_PROFILE_COUNT(name, delta) AddProfileCount(name, (int64_t)(delta))
+
+#else
+
+// sizeof keeps variables that only feed a counter from warning as unused without evaluating anything
+#define KS_PROFILE_ZONE(name) ((void)0)
+#define KS_PROFILE_COUNT(name, delta) ((void)sizeof(delta))
+
+#endif
+
+// If zones and counters are compiled in
+bool IsProfilingEnabled();
+
+// Drop everything recorded so far and restart the clock. None of the functions below may run while
+// other threads are still recording.
+void ResetProfile();
+
+// Total of every counter recorded so far
+std::map<std::string, int64_t> GetProfileCounters();
+
+// Write every zone and counter recorded so far as a Chrome trace_event JSON file. Returns false if the
+// file could not be written or profiling is compiled out.
+bool WriteProfileTrace(const std::string& path);
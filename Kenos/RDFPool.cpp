@@ -0,0 +1,324 @@
+#include "pch.h"
+
+#include "RDFPool.h"
+
+using namespace std;
+using namespace DirectX::SimpleMath;
+
+RDFPool::RDFPool() :
+	releasedCount(0)
+{
+}
+
+RDFPool::~RDFPool() {
+
+}
+
+void RDFPool::Clear() {
+	parentDirectoryIndex.clear();
+	bounce.clear();
+	parentRDF.clear();
+	color.clear();
+	lightBrightness.clear();
+	lightness.clear();
+	alive.clear();
+
+	childOffset.clear();
+	childCount.clear();
+	shadowOffset.clear();
+	shadowCount.clear();
+
+	childArena.clear();
+	shadowArena.clear();
+
+	releasedCount = 0;
+}
+
+void RDFPool::Reserve(int rdfCount) {
+	parentDirectoryIndex.reserve(rdfCount);
+	bounce.reserve(rdfCount);
+	parentRDF.reserve(rdfCount);
+	color.reserve(rdfCount);
+	lightBrightness.reserve(rdfCount);
+	lightness.reserve(rdfCount);
+	alive.reserve(rdfCount);
+
+	childOffset.reserve(rdfCount);
+	childCount.reserve(rdfCount);
+	shadowOffset.reserve(rdfCount);
+	shadowCount.reserve(rdfCount);
+
+	// every RDF but the roots is the child of exactly one other
+	childArena.reserve(rdfCount);
+}
+
+RDFHandle RDFPool::Add(const RDF& rdf) {
+	RDFHandle handle = (RDFHandle)parentDirectoryIndex.size();
+
+	parentDirectoryIndex.push_back(rdf.parentDirectoryIndex);
+	bounce.push_back(rdf.bounce);
+	parentRDF.push_back(rdf.parentRDF);
+	color.push_back(rdf.color);
+	lightBrightness.push_back(rdf.lightBrightness);
+	lightness.push_back(rdf.lightness);
+	alive.push_back(1);
+
+	childOffset.push_back(0);
+	childCount.push_back(0);
+	shadowOffset.push_back(0);
+	shadowCount.push_back(0);
+
+	return handle;
+}
+
+int RDFPool::Size() const {
+	return (int)parentDirectoryIndex.size();
+}
+
+bool RDFPool::Empty() const {
+	return parentDirectoryIndex.empty();
+}
+
+void RDFPool::Release(RDFHandle rdf) {
+	if (alive[rdf]) {
+		alive[rdf] = 0;
+		releasedCount++;
+	}
+}
+
+bool RDFPool::IsAlive(RDFHandle rdf) const {
+	return alive[rdf] != 0;
+}
+
+int RDFPool::GetReleasedCount() const {
+	return releasedCount;
+}
+
+void RDFPool::Compact(vector<RDFHandle>& remap) {
+	int count = Size();
+	remap.assign(count, -1);
+
+	int next = 0;
+	for (int i = 0; i < count; i++) {
+		if (alive[i]) {
+			remap[i] = next++;
+		}
+	}
+
+	vector<RDFHandle> newChildArena;
+	vector<int> newShadowArena;
+	newChildArena.reserve(next);
+
+	// Handles only ever move down so the columns can be compacted in place
+	for (int i = 0; i < count; i++) {
+		int to = remap[i];
+		if (to < 0) {
+			continue;
+		}
+
+		parentDirectoryIndex[to] = parentDirectoryIndex[i];
+		bounce[to] = bounce[i];
+		parentRDF[to] = parentRDF[i] >= 0 ? remap[parentRDF[i]] : -1;
+		color[to] = color[i];
+		lightBrightness[to] = lightBrightness[i];
+		lightness[to] = lightness[i];
+		alive[to] = 1;
+
+		int childFirst = (int)newChildArena.size();
+		for (int c = 0; c < childCount[i]; c++) {
+			RDFHandle child = remap[childArena[childOffset[i] + c]];
+			if (child >= 0) {
+				newChildArena.push_back(child);
+			}
+		}
+
+		int shadowFirst = (int)newShadowArena.size();
+		newShadowArena.insert(newShadowArena.end(), shadowArena.begin() + shadowOffset[i],
+			shadowArena.begin() + shadowOffset[i] + shadowCount[i]);
+
+		childOffset[to] = childFirst;
+		childCount[to] = (int)newChildArena.size() - childFirst;
+		shadowOffset[to] = shadowFirst;
+		shadowCount[to] = shadowCount[i];
+	}
+
+	parentDirectoryIndex.resize(next);
+	bounce.resize(next);
+	parentRDF.resize(next);
+	color.resize(next);
+	lightBrightness.resize(next);
+	lightness.resize(next);
+	alive.resize(next);
+
+	childOffset.resize(next);
+	childCount.resize(next);
+	shadowOffset.resize(next);
+	shadowCount.resize(next);
+
+	childArena.swap(newChildArena);
+	shadowArena.swap(newShadowArena);
+
+	releasedCount = 0;
+}
+
+RDF RDFPool::Get(RDFHandle rdf) const {
+	RDF result;
+	result.parentDirectoryIndex = parentDirectoryIndex[rdf];
+	result.bounce = bounce[rdf];
+	result.parentRDF = parentRDF[rdf];
+	result.color = color[rdf];
+	result.lightBrightness = lightBrightness[rdf];
+	result.lightness = lightness[rdf];
+	return result;
+}
+
+int RDFPool::GetParentDirectoryIndex(RDFHandle rdf) const {
+	return parentDirectoryIndex[rdf];
+}
+
+int RDFPool::GetBounce(RDFHandle rdf) const {
+	return bounce[rdf];
+}
+
+RDFHandle RDFPool::GetParentRDF(RDFHandle rdf) const {
+	return parentRDF[rdf];
+}
+
+const Color& RDFPool::GetColor(RDFHandle rdf) const {
+	return color[rdf];
+}
+
+float RDFPool::GetLightBrightness(RDFHandle rdf) const {
+	return lightBrightness[rdf];
+}
+
+float RDFPool::GetLightness(RDFHandle rdf) const {
+	return lightness[rdf];
+}
+
+void RDFPool::SetLightness(RDFHandle rdf, float newLightness) {
+	lightness[rdf] = newLightness;
+}
+
+void RDFPool::SetLightBrightness(RDFHandle rdf, float brightness) {
+	lightBrightness[rdf] = brightness;
+}
+
+void RDFPool::SetColor(RDFHandle rdf, const Color& newColor) {
+	color[rdf] = newColor;
+}
+
+RDFRange RDFPool::GetChildren(RDFHandle rdf) const {
+	const RDFHandle* first = childArena.data() + childOffset[rdf];
+	RDFRange range = { first, first + childCount[rdf] };
+	return range;
+}
+
+RDFRange RDFPool::GetShadows(RDFHandle rdf) const {
+	const int* first = shadowArena.data() + shadowOffset[rdf];
+	RDFRange range = { first, first + shadowCount[rdf] };
+	return range;
+}
+
+void RDFPool::SetChildren(RDFHandle rdf, const vector<RDFHandle>& children) {
+	SetChildren(rdf, children.data(), (int)children.size());
+}
+
+void RDFPool::SetChildren(RDFHandle rdf, const RDFHandle* children, int count) {
+	childOffset[rdf] = (int)childArena.size();
+	childCount[rdf] = count;
+	childArena.insert(childArena.end(), children, children + count);
+}
+
+void RDFPool::SetShadows(RDFHandle rdf, const vector<int>& shadows) {
+	SetShadows(rdf, shadows.data(), (int)shadows.size());
+}
+
+void RDFPool::SetShadows(RDFHandle rdf, const int* shadows, int count) {
+	shadowOffset[rdf] = (int)shadowArena.size();
+	shadowCount[rdf] = count;
+	shadowArena.insert(shadowArena.end(), shadows, shadows + count);
+}
+
+size_t RDFPool::GetMemoryUsage() const {
+	return GetMemoryUsageTree("").GetTotalBytes();
+}
+
+MemoryUsage RDFPool::GetMemoryUsageTree(const string& name) const {
+	MemoryUsage usage(name);
+
+	usage.Add("columns", VectorBytes(parentDirectoryIndex) + VectorBytes(bounce) + VectorBytes(parentRDF) +
+		VectorBytes(color) + VectorBytes(lightBrightness) + VectorBytes(lightness) + VectorBytes(alive));
+	usage.Add("ranges", VectorBytes(childOffset) + VectorBytes(childCount) + VectorBytes(shadowOffset) +
+		VectorBytes(shadowCount));
+	usage.Add("childArena", VectorBytes(childArena));
+	usage.Add("shadowArena", VectorBytes(shadowArena));
+
+	return usage;
+}
+
+void RDFPool::Save(BakeFileWriter& out, uint32_t firstSection) const {
+	vector<int> counts = { releasedCount };
+
+	out.WriteSection(firstSection, counts);
+	out.WriteSection(firstSection + 1, parentDirectoryIndex);
+	out.WriteSection(firstSection + 2, bounce);
+	out.WriteSection(firstSection + 3, parentRDF);
+	out.WriteSection(firstSection + 4, color);
+	out.WriteSection(firstSection + 5, lightBrightness);
+	out.WriteSection(firstSection + 6, lightness);
+	out.WriteSection(firstSection + 7, alive);
+	out.WriteSection(firstSection + 8, childOffset);
+	out.WriteSection(firstSection + 9, childCount);
+	out.WriteSection(firstSection + 10, shadowOffset);
+	out.WriteSection(firstSection + 11, shadowCount);
+	out.WriteSection(firstSection + 12, childArena);
+	out.WriteSection(firstSection + 13, shadowArena);
+}
+
+bool RDFPool::Load(const BakeFile& in, uint32_t firstSection) {
+	Clear();
+
+	vector<int> counts;
+
+	bool valid = in.ReadSection(firstSection, counts) && counts.size() == 1 &&
+		in.ReadSection(firstSection + 1, parentDirectoryIndex) &&
+		in.ReadSection(firstSection + 2, bounce) &&
+		in.ReadSection(firstSection + 3, parentRDF) &&
+		in.ReadSection(firstSection + 4, color) &&
+		in.ReadSection(firstSection + 5, lightBrightness) &&
+		in.ReadSection(firstSection + 6, lightness) &&
+		in.ReadSection(firstSection + 7, alive) &&
+		in.ReadSection(firstSection + 8, childOffset) &&
+		in.ReadSection(firstSection + 9, childCount) &&
+		in.ReadSection(firstSection + 10, shadowOffset) &&
+		in.ReadSection(firstSection + 11, shadowCount) &&
+		in.ReadSection(firstSection + 12, childArena) &&
+		in.ReadSection(firstSection + 13, shadowArena);
+
+	// Every column has to be there for every RDF and every range inside its arena
+	size_t count = parentDirectoryIndex.size();
+
+	valid = valid && bounce.size() == count && parentRDF.size() == count && color.size() == count &&
+		lightBrightness.size() == count && lightness.size() == count && alive.size() == count &&
+		childOffset.size() == count && childCount.size() == count && shadowOffset.size() == count &&
+		shadowCount.size() == count;
+
+	for (size_t i = 0; i < count && valid; i++) {
+		valid = childOffset[i] >= 0 && childCount[i] >= 0 && (size_t)childOffset[i] + childCount[i] <= childArena.size() &&
+			shadowOffset[i] >= 0 && shadowCount[i] >= 0 && (size_t)shadowOffset[i] + shadowCount[i] <= shadowArena.size() &&
+			parentRDF[i] >= -1 && parentRDF[i] < (RDFHandle)count;
+	}
+
+	for (size_t i = 0; i < childArena.size() && valid; i++) {
+		valid = childArena[i] >= 0 && childArena[i] < (RDFHandle)count;
+	}
+
+	if (!valid) {
+		Clear();
+		return false;
+	}
+
+	releasedCount = counts[0];
+	return true;
+}
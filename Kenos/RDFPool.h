@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <DirectXMath.h>
+#include <SimpleMath.h>
+
+#include "BakeCache.h"
+#include "MemoryUsage.h"
+
+// Handle of an RDF in an RDFPool. Handles are plain indices so they stay valid when the pool grows,
+// only Compact() moves RDFs around.
+typedef int RDFHandle;
+
+// Representaiton of the the radiance distribution function. This is what gets traced through the scene.
+// This is the value type used to add RDFs to and read them from an RDFPool, the pool itself stores every
+// field in its own column. Children and shadows are kept by the pool as ranges in shared arenas.
+struct RDF {
+	// Index of the SurfaceLightmapDirectory struct that this RDF belongs to.
+	int parentDirectoryIndex;
+
+	// Every time we process an rdf, if the bounce < maxBounces we spawn children
+	int bounce;
+
+	// When backtracing, handle of the parent RDF in the jumble map. If this is -1
+	// then it has no parent and we are at a light source.
+	RDFHandle parentRDF;
+
+	// This is the corrected colour, so we dont have to sample the surface and mix it with the
+	// light colour in the shader.
+	DirectX::SimpleMath::Color color;
+
+	// This stays the same through all bounces because of how the shader works maybe we can optimize
+	// this but 4 extra bytes per structure isnt that bad. (we probably will have more padding anyway)
+	float lightBrightness;
+
+	// This is the per surface lightness multiplier. 1.0 is the default, that means that 100% of the
+	// the light from the parent scatters onto the surface.
+	float lightness;
+};
+
+// Contiguous run of handles in one of the pool arenas
+struct RDFRange {
+	const RDFHandle* first;
+	const RDFHandle* last;
+
+	const RDFHandle* begin() const { return first; }
+	const RDFHandle* end() const { return last; }
+	int size() const { return (int)(last - first); }
+	bool empty() const { return first == last; }
+};
+
+/*
+* Structure of arrays storage for all of the RDFs in a scene. Every RDF field is its own column so passes
+* that only look at a couple of fields (parents and brightness when packing buffers) stream through
+* memory, and adding an RDF never allocates on its own. Children and shadows of an RDF are a range in
+* the child or shadow arena, set once with SetChildren / SetShadows. Setting them again appends a new
+* range and leaves the old one behind until the next Compact().
+*
+* RDFs are never removed on their own, Release() only marks one as dead so handles held elsewhere stay
+* valid. Compact() drops the released RDFs and the stale arena ranges and renumbers what is left.
+*/
+class RDFPool
+{
+public:
+	RDFPool();
+	~RDFPool();
+
+	void Clear();
+	void Reserve(int rdfCount);
+
+	// Add an RDF with no children or shadows, returns its handle
+	RDFHandle Add(const RDF& rdf);
+
+	// Number of RDFs including released ones, handles are in [0, Size())
+	int Size() const;
+	bool Empty() const;
+
+	// Mark an RDF as dead. Its columns stay readable until the next Compact().
+	void Release(RDFHandle rdf);
+	bool IsAlive(RDFHandle rdf) const;
+	int GetReleasedCount() const;
+
+	// Remove the released RDFs and unused arena ranges. remap is filled with the new handle of every old
+	// handle, -1 for released ones. Parents and children are remapped by the pool, handles kept anywhere
+	// else have to be remapped by the caller.
+	void Compact(std::vector<RDFHandle>& remap);
+
+	// Read back every column of an RDF
+	RDF Get(RDFHandle rdf) const;
+
+	int GetParentDirectoryIndex(RDFHandle rdf) const;
+	int GetBounce(RDFHandle rdf) const;
+	RDFHandle GetParentRDF(RDFHandle rdf) const;
+	const DirectX::SimpleMath::Color& GetColor(RDFHandle rdf) const;
+	float GetLightBrightness(RDFHandle rdf) const;
+	float GetLightness(RDFHandle rdf) const;
+
+	void SetLightness(RDFHandle rdf, float lightness);
+	void SetLightBrightness(RDFHandle rdf, float brightness);
+	void SetColor(RDFHandle rdf, const DirectX::SimpleMath::Color& color);
+
+	// Only valid until the next SetChildren / SetShadows / Compact
+	RDFRange GetChildren(RDFHandle rdf) const;
+	RDFRange GetShadows(RDFHandle rdf) const;
+
+	void SetChildren(RDFHandle rdf, const RDFHandle* children, int count);
+	void SetChildren(RDFHandle rdf, const std::vector<RDFHandle>& children);
+	void SetShadows(RDFHandle rdf, const int* shadows, int count);
+	void SetShadows(RDFHandle rdf, const std::vector<int>& shadows);
+
+	// Bytes used by the columns and arenas, including unused capacity
+	size_t GetMemoryUsage() const;
+
+	// GetMemoryUsage split into the per RDF columns, the child and shadow ranges and the two arenas
+	MemoryUsage GetMemoryUsageTree(const std::string& name) const;
+
+	// Write the pool to sections [firstSection, firstSection + 14) of a bake file and read it back
+	void Save(BakeFileWriter& out, uint32_t firstSection) const;
+	bool Load(const BakeFile& in, uint32_t firstSection);
+
+private:
+	// Columns, all indexed by handle
+	std::vector<int> parentDirectoryIndex;
+	std::vector<int> bounce;
+	std::vector<RDFHandle> parentRDF;
+	std::vector<DirectX::SimpleMath::Color> color;
+	std::vector<float> lightBrightness;
+	std::vector<float> lightness;
+	std::vector<uint8_t> alive;
+
+	// Range of every RDF in the child and shadow arenas
+	std::vector<int> childOffset;
+	std::vector<int> childCount;
+	std::vector<int> shadowOffset;
+	std::vector<int> shadowCount;
+
+	std::vector<RDFHandle> childArena;
+	std::vector<int> shadowArena;
+
+	int releasedCount;
+};
@@ -0,0 +1,617 @@
+#include "pch.h"
+
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+#include "SceneDescription.h"
+
+using json = nlohmann::json;
+
+using namespace std;
+using namespace DirectX::SimpleMath;
+
+namespace
+{
+	// Keys the schema knows, everything else is skipped
+	enum SceneKey {
+		KS_SCENEKEY_OTHER,
+		KS_SCENEKEY_SCENENAME,
+		KS_SCENEKEY_SCENEDESCRIPTION,
+		KS_SCENEKEY_SCENESIZE,
+		KS_SCENEKEY_MESHES,
+		KS_SCENEKEY_MATERIALS,
+		KS_SCENEKEY_OBJECTS,
+		KS_SCENEKEY_CAMERA,
+		KS_SCENEKEY_NAME,
+		KS_SCENEKEY_MESH,
+		KS_SCENEKEY_MATERIAL,
+		KS_SCENEKEY_ALBEDO,
+		KS_SCENEKEY_EMISSIVEINTENSITY,
+		KS_SCENEKEY_ROUGHNESS,
+		KS_SCENEKEY_POSITION,
+		KS_SCENEKEY_ROTATION,
+		KS_SCENEKEY_SCALE,
+		KS_SCENEKEY_FOCALLENGTH,
+		KS_SCENEKEY_COUNT
+	};
+
+	const char* sceneKeyNames[KS_SCENEKEY_COUNT] = { "", "sceneName", "sceneDescription", "sceneSize", "meshes",
+		"materials", "objects", "camera", "name", "mesh", "material", "albedo", "emissiveIntensity", "roughness",
+		"position", "rotation", "scale", "focalLength" };
+
+	SceneKey LookupSceneKey(const string& key) {
+		for (int k = 1; k < KS_SCENEKEY_COUNT; k++) {
+			if (key == sceneKeyNames[k]) {
+				return (SceneKey)k;
+			}
+		}
+
+		return KS_SCENEKEY_OTHER;
+	}
+
+	uint32_t KeyBit(SceneKey key) {
+		return 1u << key;
+	}
+
+	// Keys each kind of object has to have
+	const uint32_t rootRequired = (1u << KS_SCENEKEY_SCENENAME) | (1u << KS_SCENEKEY_SCENEDESCRIPTION) | (1u << KS_SCENEKEY_CAMERA);
+	const uint32_t materialRequired = (1u << KS_SCENEKEY_NAME) | (1u << KS_SCENEKEY_ALBEDO) |
+		(1u << KS_SCENEKEY_EMISSIVEINTENSITY) | (1u << KS_SCENEKEY_ROUGHNESS);
+	const uint32_t objectRequired = (1u << KS_SCENEKEY_MESH) | (1u << KS_SCENEKEY_MATERIAL) |
+		(1u << KS_SCENEKEY_POSITION) | (1u << KS_SCENEKEY_ROTATION) | (1u << KS_SCENEKEY_SCALE);
+	const uint32_t cameraRequired = (1u << KS_SCENEKEY_POSITION) | (1u << KS_SCENEKEY_ROTATION) | (1u << KS_SCENEKEY_FOCALLENGTH);
+
+	// What a container in the file is to the schema
+	enum ParseContext {
+		KS_PARSE_ROOT,
+		KS_PARSE_MESH_LIST,
+		KS_PARSE_MATERIAL_LIST,
+		KS_PARSE_MATERIAL,
+		KS_PARSE_OBJECT_LIST,
+		KS_PARSE_OBJECT,
+		KS_PARSE_CAMERA,
+		// Three numbers, x y z
+		KS_PARSE_VECTOR,
+		// Anything under a key the schema does not know
+		KS_PARSE_SKIP
+	};
+
+	// What the next value has to be
+	enum ParseExpect {
+		KS_EXPECT_ROOT,
+		KS_EXPECT_STRING,
+		KS_EXPECT_NUMBER,
+		KS_EXPECT_MESH_LIST,
+		KS_EXPECT_MATERIAL_LIST,
+		KS_EXPECT_MATERIAL,
+		KS_EXPECT_OBJECT_LIST,
+		KS_EXPECT_OBJECT,
+		KS_EXPECT_CAMERA,
+		KS_EXPECT_VECTOR,
+		KS_EXPECT_ANY
+	};
+
+	struct ParseFrame {
+		ParseContext context;
+
+		// Last key read in an object
+		SceneKey key;
+
+		// Keys read so far in an object, elements so far in an array
+		uint32_t seen;
+		int count;
+
+		// Where the numbers of a KS_PARSE_VECTOR go
+		Vector3* vector;
+	};
+
+	// The nlohmann::json input format of a document format for sax_parse
+	json::input_format_t GetDocumentInputFormat(DocumentFormat format) {
+		switch (format) {
+		case KS_DOCFORMAT_CBOR:
+			return json::input_format_t::cbor;
+		case KS_DOCFORMAT_MSGPACK:
+			return json::input_format_t::msgpack;
+		default:
+			return json::input_format_t::json;
+		}
+	}
+
+	json VectorToDocument(const Vector3& v, DocumentFormat format) {
+		return json::array({ MakeDocumentFloat(v.x, format), MakeDocumentFloat(v.y, format), MakeDocumentFloat(v.z, format) });
+	}
+
+	/*
+	* Fills a SceneDescription from the SAX events of a scene file. Every event first works out what the
+	* value at this place has to be from the innermost container and its last key, then stores it or
+	* pushes a frame for it. Unknown keys push KS_PARSE_SKIP frames so whatever is under them is read and
+	* thrown away.
+	*/
+	class SceneDescriptionHandler : public nlohmann::json_sax<json>
+	{
+	public:
+		SceneDescriptionHandler(SceneDescription& scene, size_t documentSize) :
+			scene(scene),
+			documentSize(documentSize)
+		{
+		}
+
+		std::string error;
+
+		bool null() override {
+			return Scalar("null");
+		}
+
+		bool boolean(bool) override {
+			return Scalar("a boolean");
+		}
+
+		bool number_integer(number_integer_t val) override {
+			return Number((float)val);
+		}
+
+		bool number_unsigned(number_unsigned_t val) override {
+			return Number((float)val);
+		}
+
+		bool number_float(number_float_t val, const string_t&) override {
+			return Number((float)val);
+		}
+
+		bool string(string_t& val) override {
+			ParseExpect expect = BeginValue();
+
+			if (expect == KS_EXPECT_ANY) {
+				return true;
+			}
+			if (expect != KS_EXPECT_STRING) {
+				return Fail(Where() + " has to be " + ExpectName(expect) + ", not a string");
+			}
+
+			std::string* target = StringTarget();
+			if (target == nullptr) {
+				// A mesh path in the mesh list
+				scene.meshes.push_back(std::move(val));
+			}
+			else {
+				*target = std::move(val);
+			}
+
+			return true;
+		}
+
+		bool binary(binary_t&) override {
+			return Scalar("binary data");
+		}
+
+		bool start_object(size_t) override {
+			ParseExpect expect = BeginValue();
+
+			switch (expect) {
+			case KS_EXPECT_ROOT:
+				Push(KS_PARSE_ROOT);
+				return true;
+			case KS_EXPECT_MATERIAL:
+				scene.materials.push_back(MaterialDescription());
+				Push(KS_PARSE_MATERIAL);
+				return true;
+			case KS_EXPECT_OBJECT:
+				scene.objects.push_back(ObjectDescription());
+				Push(KS_PARSE_OBJECT);
+				return true;
+			case KS_EXPECT_CAMERA:
+				Push(KS_PARSE_CAMERA);
+				return true;
+			case KS_EXPECT_ANY:
+				Push(KS_PARSE_SKIP);
+				return true;
+			default:
+				return Fail(Where() + " has to be " + ExpectName(expect) + ", not an object");
+			}
+		}
+
+		bool key(string_t& val) override {
+			ParseFrame& frame = frames.back();
+
+			// Inside skipped values the keys do not matter
+			frame.key = frame.context == KS_PARSE_SKIP ? KS_SCENEKEY_OTHER : LookupSceneKey(val);
+			frame.seen |= KeyBit(frame.key);
+
+			return true;
+		}
+
+		bool end_object() override {
+			ParseFrame frame = frames.back();
+			frames.pop_back();
+
+			uint32_t required = 0;
+			std::string what;
+
+			switch (frame.context) {
+			case KS_PARSE_ROOT:
+				required = rootRequired;
+				what = "The scene";
+				break;
+			case KS_PARSE_MATERIAL:
+				required = materialRequired;
+				what = "Material " + to_string(scene.materials.size() - 1);
+				break;
+			case KS_PARSE_OBJECT:
+				required = objectRequired;
+				what = "Object " + to_string(scene.objects.size() - 1);
+				break;
+			case KS_PARSE_CAMERA:
+				required = cameraRequired;
+				what = "The camera";
+				break;
+			default:
+				break;
+			}
+
+			uint32_t missing = required & ~frame.seen;
+
+			for (int k = 1; k < KS_SCENEKEY_COUNT && missing != 0; k++) {
+				if (missing & KeyBit((SceneKey)k)) {
+					return Fail(what + " has no '" + sceneKeyNames[k] + "'");
+				}
+			}
+
+			return true;
+		}
+
+		bool start_array(size_t elements) override {
+			ParseExpect expect = BeginValue();
+
+			// Binary formats know the element count up front, text JSON passes -1. Every element takes at
+			// least a byte so a count larger than the document is broken and not worth reserving for.
+			bool sized = elements != (size_t)-1 && elements <= documentSize;
+
+			switch (expect) {
+			case KS_EXPECT_MESH_LIST:
+				if (sized) {
+					scene.meshes.reserve(scene.meshes.size() + elements);
+				}
+				Push(KS_PARSE_MESH_LIST);
+				return true;
+			case KS_EXPECT_MATERIAL_LIST:
+				if (sized) {
+					scene.materials.reserve(scene.materials.size() + elements);
+				}
+				Push(KS_PARSE_MATERIAL_LIST);
+				return true;
+			case KS_EXPECT_OBJECT_LIST:
+				if (sized) {
+					scene.objects.reserve(scene.objects.size() + elements);
+				}
+				Push(KS_PARSE_OBJECT_LIST);
+				return true;
+			case KS_EXPECT_VECTOR: {
+				Vector3* target = VectorTarget();
+				Push(KS_PARSE_VECTOR);
+				frames.back().vector = target;
+				return true;
+			}
+			case KS_EXPECT_ANY:
+				Push(KS_PARSE_SKIP);
+				return true;
+			default:
+				return Fail(Where() + " has to be " + ExpectName(expect) + ", not an array");
+			}
+		}
+
+		bool end_array() override {
+			ParseFrame frame = frames.back();
+			frames.pop_back();
+
+			if (frame.context == KS_PARSE_VECTOR && frame.count < 3) {
+				return Fail(Where() + " has to have 3 numbers");
+			}
+
+			return true;
+		}
+
+		bool parse_error(size_t, const std::string&, const nlohmann::detail::exception& ex) override {
+			return Fail(ex.what());
+		}
+
+	private:
+		SceneDescription& scene;
+		size_t documentSize;
+
+		vector<ParseFrame> frames;
+
+		void Push(ParseContext context) {
+			ParseFrame frame = { context, KS_SCENEKEY_OTHER, 0, 0, nullptr };
+			frames.push_back(frame);
+		}
+
+		bool Fail(const std::string& message) {
+			// Keep the first error, the parser reports its own after a handler returns false
+			if (error.empty()) {
+				error = message;
+			}
+
+			return false;
+		}
+
+		// What the value starting now has to be, counts it if it is an array element
+		ParseExpect BeginValue() {
+			if (frames.empty()) {
+				return KS_EXPECT_ROOT;
+			}
+
+			ParseFrame& frame = frames.back();
+			frame.count++;
+
+			switch (frame.context) {
+			case KS_PARSE_ROOT:
+				switch (frame.key) {
+				case KS_SCENEKEY_SCENENAME:
+				case KS_SCENEKEY_SCENEDESCRIPTION:
+				case KS_SCENEKEY_SCENESIZE:
+					return KS_EXPECT_STRING;
+				case KS_SCENEKEY_MESHES:
+					return KS_EXPECT_MESH_LIST;
+				case KS_SCENEKEY_MATERIALS:
+					return KS_EXPECT_MATERIAL_LIST;
+				case KS_SCENEKEY_OBJECTS:
+					return KS_EXPECT_OBJECT_LIST;
+				case KS_SCENEKEY_CAMERA:
+					return KS_EXPECT_CAMERA;
+				default:
+					return KS_EXPECT_ANY;
+				}
+			case KS_PARSE_MESH_LIST:
+				return KS_EXPECT_STRING;
+			case KS_PARSE_MATERIAL_LIST:
+				return KS_EXPECT_MATERIAL;
+			case KS_PARSE_OBJECT_LIST:
+				return KS_EXPECT_OBJECT;
+			case KS_PARSE_MATERIAL:
+				switch (frame.key) {
+				case KS_SCENEKEY_NAME:
+					return KS_EXPECT_STRING;
+				case KS_SCENEKEY_ALBEDO:
+					return KS_EXPECT_VECTOR;
+				case KS_SCENEKEY_EMISSIVEINTENSITY:
+				case KS_SCENEKEY_ROUGHNESS:
+					return KS_EXPECT_NUMBER;
+				default:
+					return KS_EXPECT_ANY;
+				}
+			case KS_PARSE_OBJECT:
+				switch (frame.key) {
+				case KS_SCENEKEY_NAME:
+				case KS_SCENEKEY_MESH:
+				case KS_SCENEKEY_MATERIAL:
+					return KS_EXPECT_STRING;
+				case KS_SCENEKEY_POSITION:
+				case KS_SCENEKEY_ROTATION:
+				case KS_SCENEKEY_SCALE:
+					return KS_EXPECT_VECTOR;
+				default:
+					return KS_EXPECT_ANY;
+				}
+			case KS_PARSE_CAMERA:
+				switch (frame.key) {
+				case KS_SCENEKEY_POSITION:
+				case KS_SCENEKEY_ROTATION:
+					return KS_EXPECT_VECTOR;
+				case KS_SCENEKEY_FOCALLENGTH:
+					return KS_EXPECT_NUMBER;
+				default:
+					return KS_EXPECT_ANY;
+				}
+			case KS_PARSE_VECTOR:
+				// Numbers past the third are ignored like they always were
+				return frame.count <= 3 ? KS_EXPECT_NUMBER : KS_EXPECT_ANY;
+			default:
+				return KS_EXPECT_ANY;
+			}
+		}
+
+		bool Scalar(const char* what) {
+			ParseExpect expect = BeginValue();
+
+			if (expect == KS_EXPECT_ANY) {
+				return true;
+			}
+
+			return Fail(Where() + " has to be " + ExpectName(expect) + ", not " + what);
+		}
+
+		bool Number(float value) {
+			ParseExpect expect = BeginValue();
+
+			if (expect == KS_EXPECT_ANY) {
+				return true;
+			}
+			if (expect != KS_EXPECT_NUMBER) {
+				return Fail(Where() + " has to be " + ExpectName(expect) + ", not a number");
+			}
+
+			ParseFrame& frame = frames.back();
+
+			if (frame.context == KS_PARSE_VECTOR) {
+				float* components[3] = { &frame.vector->x, &frame.vector->y, &frame.vector->z };
+				*components[frame.count - 1] = value;
+				return true;
+			}
+
+			*NumberTarget() = value;
+			return true;
+		}
+
+		// Field the string, number or vector under the current key goes to. Only called once
+		// BeginValue said the value has that type.
+		std::string* StringTarget() {
+			ParseFrame& frame = frames.back();
+
+			switch (frame.context) {
+			case KS_PARSE_ROOT:
+				return frame.key == KS_SCENEKEY_SCENENAME ? &scene.sceneName :
+					frame.key == KS_SCENEKEY_SCENEDESCRIPTION ? &scene.sceneDescription : &scene.sceneSize;
+			case KS_PARSE_MATERIAL:
+				return &scene.materials.back().name;
+			case KS_PARSE_OBJECT: {
+				ObjectDescription& object = scene.objects.back();
+				return frame.key == KS_SCENEKEY_NAME ? &object.name :
+					frame.key == KS_SCENEKEY_MESH ? &object.mesh : &object.material;
+			}
+			default:
+				return nullptr;
+			}
+		}
+
+		float* NumberTarget() {
+			ParseFrame& frame = frames.back();
+
+			if (frame.context == KS_PARSE_CAMERA) {
+				return &scene.camera.focalLength;
+			}
+
+			MaterialDescription& material = scene.materials.back();
+			return frame.key == KS_SCENEKEY_EMISSIVEINTENSITY ? &material.emissiveIntensity : &material.roughness;
+		}
+
+		Vector3* VectorTarget() {
+			ParseFrame& frame = frames.back();
+
+			switch (frame.context) {
+			case KS_PARSE_MATERIAL:
+				return &scene.materials.back().albedo;
+			case KS_PARSE_OBJECT: {
+				ObjectDescription& object = scene.objects.back();
+				return frame.key == KS_SCENEKEY_POSITION ? &object.position :
+					frame.key == KS_SCENEKEY_ROTATION ? &object.rotation : &object.scale;
+			}
+			default:
+				return frame.key == KS_SCENEKEY_POSITION ? &scene.camera.position : &scene.camera.rotation;
+			}
+		}
+
+		// Where in the file the current value is, like "'roughness' of material 3"
+		std::string Where() const {
+			if (frames.empty()) {
+				return "The scene";
+			}
+
+			const ParseFrame* frame = &frames.back();
+			std::string where;
+
+			// The key of a vector is on the frame of the object holding it
+			if (frame->context == KS_PARSE_VECTOR && frames.size() >= 2) {
+				frame = &frames[frames.size() - 2];
+			}
+
+			switch (frame->context) {
+			case KS_PARSE_MESH_LIST:
+				return "mesh " + to_string(frame->count - 1);
+			case KS_PARSE_MATERIAL_LIST:
+				return "material " + to_string(frame->count - 1);
+			case KS_PARSE_OBJECT_LIST:
+				return "object " + to_string(frame->count - 1);
+			case KS_PARSE_MATERIAL:
+				return "'" + std::string(sceneKeyNames[frame->key]) + "' of material " + to_string(scene.materials.size() - 1);
+			case KS_PARSE_OBJECT:
+				return "'" + std::string(sceneKeyNames[frame->key]) + "' of object " + to_string(scene.objects.size() - 1);
+			case KS_PARSE_CAMERA:
+				return "'" + std::string(sceneKeyNames[frame->key]) + "' of the camera";
+			default:
+				return "'" + std::string(sceneKeyNames[frame->key]) + "'";
+			}
+		}
+
+		static std::string ExpectName(ParseExpect expect) {
+			switch (expect) {
+			case KS_EXPECT_ROOT:
+			case KS_EXPECT_MATERIAL:
+			case KS_EXPECT_OBJECT:
+			case KS_EXPECT_CAMERA:
+				return "an object";
+			case KS_EXPECT_STRING:
+				return "a string";
+			case KS_EXPECT_NUMBER:
+				return "a number";
+			case KS_EXPECT_VECTOR:
+				return "an array of 3 numbers";
+			default:
+				return "an array";
+			}
+		}
+	};
+}
+
+bool ReadSceneDescription(const string& path, SceneDescription& scene, string& error) {
+	// Parsing from memory is faster than from a stream and lets the format be told from the first bytes
+	vector<uint8_t> data;
+
+	if (!ReadDocumentFile(path, data)) {
+		error = "Scene file '" + path + "' does not exist!";
+		return false;
+	}
+
+	size_t headerSize;
+	DocumentFormat format = DetectDocumentFormat(data.data(), data.size(), headerSize);
+
+	scene = SceneDescription();
+
+	SceneDescriptionHandler handler(scene, data.size() - headerSize);
+
+	if (!json::sax_parse(data.data() + headerSize, data.data() + data.size(), &handler, GetDocumentInputFormat(format))) {
+		error = "Scene file '" + path + "' (" + GetDocumentFormatName(format) + ") is invalid: " + handler.error;
+		return false;
+	}
+
+	return true;
+}
+
+json SceneDescriptionToDocument(const SceneDescription& scene, DocumentFormat format) {
+	json doc;
+
+	doc["sceneName"] = scene.sceneName;
+	doc["sceneDescription"] = scene.sceneDescription;
+
+	if (!scene.sceneSize.empty()) {
+		doc["sceneSize"] = scene.sceneSize;
+	}
+
+	doc["meshes"] = scene.meshes;
+
+	json& materials = doc["materials"] = json::array();
+	for (const MaterialDescription& material : scene.materials) {
+		json m;
+		m["name"] = material.name;
+		m["albedo"] = VectorToDocument(material.albedo, format);
+		m["emissiveIntensity"] = MakeDocumentFloat(material.emissiveIntensity, format);
+		m["roughness"] = MakeDocumentFloat(material.roughness, format);
+
+		materials.push_back(std::move(m));
+	}
+
+	json& objects = doc["objects"] = json::array();
+	for (const ObjectDescription& object : scene.objects) {
+		json o;
+		if (!object.name.empty()) {
+			o["name"] = object.name;
+		}
+		o["mesh"] = object.mesh;
+		o["material"] = object.material;
+		o["position"] = VectorToDocument(object.position, format);
+		o["rotation"] = VectorToDocument(object.rotation, format);
+		o["scale"] = VectorToDocument(object.scale, format);
+
+		objects.push_back(std::move(o));
+	}
+
+	json& camera = doc["camera"];
+	camera["position"] = VectorToDocument(scene.camera.position, format);
+	camera["rotation"] = VectorToDocument(scene.camera.rotation, format);
+	camera["focalLength"] = MakeDocumentFloat(scene.camera.focalLength, format);
+
+	return doc;
+}
+
+bool WriteSceneDescription(const string& path, const SceneDescription& scene, DocumentFormat format, string& error) {
+	return WriteDocument(path, SceneDescriptionToDocument(scene, format), format, error);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+#include <SimpleMath.h>
+
+#include "DocumentFormat.h"
+
+/*
+* Kenos scene descriptions, what a scene file says before anything is loaded from it.
+*
+* ReadSceneDescription feeds the scene file through the SAX interface of nlohmann::json and fills the
+* structures below as the tokens come in, no document is built. The schema is the one of
+* assets/cornell_box.json: sceneName, sceneDescription and camera are required, sceneSize, meshes,
+* materials and objects are optional and any other key is skipped. Keys can come in any order.
+*
+* Scene files can be text JSON, CBOR or MessagePack with the same keys, see DocumentFormat.h. The format
+* is detected from the first bytes of the file.
+*/
+
+struct MaterialDescription {
+	std::string name;
+
+	// 0-255 per channel like Material::SetAlbedo
+	DirectX::SimpleMath::Vector3 albedo;
+	float emissiveIntensity;
+	float roughness;
+};
+
+struct ObjectDescription {
+	// Optional, not used by the engine
+	std::string name;
+
+	std::string mesh;
+	std::string material;
+
+	DirectX::SimpleMath::Vector3 position;
+	DirectX::SimpleMath::Vector3 rotation;
+	DirectX::SimpleMath::Vector3 scale;
+};
+
+struct CameraDescription {
+	DirectX::SimpleMath::Vector3 position;
+	DirectX::SimpleMath::Vector3 rotation;
+	float focalLength;
+};
+
+struct SceneDescription {
+	std::string sceneName;
+	std::string sceneDescription;
+
+	// "small", "medium" or "large" as written in the file, empty if it has none
+	std::string sceneSize;
+
+	// Paths of the mesh files in file order
+	std::vector<std::string> meshes;
+
+	std::vector<MaterialDescription> materials;
+	std::vector<ObjectDescription> objects;
+
+	CameraDescription camera;
+};
+
+// Read the scene file at path into scene. Returns false with the reason in error if the file could not
+// be read, is not a valid document or does not fit the schema.
+bool ReadSceneDescription(const std::string& path, SceneDescription& scene, std::string& error);
+
+// The document ReadSceneDescription reads back into scene. An empty sceneSize and empty object names are
+// left out.
+nlohmann::json SceneDescriptionToDocument(const SceneDescription& scene, DocumentFormat format);
+
+// Write scene to path in format. Returns false with the reason in error if the file could not be written.
+bool WriteSceneDescription(const std::string& path, const SceneDescription& scene, DocumentFormat format,
+	std::string& error);
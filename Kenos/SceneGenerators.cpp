@@ -0,0 +1,462 @@
+#include "pch.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+
+#include "SceneGenerators.h"
+
+using namespace std;
+using namespace DirectX;
+using namespace DirectX::SimpleMath;
+
+namespace
+{
+	// std distributions are implementation defined, this is not, so a seed gives the same scene with
+	// every standard library
+	float RandomFloat(mt19937& rng, float low, float high) {
+		return low + (high - low) * ((rng() >> 8) * (1.0f / 16777216.0f));
+	}
+
+	// Append triangle abc given counter clockwise as seen from its front, the side that receives and
+	// casts light. The lighting code treats the side opposite to cross(b - a, c - a) as the front.
+	void AddTriangle(vector<uint32_t>& indices, int a, int b, int c) {
+		uint32_t face[3] = { (uint32_t)a, (uint32_t)c, (uint32_t)b };
+		indices.insert(indices.end(), face, face + 3);
+	}
+
+	// Append a grid of n by n quads spanning centre +- u +- v, front facing the side front points to
+	void AddGrid(vector<Vector3>& vertices, vector<uint32_t>& indices, Vector3 centre, Vector3 u, Vector3 v,
+		int n, Vector3 front) {
+
+		int first = (int)vertices.size();
+
+		for (int i = 0; i <= n; i++) {
+			for (int j = 0; j <= n; j++) {
+				float s = i / (float)n * 2.0f - 1.0f;
+				float t = j / (float)n * 2.0f - 1.0f;
+
+				vertices.push_back(centre + u * s + v * t);
+			}
+		}
+
+		// u, v is counter clockwise seen from the side cross(u, v) points to
+		bool flip = u.Cross(v).Dot(front) < 0.0f;
+
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++) {
+				int a = first + i * (n + 1) + j;
+				int b = a + n + 1;
+				int c = b + 1;
+				int d = a + 1;
+
+				if (flip) {
+					AddTriangle(indices, a, c, b);
+					AddTriangle(indices, a, d, c);
+				}
+				else {
+					AddTriangle(indices, a, b, c);
+					AddTriangle(indices, a, c, d);
+				}
+			}
+		}
+	}
+
+	Material MakeMaterial(Color albedo, float emissiveIntensity) {
+		Material material;
+		material.SetAlbedo(albedo);
+		material.SetRoughness(1.0f);
+		material.SetEmissiveIntensity(emissiveIntensity);
+		return material;
+	}
+
+	// Quads per side of a grid with about triangles triangles
+	int GridSizeFor(double triangles) {
+		return max((int)lround(sqrt(max(triangles, 2.0) / 2.0)), 1);
+	}
+
+	// Emissive panel facing down at height y, every generated scene has one
+	void AddCeilingLight(SceneInformation& scene, float y, float halfSize, float intensity) {
+		vector<Vector3> vertices;
+		vector<uint32_t> indices;
+		AddGrid(vertices, indices, Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(0, 0, 1), 1, Vector3(0, -1, 0));
+
+		scene.addMesh("light", Mesh(vertices, indices));
+		scene.addMaterial("light", MakeMaterial(Color(255, 255, 255), intensity));
+		scene.addObject("light", "light", Vector3(0, y, 0), Vector3(0, 0, 0), Vector3(halfSize, 1, halfSize));
+	}
+
+	void BeginScene(SceneInformation& scene, SceneGeneratorType type, int targetTriangles, unsigned int seed) {
+		scene.clearScene();
+		scene.setSceneName(GetSceneGeneratorName(type));
+		scene.setSceneDescription("Generated, " + to_string(targetTriangles) + " triangles, seed " + to_string(seed));
+		scene.setSceneSize(KS_SCENESIZE_SMALL);
+	}
+}
+
+Mesh CreateIcosphereMesh(int subdivisions) {
+	const float t = (1.0f + sqrt(5.0f)) / 2.0f;
+
+	vector<Vector3> vertices = {
+		Vector3(-1,  t,  0), Vector3( 1,  t,  0), Vector3(-1, -t,  0), Vector3( 1, -t,  0),
+		Vector3( 0, -1,  t), Vector3( 0,  1,  t), Vector3( 0, -1, -t), Vector3( 0,  1, -t),
+		Vector3( t,  0, -1), Vector3( t,  0,  1), Vector3(-t,  0, -1), Vector3(-t,  0,  1)
+	};
+
+	// counter clockwise seen from outside
+	vector<int> faces = {
+		0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+		1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+		3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+		4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1
+	};
+
+	for (Vector3& v : vertices) {
+		v.Normalize();
+	}
+
+	for (int s = 0; s < subdivisions; s++) {
+		// Edges are shared by two faces, both have to use the same midpoint
+		unordered_map<uint64_t, int> midpoints;
+		midpoints.reserve(faces.size());
+
+		auto midpoint = [&](int a, int b) {
+			uint64_t key = ((uint64_t)min(a, b) << 32) | (uint64_t)max(a, b);
+
+			unordered_map<uint64_t, int>::iterator found = midpoints.find(key);
+			if (found != midpoints.end()) {
+				return found->second;
+			}
+
+			Vector3 mid = (vertices[a] + vertices[b]) * 0.5f;
+			mid.Normalize();
+			vertices.push_back(mid);
+
+			int idx = (int)vertices.size() - 1;
+			midpoints[key] = idx;
+			return idx;
+		};
+
+		vector<int> subdivided;
+		subdivided.reserve(faces.size() * 4);
+
+		for (size_t f = 0; f < faces.size(); f += 3) {
+			int a = faces[f];
+			int b = faces[f + 1];
+			int c = faces[f + 2];
+
+			int ab = midpoint(a, b);
+			int bc = midpoint(b, c);
+			int ca = midpoint(c, a);
+
+			int children[12] = { a, ab, ca,   b, bc, ab,   c, ca, bc,   ab, bc, ca };
+			subdivided.insert(subdivided.end(), children, children + 12);
+		}
+
+		faces.swap(subdivided);
+	}
+
+	vector<uint32_t> indices;
+	indices.reserve(faces.size());
+
+	for (size_t f = 0; f < faces.size(); f += 3) {
+		AddTriangle(indices, faces[f], faces[f + 1], faces[f + 2]);
+	}
+
+	return Mesh(vertices, indices);
+}
+
+Mesh CreateGridMesh(int n, float jitter, unsigned int seed) {
+	n = max(n, 1);
+
+	vector<Vector3> vertices;
+	vector<uint32_t> indices;
+	vertices.reserve((n + 1) * (n + 1));
+	indices.reserve(6 * n * n);
+
+	AddGrid(vertices, indices, Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(0, 0, 1), n, Vector3(0, 1, 0));
+
+	if (jitter > 0.0f) {
+		mt19937 rng(seed);
+		for (Vector3& v : vertices) {
+			v.y += RandomFloat(rng, -jitter, jitter);
+		}
+	}
+
+	return Mesh(vertices, indices);
+}
+
+Mesh CreateBoxMesh(int n) {
+	n = max(n, 1);
+
+	vector<Vector3> vertices;
+	vector<uint32_t> indices;
+	vertices.reserve(6 * (n + 1) * (n + 1));
+	indices.reserve(36 * n * n);
+
+	Vector3 axes[3] = { Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1) };
+
+	for (int axis = 0; axis < 3; axis++) {
+		Vector3 u = axes[(axis + 1) % 3];
+		Vector3 v = axes[(axis + 2) % 3];
+
+		AddGrid(vertices, indices, axes[axis], u, v, n, axes[axis]);
+		AddGrid(vertices, indices, -axes[axis], u, v, n, -axes[axis]);
+	}
+
+	return Mesh(vertices, indices);
+}
+
+void GenerateIcospheres(SceneInformation& scene, int targetTriangles, unsigned int seed) {
+	BeginScene(scene, KS_SCENEGEN_ICOSPHERES, targetTriangles, seed);
+	mt19937 rng(seed);
+
+	// About nine tenths of the triangles go to the spheres. The finest subdivision that still leaves
+	// room for a few spheres is used, up to the largest object the generators make. The floor gets
+	// whatever is left so the total lands close to the target.
+	double sphereBudget = max(targetTriangles * 0.9, 20.0);
+
+	int subdivisions = 0;
+	while (subdivisions < 10 && 20.0 * pow(4.0, subdivisions + 1) * 4.0 <= sphereBudget &&
+		20.0 * pow(4.0, subdivisions + 1) <= KS_SCENEGEN_MAX_OBJECT_TRIS) {
+		subdivisions++;
+	}
+
+	int sphereTris = 20 * (1 << (2 * subdivisions));
+	int sphereCount = max((int)(sphereBudget / sphereTris), 1);
+
+	int floorSize = GridSizeFor(targetTriangles - (double)sphereCount * sphereTris - 2.0);
+
+	int side = (int)ceil(sqrt((double)sphereCount));
+	float spacing = 2.5f;
+	float extent = side * spacing * 0.5f;
+
+	scene.addMesh("icosphere", CreateIcosphereMesh(subdivisions));
+	scene.addMesh("floor", CreateGridMesh(floorSize, 0.0f, seed));
+
+	scene.addMaterial("floor", MakeMaterial(Color(200, 200, 200), 0.0f));
+	scene.addMaterial("sphere", MakeMaterial(Color(255, 255, 255), 0.0f));
+
+	scene.addObject("floor", "floor", Vector3(0, 0, 0), Vector3(0, 0, 0), Vector3(extent + 1.0f, 1, extent + 1.0f));
+
+	for (int i = 0; i < sphereCount; i++) {
+		float radius = RandomFloat(rng, 0.6f, 1.0f);
+		float x = (i % side - (side - 1) * 0.5f) * spacing;
+		float z = (i / side - (side - 1) * 0.5f) * spacing;
+
+		scene.addObject("icosphere", "sphere", Vector3(x, radius, z),
+			Vector3(RandomFloat(rng, 0.0f, XM_2PI), RandomFloat(rng, 0.0f, XM_2PI), 0.0f),
+			Vector3(radius, radius, radius));
+	}
+
+	AddCeilingLight(scene, 4.0f, max(extent * 0.25f, 0.5f), 10.0f);
+
+	scene.setCamera(Vector3(0, 2.0f, -extent - 4.0f), Vector3(0, 0, 0), 1.0f);
+	scene.finishScene();
+}
+
+void GenerateCornellBox(SceneInformation& scene, int targetTriangles, unsigned int seed) {
+	BeginScene(scene, KS_SCENEGEN_CORNELL_BOX, targetTriangles, seed);
+	mt19937 rng(seed);
+
+	// 5 walls of 2 n^2 triangles and two blocks of 12 b^2 with b about n / 2, 16 n^2 in total. Try the
+	// sizes around that and keep the pair closest to the target.
+	int wallGuess = max((int)sqrt(max(targetTriangles - 2, 16) / 16.0), 2);
+	int n = wallGuess;
+	int blockSize = 1;
+	double bestError = -1.0;
+
+	for (int wallSize = max(wallGuess - 2, 2); wallSize <= wallGuess + 2; wallSize++) {
+		for (int size = max(wallSize / 2 - 2, 1); size <= wallSize / 2 + 2; size++) {
+			double error = fabs(10.0 * wallSize * wallSize + 24.0 * size * size + 2.0 - targetTriangles);
+
+			if (bestError < 0.0 || error < bestError) {
+				bestError = error;
+				n = wallSize;
+				blockSize = size;
+			}
+		}
+	}
+
+	// Walls bulge a little so they are not perfectly flat, seeded
+	float jitter = 0.1f / n;
+
+	struct Wall {
+		const char* name;
+		const char* material;
+		Vector3 centre;
+		Vector3 u;
+		Vector3 v;
+	};
+
+	// The room is [-1, 1]^3, open towards -z. Every wall faces the inside.
+	Wall walls[5] = {
+		{ "floor", "white", Vector3(0, -1, 0), Vector3(1, 0, 0), Vector3(0, 0, 1) },
+		{ "ceiling", "white", Vector3(0, 1, 0), Vector3(1, 0, 0), Vector3(0, 0, 1) },
+		{ "back", "white", Vector3(0, 0, 1), Vector3(1, 0, 0), Vector3(0, 1, 0) },
+		{ "left", "red", Vector3(-1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1) },
+		{ "right", "green", Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1) }
+	};
+
+	scene.addMaterial("white", MakeMaterial(Color(255, 255, 255), 0.0f));
+	scene.addMaterial("red", MakeMaterial(Color(255, 40, 40), 0.0f));
+	scene.addMaterial("green", MakeMaterial(Color(40, 255, 40), 0.0f));
+
+	for (const Wall& wall : walls) {
+		vector<Vector3> vertices;
+		vector<uint32_t> indices;
+		AddGrid(vertices, indices, wall.centre, wall.u, wall.v, n, -wall.centre);
+
+		for (Vector3& vertex : vertices) {
+			vertex += wall.centre * RandomFloat(rng, -jitter, jitter);
+		}
+
+		scene.addMesh(wall.name, Mesh(vertices, indices));
+		scene.addObject(wall.name, wall.material, Vector3(0, 0, 0), Vector3(0, 0, 0), Vector3(1, 1, 1));
+	}
+
+	scene.addMesh("block", CreateBoxMesh(blockSize));
+
+	scene.addObject("block", "white", Vector3(RandomFloat(rng, -0.5f, -0.3f), -0.4f, RandomFloat(rng, 0.2f, 0.4f)),
+		Vector3(0, RandomFloat(rng, 0.0f, XM_PIDIV2), 0), Vector3(0.3f, 0.6f, 0.3f));
+	scene.addObject("block", "white", Vector3(RandomFloat(rng, 0.3f, 0.5f), -0.7f, RandomFloat(rng, -0.4f, -0.2f)),
+		Vector3(0, RandomFloat(rng, 0.0f, XM_PIDIV2), 0), Vector3(0.3f, 0.3f, 0.3f));
+
+	AddCeilingLight(scene, 0.98f, 0.25f, 10.0f);
+
+	scene.setCamera(Vector3(0, 0, -3.5f), Vector3(0, 0, 0), 1.0f);
+	scene.finishScene();
+}
+
+void GenerateTriangleSoup(SceneInformation& scene, int targetTriangles, unsigned int seed) {
+	BeginScene(scene, KS_SCENEGEN_TRIANGLE_SOUP, targetTriangles, seed);
+	mt19937 rng(seed);
+
+	// Triangles in a cube of half size 5, sized so the soup is about as dense at any count
+	const float halfSize = 5.0f;
+	int triangles = max(targetTriangles - 2, 1);
+	float edge = 3.0f * halfSize / cbrt((float)triangles);
+
+	scene.addMaterial("soup", MakeMaterial(Color(255, 255, 255), 0.0f));
+
+	for (int first = 0, part = 0; first < triangles; first += KS_SCENEGEN_MAX_OBJECT_TRIS, part++) {
+		int count = min(triangles - first, KS_SCENEGEN_MAX_OBJECT_TRIS);
+
+		vector<Vector3> vertices;
+		vector<uint32_t> indices;
+		vertices.reserve(count * 3);
+		indices.reserve(count * 3);
+
+		for (int i = 0; i < count; i++) {
+			Vector3 centre(RandomFloat(rng, -halfSize, halfSize), RandomFloat(rng, -halfSize, halfSize), RandomFloat(rng, -halfSize, halfSize));
+
+			int base = (int)vertices.size();
+			for (int k = 0; k < 3; k++) {
+				vertices.push_back(centre + Vector3(RandomFloat(rng, -edge, edge), RandomFloat(rng, -edge, edge), RandomFloat(rng, -edge, edge)));
+			}
+
+			AddTriangle(indices, base, base + 1, base + 2);
+		}
+
+		string name = "soup" + to_string(part);
+		scene.addMesh(name, Mesh(vertices, indices));
+		scene.addObject(name, "soup", Vector3(0, 0, 0), Vector3(0, 0, 0), Vector3(1, 1, 1));
+	}
+
+	AddCeilingLight(scene, halfSize + 1.0f, halfSize * 0.5f, 10.0f);
+
+	scene.setCamera(Vector3(0, 0, -3.0f * halfSize), Vector3(0, 0, 0), 1.0f);
+	scene.finishScene();
+}
+
+void GenerateObjectField(SceneInformation& scene, int targetTriangles, int objectCount, unsigned int seed) {
+	BeginScene(scene, KS_SCENEGEN_OBJECT_FIELD, targetTriangles, seed);
+	mt19937 rng(seed);
+
+	if (objectCount <= 0) {
+		objectCount = max(targetTriangles / 500, 1);
+	}
+
+	// Every object is the same subdivided box, the ground under them gets what is left
+	int boxSize = max((int)(sqrt(max(targetTriangles * 0.9, 12.0) / 12.0 / objectCount)), 1);
+	int groundSize = GridSizeFor(targetTriangles - 12.0 * boxSize * boxSize * objectCount - 2.0);
+
+	int side = (int)ceil(sqrt((double)objectCount));
+	float spacing = 3.0f;
+	float extent = side * spacing * 0.5f;
+
+	scene.addMesh("box", CreateBoxMesh(boxSize));
+	scene.addMesh("ground", CreateGridMesh(groundSize, 0.0f, seed));
+
+	// A few materials spread over the field so the light tree sees different albedos
+	const int paletteSize = 4;
+	string palette[paletteSize];
+
+	for (int i = 0; i < paletteSize; i++) {
+		palette[i] = "field" + to_string(i);
+		scene.addMaterial(palette[i], MakeMaterial(Color(RandomFloat(rng, 64, 255), RandomFloat(rng, 64, 255), RandomFloat(rng, 64, 255)), 0.0f));
+	}
+
+	for (int i = 0; i < objectCount; i++) {
+		float x = (i % side - (side - 1) * 0.5f) * spacing;
+		float z = (i / side - (side - 1) * 0.5f) * spacing;
+		float scale = RandomFloat(rng, 0.5f, 1.0f);
+
+		Vector3 position(x + RandomFloat(rng, -0.4f, 0.4f), RandomFloat(rng, -0.5f, 0.5f), z + RandomFloat(rng, -0.4f, 0.4f));
+		Vector3 rotation(RandomFloat(rng, 0.0f, XM_2PI), RandomFloat(rng, 0.0f, XM_2PI), RandomFloat(rng, 0.0f, XM_2PI));
+
+		scene.addObject("box", palette[rng() % paletteSize], position, rotation, Vector3(scale, scale, scale));
+	}
+
+	scene.addObject("ground", palette[0], Vector3(0, -2.0f, 0), Vector3(0, 0, 0), Vector3(extent + 1.0f, 1, extent + 1.0f));
+
+	AddCeilingLight(scene, 4.0f, max(extent * 0.5f, 1.0f), 10.0f);
+
+	scene.setCamera(Vector3(0, 3.0f, -extent - 4.0f), Vector3(0, 0, 0), 1.0f);
+	scene.finishScene();
+}
+
+void GenerateScene(SceneInformation& scene, SceneGeneratorType type, int targetTriangles, unsigned int seed, int objectCount) {
+	switch (type) {
+	case KS_SCENEGEN_ICOSPHERES:
+		GenerateIcospheres(scene, targetTriangles, seed);
+		break;
+	case KS_SCENEGEN_CORNELL_BOX:
+		GenerateCornellBox(scene, targetTriangles, seed);
+		break;
+	case KS_SCENEGEN_TRIANGLE_SOUP:
+		GenerateTriangleSoup(scene, targetTriangles, seed);
+		break;
+	case KS_SCENEGEN_OBJECT_FIELD:
+		GenerateObjectField(scene, targetTriangles, objectCount, seed);
+		break;
+	}
+}
+
+const char* GetSceneGeneratorName(SceneGeneratorType type) {
+	switch (type) {
+	case KS_SCENEGEN_ICOSPHERES:
+		return "icospheres";
+	case KS_SCENEGEN_CORNELL_BOX:
+		return "cornell";
+	case KS_SCENEGEN_TRIANGLE_SOUP:
+		return "soup";
+	case KS_SCENEGEN_OBJECT_FIELD:
+		return "field";
+	}
+	return "unknown";
+}
+
+bool ParseSceneGeneratorType(const string& name, SceneGeneratorType& type) {
+	SceneGeneratorType types[4] = { KS_SCENEGEN_ICOSPHERES, KS_SCENEGEN_CORNELL_BOX, KS_SCENEGEN_TRIANGLE_SOUP, KS_SCENEGEN_OBJECT_FIELD };
+
+	for (SceneGeneratorType candidate : types) {
+		if (name == GetSceneGeneratorName(candidate)) {
+			type = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+
+#include "Mesh.h"
+#include "SceneInformation.h"
+
+/*
+* Kenos scene generators, procedural scenes of any size built straight into a SceneInformation with
+* the scene builder API, no scene file or mesh files involved.
+*
+* Every generator takes a target triangle count and a seed. The result lands within a few percent of
+* the target (the meshes are grids and subdivided spheres so not every count can be hit exactly) and
+* the same seed always gives the same scene, on any machine. Every scene has an emissive object so
+* BuildLightTree has light to propagate.
+*/
+
+enum SceneGeneratorType
+{
+	// Subdivided icospheres spread over a floor
+	KS_SCENEGEN_ICOSPHERES,
+	// Cornell box, five subdivided walls, a ceiling light and two blocks
+	KS_SCENEGEN_CORNELL_BOX,
+	// Randomly placed and oriented triangles, split into objects of at most KS_SCENEGEN_MAX_OBJECT_TRIS
+	KS_SCENEGEN_TRIANGLE_SOUP,
+	// One mesh instanced as many objects laid out on a grid
+	KS_SCENEGEN_OBJECT_FIELD
+};
+
+// Largest object the generators make. Mesh indices are uint32, so this is not a format limit: it keeps
+// big soups split into several objects (objects are the unit of per-object updates and of the
+// parallel object build) and keeps the scene for a given target and seed the same as in earlier runs.
+#define KS_SCENEGEN_MAX_OBJECT_TRIS 1000000
+
+// Unit icosphere, 20 * 4^subdivisions triangles with outward facing normals
+Mesh CreateIcosphereMesh(int subdivisions);
+
+// Grid of n by n quads (2 * n^2 triangles) covering [-1, 1] in x and z with its normal along +y.
+// jitter moves every vertex by up to that much in y, seeded by seed.
+Mesh CreateGridMesh(int n, float jitter = 0.0f, unsigned int seed = 0);
+
+// Closed box over [-1, 1]^3 with every face a grid of n by n quads (12 * n^2 triangles), normals out
+Mesh CreateBoxMesh(int n);
+
+void GenerateIcospheres(SceneInformation& scene, int targetTriangles, unsigned int seed);
+void GenerateCornellBox(SceneInformation& scene, int targetTriangles, unsigned int seed);
+void GenerateTriangleSoup(SceneInformation& scene, int targetTriangles, unsigned int seed);
+
+// objectCount of 0 picks one from the target, about 500 triangles per object
+void GenerateObjectField(SceneInformation& scene, int targetTriangles, int objectCount, unsigned int seed);
+
+// Clear scene and fill it with the given generator. objectCount is only used by KS_SCENEGEN_OBJECT_FIELD.
+void GenerateScene(SceneInformation& scene, SceneGeneratorType type, int targetTriangles, unsigned int seed, int objectCount = 0);
+
+// Name of a generator as used on command lines ("icospheres", "cornell", "soup", "field") and back.
+// ParseSceneGeneratorType returns false for unknown names.
+const char* GetSceneGeneratorName(SceneGeneratorType type);
+bool ParseSceneGeneratorType(const std::string& name, SceneGeneratorType& type);
@@ -1,180 +1,455 @@
 #include "pch.h"
 
 #include "SceneInformation.h"
+#include "CoreFuncsLib.h"
+#include "MeshCache.h"
+#include "ObjLoader.h"
+#include "SceneDescription.h"
+#include "ProfilingLib.h"
+#include "ThreadingLib.h"
 
 #include <assimp/Importer.hpp>      // C++ importer interface
 #include <assimp/scene.h>           // Output data structure
 #include <assimp/postprocess.h>     // Post processing flags
 
+#include <cctype>
 #include <fstream>
-#include <nlohmann/json.hpp>
-
-using json = nlohmann::json;
+#include <set>
 
 using namespace std;
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
+namespace
+{
+	const unsigned int meshImportFlags = aiProcess_Triangulate | aiProcess_ConvertToLeftHanded;
+
+	bool HasObjExtension(const string& path) {
+		if (path.size() < 4 || path[path.size() - 4] != '.') {
+			return false;
+		}
+
+		string extension = path.substr(path.size() - 3);
+		transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower(c); });
+
+		return extension == "obj";
+	}
+
+	// Import the first mesh of the file at path into mesh. Returns the error message, empty if it worked.
+	// Only touches its arguments (and the mesh cache of path) so meshes can be imported on several
+	// threads at once. threadCount is how many threads a single large OBJ file may be parsed on. fileHash
+	// is set to the HashFile of the mesh file, 0 if it could not be read.
+	string ImportMesh(const string& path, Mesh& mesh, int threadCount, uint64_t& fileHash) {
+		KS_PROFILE_ZONE("LoadMesh");
+
+		// check if the mesh file exists
+		ifstream f(path);
+		if (!f.good()) {
+			return "Mesh file '" + path + "' does not exist!";
+		}
+
+		// Use the cache from an earlier import while the mesh file is unchanged
+		string cachePath = path + KS_MESH_CACHE_EXTENSION;
+		uint64_t cacheKey = ComputeMeshCacheKey(path, meshImportFlags, fileHash);
+
+		if (cacheKey != 0 && LoadMeshCache(cachePath, cacheKey, mesh)) {
+			KS_PROFILE_COUNT("meshCacheHits", 1);
+			return string();
+		}
+
+		// Triangulated OBJ files are parsed in parallel without Assimp, the mesh comes out the same.
+		// Anything the fast path does not handle goes to Assimp.
+		bool isObj = HasObjExtension(path);
+		string fastPathFailure;
+
+		if (!isObj || !LoadObjFast(path, mesh, threadCount, fastPathFailure)) {
+			if (isObj) {
+				KS_PROFILE_COUNT("objFastPathFallbacks", 1);
+			}
+
+			// use AssImp to import mesh
+			Assimp::Importer importer;
+
+			const aiScene* scene = importer.ReadFile(path, meshImportFlags);
+
+			// check if the mesh file is valid
+			if (!scene || scene->mNumMeshes == 0) {
+				return "Mesh file '" + path + "' is invalid (AssImp error)!";
+			}
+
+			// get the first mesh in the scene
+			const aiMesh* aiMesh = scene->mMeshes[0];
+
+			// Both buffers are sized up front and written in place, vertices are converted as is and every
+			// face becomes the 3 indices of the triangle
+			mesh.m_vertices.resize(aiMesh->mNumVertices);
+			for (unsigned int i = 0; i < aiMesh->mNumVertices; i++) {
+				const aiVector3D& aiPos = aiMesh->mVertices[i];
+				mesh.m_vertices[i] = Vector3(aiPos.x, aiPos.y, aiPos.z);
+			}
+
+			vector<uint32_t> indices(3 * (size_t)aiMesh->mNumFaces);
+			for (unsigned int i = 0; i < aiMesh->mNumFaces; i++) {
+				const aiFace& aiFace = aiMesh->mFaces[i];
+				indices[3 * i] = aiFace.mIndices[0];
+				indices[3 * i + 1] = aiFace.mIndices[1];
+				indices[3 * i + 2] = aiFace.mIndices[2];
+			}
+			mesh.SetIndices(std::move(indices));
+		}
+
+		// A mesh directory that cannot be written to only means no cache
+		if (cacheKey != 0) {
+			SaveMeshCache(cachePath, cacheKey, mesh);
+		}
+
+		KS_PROFILE_COUNT("meshCacheMisses", 1);
+		return string();
+	}
+
+	MaterialDescription DescribeMaterial(const string& name, const Material& material) {
+		MaterialDescription m;
+		m.name = name;
+
+		const Color& albedo = material.GetAlbedo();
+		m.albedo = Vector3(albedo.x, albedo.y, albedo.z);
+		m.emissiveIntensity = material.GetEmissiveIntensity();
+		m.roughness = material.GetRoughness();
+
+		return m;
+	}
+}
+
 // Default constructor
 SceneInformation::SceneInformation() {
 	globalPolyCount = 0;
 	size = KS_SCENESIZE_SMALL;
+	objTriOffsets = { 0 };
+
+	setCamera(Vector3(0, 0, 0), Vector3(0, 0, 0), 1.0f);
 };
 
 SceneInformation::SceneInformation(string filePath) {
-	// Load the scene file
-	ifstream f(filePath);
-	if (!f.good()) {
-		string errorMessage = "Scene file file '" + filePath + "' does not exist!";
-		MessageBoxA(NULL, errorMessage.c_str(), "Fatal error", MB_ICONERROR | MB_OK);
-		exit(0);
-	}
+	KS_PROFILE_ZONE("SceneLoad");
+
+	// Load the scene file, it is streamed straight into the description without building a json document
+	SceneDescription desc;
+	string errorMessage;
 
-	json data = json::parse(f);
+	{
+		KS_PROFILE_ZONE("ParseScene");
+
+		if (!ReadSceneDescription(filePath, desc, errorMessage)) {
+			FatalError(errorMessage);
+		}
+	}
 
 	// Get the basic strings
-	sceneName = data["sceneName"];
-	sceneDescription = data["sceneDescription"];
+	sceneName = std::move(desc.sceneName);
+	sceneDescription = std::move(desc.sceneDescription);
 	scenePath = filePath;
 	
 	// Create materials
-	for (auto& material : data["materials"]) {
+	for (const MaterialDescription& material : desc.materials) {
 		Material m;
-		m.SetRoughness(material["roughness"]);
-		m.SetAlbedo(Color(material["albedo"][0], material["albedo"][1], material["albedo"][2]));
-		m.SetEmissiveIntensity(material["emissiveIntensity"]);
+		m.SetRoughness(material.roughness);
+		m.SetAlbedo(Color(material.albedo.x, material.albedo.y, material.albedo.z));
+		m.SetEmissiveIntensity(material.emissiveIntensity);
 		
-		sceneMaterials[material["name"]] = m;
+		addMaterial(material.name, m);
 	}
 
 	// Create meshes
-	// scan through all of the meshes listed in the "meshes" array and throw error if cannot be found
-	for (string mesh : data["meshes"]) {
-		// check if the mesh file exists
-		ifstream f(mesh);
-		if (!f.good()) {
-			string errorMessage = "Mesh file '" + mesh + "' does not exist!";
-			MessageBoxA(NULL, errorMessage.c_str(), "Fatal error", MB_ICONERROR | MB_OK);
-			exit(0);
+	// Every mesh listed in the "meshes" array is imported on its own thread with its own importer, into
+	// its own slot so they go into the scene in file order whatever order they finish in.
+	// A mesh listed twice is imported once, two threads would otherwise write the same mesh cache.
+	vector<string> meshPaths;
+	set<string> listedMeshes;
+	for (const string& mesh : desc.meshes) {
+		if (listedMeshes.insert(mesh).second) {
+			meshPaths.push_back(mesh);
 		}
+	}
 
-		// use AssImp to import mesh
-		
-		Assimp::Importer importer;
-		
-		const aiScene* scene = importer.ReadFile(mesh, aiProcess_Triangulate | aiProcess_ConvertToLeftHanded);
+	int meshCount = (int)meshPaths.size();
+	vector<Mesh> meshes(meshCount);
+	vector<string> meshErrors(meshCount);
+	vector<uint64_t> fileHashes(meshCount, 0);
+
+	// The load threads are shared out between the meshes, a scene with one big OBJ file parses it on
+	// all of them
+	int loadThreads = ResolveThreadCount(KS_LOAD_THREADS);
+	int threadsPerMesh = max(1, (loadThreads + meshCount - 1) / max(meshCount, 1));
 
-		// check if the mesh file is valid
-		if (!scene) {
-			string errorMessage = "Mesh file '" + mesh + "' is invalid (AssImp error)!";
-			MessageBoxA(NULL, errorMessage.c_str(), "Fatal error", MB_ICONERROR | MB_OK);
-			exit(0);
+	ParallelFor(meshCount, 1, loadThreads, [&](int chunkStart, int chunkEnd, int) {
+		for (int m = chunkStart; m < chunkEnd; m++) {
+			meshErrors[m] = ImportMesh(meshPaths[m], meshes[m], threadsPerMesh, fileHashes[m]);
 		}
+	});
 
-		// get the first mesh in the scene
-		aiMesh* aiMesh = scene->mMeshes[0];
-		
-		// create a vector to store the vertices
-		vector<Vector3> verts;
-		// create a vector to store the faces (indices)
-		vector<Vector3> faces;
-
-		// scan through all of the vertices in the mesh
-		for (int i = 0; i < aiMesh->mNumVertices; i++) {
-			// get the vertex position
-			aiVector3D aiPos = aiMesh->mVertices[i];
-			// convert the vertex position to a Vector3
-			Vector3 pos = Vector3(aiPos.x, aiPos.y, aiPos.z);
-			// add the vertex position to the vector of vertices
-			verts.push_back(pos);
+	// Report the first broken mesh in file order, not whichever thread got there first
+	for (int m = 0; m < meshCount; m++) {
+		if (!meshErrors[m].empty()) {
+			FatalError(meshErrors[m]);
 		}
 
-		// scan through all of the faces in the mesh
-		for (int i = 0; i < aiMesh->mNumFaces; i++) {
-			// get the face
-			aiFace aiFace = aiMesh->mFaces[i];
-			
-			// get each index from the face and write to a Vector3
-			Vector3 face = Vector3(aiFace.mIndices[0], aiFace.mIndices[1], aiFace.mIndices[2]);
+		//Add mesh to the list of meshes in the scene
+		sceneMeshes[meshPaths[m]] = std::move(meshes[m]);
 
-			// add the face to the vector of faces
-			faces.push_back(face);
+		// Kept for the bake key, so the mesh files are only read once per load
+		if (fileHashes[m] != 0) {
+			meshFileHashes[meshPaths[m]] = fileHashes[m];
 		}
+	}
 
-		//Add mesh to the list of meshes in the scene
-		sceneMeshes[mesh] = Mesh{ verts, faces };
-		
+	// Create scene objects, once every mesh is in. The names are checked here so a scene with a typo
+	// fails the same way as before, the objects (each copies its mesh) are then built in parallel.
+	for (const ObjectDescription& object : desc.objects) {
+		if (sceneMeshes.find(object.mesh) == sceneMeshes.end() || sceneMaterials.find(object.material) == sceneMaterials.end()) {
+			errorMessage = "Object uses mesh '" + object.mesh + "' or material '" + object.material + "' which the scene does not have!";
+			FatalError(errorMessage);
+		}
 	}
 
-	// Create scene objects
-	for (auto& object : data["objects"]) {
-		SceneObject o;
-		o.SetMesh(sceneMeshes[object["mesh"]]);
-		o.SetMaterial(sceneMaterials[object["material"]]);
-		o.SetPosition(Vector3(object["position"][0], object["position"][1], object["position"][2]));
-		o.SetRotation(Vector3(object["rotation"][0], object["rotation"][1], object["rotation"][2]));
-		o.SetScale(Vector3(object["scale"][0], object["scale"][1], object["scale"][2]));
+	{
+		KS_PROFILE_ZONE("CreateObjects");
 
-		sceneObjects.push_back(o);
-	}
+		int objectCount = (int)desc.objects.size();
+		vector<SceneObject> objects(objectCount);
 
-	// count globalpolycount
-	for (SceneObject& obj : sceneObjects) {
-		globalPolyCount += (obj.GetMesh()).GetFaceCount();
+		ParallelFor(objectCount, 1, KS_LOAD_THREADS, [&](int chunkStart, int chunkEnd, int) {
+			for (int o = chunkStart; o < chunkEnd; o++) {
+				const ObjectDescription& object = desc.objects[o];
+				objects[o] = createObject(object.mesh, object.material, object.position, object.rotation, object.scale);
+			}
+		});
+
+		sceneObjects.reserve(sceneObjects.size() + objectCount);
+		for (int o = 0; o < objectCount; o++) {
+			sceneObjects.push_back(std::move(objects[o]));
+			objectMeshNames.push_back(std::move(desc.objects[o].mesh));
+			objectNames.push_back(std::move(desc.objects[o].name));
+		}
 	}
 
 	// Setup the camera
-	Vector3 camPos = Vector3(data["camera"]["position"][0], data["camera"]["position"][1], data["camera"]["position"][2]);
-	Vector3 camRot = Vector3(data["camera"]["rotation"][0], data["camera"]["rotation"][1], data["camera"]["rotation"][2]);
-	float camFocalLength = data["camera"]["focalLength"];
-
-	cam.Apos = camPos;
-	cam.Bpos = camPos + Vector3( 1, 1, 0);
-	cam.Cpos = camPos + Vector3(-1, 1, 0);
-	
-	cam.focalLength = camFocalLength;
-	cam.focalPoint = camPos + Vector3(0, 0, -camFocalLength);
-	cam.lookAt =     camPos + Vector3(0, 0,  camFocalLength);
-
-	rotateCamera(camRot);
+	setCamera(desc.camera.position, desc.camera.rotation, desc.camera.focalLength);
 
 	// Set the scene size
-	if (data["sceneSize"] == "small") {
+	if (desc.sceneSize == "small") {
 		size = KS_SCENESIZE_SMALL;
 	}
-	else if (data["sceneSize"] == "medium") {
+	else if (desc.sceneSize == "medium") {
 		size = KS_SCENESIZE_MEDIUM;
 	}
-	else if (data["sceneSize"] == "large") {
+	else if (desc.sceneSize == "large") {
 		size = KS_SCENESIZE_LARGE;
 	}
 	else {
 		size = KS_SCENESIZE_MEDIUM;
 	}
 
-	recomputeObjBVH();
+	// count globalpolycount, build the lookup tables and the world space geometry used by the lighting
+	// code
+	finishScene();
 };
 
 SceneInformation::~SceneInformation() {
 
 }
 
-std::pair<int, int> SceneInformation::getObjectTrisRange(int objIdx) {
-	int start = 0;
-	int end = 0;
+void SceneInformation::rebuildGlobalIndex() {
+	objTriOffsets.resize(sceneObjects.size() + 1);
+	objTriOffsets[0] = 0;
 
-	if (objIdx == 0) {
-		start = 0;
-		end = sceneObjects[0].GetMesh().GetFaceCount();
+	for (int i = 0; i < (int)sceneObjects.size(); i++) {
+		objTriOffsets[i + 1] = objTriOffsets[i] + sceneObjects[i].GetFaceCount();
 	}
-	else {
-		for (int i = 0; i < objIdx; i++) {
-			start += sceneObjects[i].GetMesh().GetFaceCount();
+
+	globalPolyCount = objTriOffsets.back();
+
+	// fill the reverse table, every triangle just stores the object it came from
+	triObjIndex.resize(globalPolyCount);
+	for (int i = 0; i < (int)sceneObjects.size(); i++) {
+		std::fill(triObjIndex.begin() + objTriOffsets[i], triObjIndex.begin() + objTriOffsets[i + 1], i);
+	}
+}
+
+std::pair<int, int> SceneInformation::getObjectTrisRange(int objIdx) const {
+	return std::make_pair(objTriOffsets[objIdx], objTriOffsets[objIdx + 1]);
+}
+
+GlobalTriRange SceneInformation::getObjectTris(int objIdx) const {
+	return GlobalTriRange{ objTriOffsets[objIdx], objTriOffsets[objIdx + 1] };
+}
+
+void CompiledSceneGeometry::getTri(DXVector3 verts[3], int idx) const {
+	for (int k = 0; k < 3; k++) {
+		verts[k] = Vector3(cornerX[k][idx], cornerY[k][idx], cornerZ[k][idx]);
+	}
+}
+
+int SceneInformation::compileScene() {
+	KS_PROFILE_ZONE("CompileScene");
+
+	int objCount = (int)sceneObjects.size();
+
+	// If the triangle or vertex layout changed (new objects, new meshes) everything has to be rebuilt,
+	// otherwise we only need to re-transform the objects that moved.
+	bool fullRebuild = (int)compiled.objVertexOffsets.size() != objCount + 1
+		|| (int)objTriOffsets.size() != objCount + 1;
+
+	for (int i = 0; i < objCount && !fullRebuild; i++) {
+		const Mesh& mesh = sceneObjects[i].GetMesh();
+
+		fullRebuild = objTriOffsets[i + 1] - objTriOffsets[i] != mesh.GetFaceCount()
+			|| compiled.objVertexOffsets[i + 1] - compiled.objVertexOffsets[i] != mesh.GetVertexCount();
+	}
+
+	if (fullRebuild) {
+		rebuildGlobalIndex();
+
+		compiled.objVertexOffsets.resize(objCount + 1);
+		compiled.objVertexOffsets[0] = 0;
+		for (int i = 0; i < objCount; i++) {
+			compiled.objVertexOffsets[i + 1] = compiled.objVertexOffsets[i] + sceneObjects[i].GetMesh().GetVertexCount();
+		}
+
+		compiled.worldVertices.resize(compiled.objVertexOffsets.back());
+
+		for (int k = 0; k < 3; k++) {
+			compiled.cornerX[k].resize(globalPolyCount);
+			compiled.cornerY[k].resize(globalPolyCount);
+			compiled.cornerZ[k].resize(globalPolyCount);
 		}
-		end = start + sceneObjects[objIdx].GetMesh().GetFaceCount();
+
+		compiled.normals.resize(globalPolyCount);
+		compiled.centroids.resize(globalPolyCount);
+		compiled.planes.resize(globalPolyCount);
+		compiled.areas.resize(globalPolyCount);
+		compiled.objectIds = triObjIndex;
+		compiled.materialIds.resize(globalPolyCount);
+	}
+
+	// Materials are cheap so the table is always rebuilt. Scene materials go first in map order so the
+	// ids given to objects when loading line up, objects without a valid id get their own entry.
+	compiled.materials.clear();
+	for (auto& material : sceneMaterials) {
+		compiled.materials.push_back(material.second);
 	}
 
-	return std::make_pair(start, end);
+	for (int i = 0; i < objCount; i++) {
+		int materialId = sceneObjects[i].GetMaterialId();
+
+		if (materialId < 0 || materialId >= (int)sceneMaterials.size()) {
+			materialId = (int)compiled.materials.size();
+			compiled.materials.push_back(sceneObjects[i].GetMaterial());
+		}
+
+		fill(compiled.materialIds.begin() + objTriOffsets[i], compiled.materialIds.begin() + objTriOffsets[i + 1], materialId);
+	}
+
+	int recompiled = 0;
+	for (int i = 0; i < objCount; i++) {
+		if (!fullRebuild && !sceneObjects[i].IsTransformDirty()) {
+			continue;
+		}
+
+		compileObject(i);
+		recompiled++;
+	}
+
+	return recompiled;
+}
+
+void SceneInformation::compileObject(int objIdx) {
+	SceneObject& obj = sceneObjects[objIdx];
+	const Mesh& mesh = obj.GetMesh();
+
+	XMFLOAT3* objVerts = compiled.worldVertices.data() + compiled.objVertexOffsets[objIdx];
+
+	// Transform the whole mesh in one go instead of per vertex per lookup
+	XMVector3TransformStream(objVerts, sizeof(XMFLOAT3),
+		mesh.m_vertices.data(), sizeof(Vector3),
+		mesh.GetVertexCount(), obj.GetWorldMatrix());
+
+	int firstTri = objTriOffsets[objIdx];
+	int faceCount = mesh.GetFaceCount();
+
+	for (int f = 0; f < faceCount; f++) {
+		int tri = firstTri + f;
+
+		MeshFace face = mesh.GetIndex(f);
+		Vector3 v[3] = {
+			objVerts[face[0]],
+			objVerts[face[1]],
+			objVerts[face[2]]
+		};
+
+		for (int k = 0; k < 3; k++) {
+			compiled.cornerX[k][tri] = v[k].x;
+			compiled.cornerY[k][tri] = v[k].y;
+			compiled.cornerZ[k][tri] = v[k].z;
+		}
+
+		Vector3 edgeCross = XMVector3Cross(v[1] - v[0], v[2] - v[0]);
+
+		compiled.normals[tri] = Vector3(XMVector3Normalize(edgeCross));
+		compiled.centroids[tri] = (v[0] + v[1] + v[2]) / 3.0f;
+		XMStoreFloat4(&compiled.planes[tri], XMPlaneFromPoints(v[0], v[1], v[2]));
+		compiled.areas[tri] = 0.5f * edgeCross.Length();
+	}
+
+	// the object BV depends on the transform too
+	obj.computeBVH();
+	obj.ClearTransformDirty();
+}
+
+const CompiledSceneGeometry& SceneInformation::getCompiledGeometry() const {
+	return compiled;
+}
+
+MemoryUsage SceneInformation::getMemoryUsageTree() const {
+	MemoryUsage usage("scene", StringBytes(sceneName) + StringBytes(sceneDescription) + StringBytes(scenePath));
+
+	size_t meshBytes = MapNodeBytes(sceneMeshes);
+	for (auto& mesh : sceneMeshes) {
+		meshBytes += StringBytes(mesh.first) + mesh.second.GetMemoryUsage();
+	}
+
+	size_t materialBytes = MapNodeBytes(sceneMaterials);
+	for (auto& material : sceneMaterials) {
+		materialBytes += StringBytes(material.first);
+	}
+
+	usage.Add("meshes", meshBytes);
+	usage.Add("materials", materialBytes);
+
+	MemoryUsage& objects = usage.Add("sceneObjects", VectorBytes(sceneObjects));
+
+	size_t objectMeshBytes = 0;
+	for (const SceneObject& obj : sceneObjects) {
+		objectMeshBytes += obj.GetMesh().GetMemoryUsage();
+	}
+
+	objects.Add("meshCopies", objectMeshBytes);
+
+	usage.Add("globalIndex", VectorBytes(objTriOffsets) + VectorBytes(triObjIndex));
+
+	size_t corners = 0;
+	for (int k = 0; k < 3; k++) {
+		corners += VectorBytes(compiled.cornerX[k]) + VectorBytes(compiled.cornerY[k]) + VectorBytes(compiled.cornerZ[k]);
+	}
+
+	MemoryUsage& geometry = usage.Add("compiledGeometry");
+	geometry.Add("worldVertices", VectorBytes(compiled.worldVertices) + VectorBytes(compiled.objVertexOffsets));
+	geometry.Add("corners", corners);
+	geometry.Add("triangleAttributes", VectorBytes(compiled.normals) + VectorBytes(compiled.centroids) +
+		VectorBytes(compiled.planes) + VectorBytes(compiled.areas) + VectorBytes(compiled.objectIds) +
+		VectorBytes(compiled.materialIds));
+	geometry.Add("materials", VectorBytes(compiled.materials));
+
+	return usage;
 }
 
 void SceneInformation::recomputeObjBVH() {
@@ -194,95 +469,218 @@ SceneSize SceneInformation::getSceneSize() {
 	return size;
 }
 
-int SceneInformation::getGlobalPolyCount() {
+int SceneInformation::getGlobalPolyCount() const {
 	return globalPolyCount;
 }
 
-void SceneInformation::getTribyGlobalIndexFast(DXVector3 verts[3], int idx) {
-	int currentSO = 0;
-	int accTriCount = 0;
-	int nextFaceAmount = 0;
+void SceneInformation::getTribyGlobalIndexFast(DXVector3 verts[3], int idx) const {
+	if (idx < 0 || idx >= globalPolyCount) {
+		//throw std::out_of_range("Triangle index out of range");
+		return;
+	}
 
-	for (SceneObject& obj : sceneObjects) {
-		nextFaceAmount = obj.GetFaceCount();
+	const SceneObject& obj = sceneObjects[triObjIndex[idx]];
+
+	// get the face at position idx - start of the object
+	MeshFace face = obj.GetMeshIndex(idx - objTriOffsets[triObjIndex[idx]]);
 
-		// if the index is less than the accumulated tri count then we are in range
-		if (idx < accTriCount + nextFaceAmount) {
-			// get the face index vector at position idx - accTriCount
-			Vector3 faceIdxVec = obj.GetMeshIndex(idx - accTriCount);
+	verts[0] = obj.GetFinalVtx(face[0]);
+	verts[1] = obj.GetFinalVtx(face[1]);
+	verts[2] = obj.GetFinalVtx(face[2]);
+}
 
-			// using each element in the index vector construct tuple from GetFinalVtx()
-			verts[0] = obj.GetFinalVtx((int)faceIdxVec.x);
-			verts[1] = obj.GetFinalVtx((int)faceIdxVec.y);
-			verts[2] = obj.GetFinalVtx((int)faceIdxVec.z);
+tuple<Vector3, Vector3, Vector3> SceneInformation::getTribyGlobalIndex(int idx) const {
+	if (idx < 0 || idx >= globalPolyCount) {
+		// this should never happen, but return 0 vectors so it doesn't crash
+		return make_tuple(Vector3(0, 0, 0), Vector3(0, 0, 0), Vector3(0, 0, 0));
+	}
 
-			return;
-		}
+	Vector3 verts[3];
+	getTribyGlobalIndexFast(verts, idx);
 
-		// otherwise we need to move on to the next object
-		currentSO++;
-		accTriCount += nextFaceAmount;
+	return make_tuple(verts[0], verts[1], verts[2]);
+}
+
+int SceneInformation::getObjIndexbyGlobalIndex(int idx) const {
+	if (idx < 0 || idx >= globalPolyCount) {
+		throw std::out_of_range("Triangle index out of range");
 	}
-	//throw std::out_of_range("Triangle index out of range");
-	return;
+
+	return triObjIndex[idx];
 }
 
-tuple<Vector3, Vector3, Vector3> SceneInformation::getTribyGlobalIndex(int idx) {
-	int currentSO = 0;
-	int accTriCount = 0;
-	int nextFaceAmount;
-	Mesh objMesh;
-	
-	for (SceneObject& obj : sceneObjects) {
-		objMesh = obj.GetMesh();
+void SceneInformation::setSceneName(const string& newName) {
+	sceneName = newName;
+}
 
-		nextFaceAmount = objMesh.GetFaceCount();
+void SceneInformation::setSceneDescription(const string& newDescription) {
+	sceneDescription = newDescription;
+}
+
+void SceneInformation::setSceneSize(SceneSize newSize) {
+	size = newSize;
+}
 
-		// if the index is less than the accumulated tri count then we are in range
-		if (idx < accTriCount + nextFaceAmount) {
-			// get the face index vector at position idx - accTriCount
-			Vector3 faceIdxVec = objMesh.GetIndex(idx - accTriCount);
+void SceneInformation::addMesh(const string& name, const Mesh& mesh) {
+	sceneMeshes[name] = mesh;
+	meshFileHashes.erase(name);
+}
+
+void SceneInformation::addMaterial(const string& name, const Material& material) {
+	map<string, Material>::iterator existing = sceneMaterials.find(name);
+
+	if (existing != sceneMaterials.end()) {
+		existing->second = material;
+
+		int materialId = (int)distance(sceneMaterials.begin(), existing);
+		for (SceneObject& obj : sceneObjects) {
+			if (obj.GetMaterialId() == materialId) {
+				obj.SetMaterial(existing->second);
+				obj.SetMaterialId(materialId);
+			}
+		}
+		return;
+	}
 
-			// using each element in the index vector construct tuple from GetFinalVtx()
-			return make_tuple(
-				obj.GetFinalVtx((int)faceIdxVec.x), // explicit cast to get rid of warning
-				obj.GetFinalVtx((int)faceIdxVec.y),
-				obj.GetFinalVtx((int)faceIdxVec.z)
-			);
+	// Material ids are positions in the map, everything sorted after the new name moves up by one
+	int materialId = (int)distance(sceneMaterials.begin(), sceneMaterials.emplace(name, material).first);
 
+	for (SceneObject& obj : sceneObjects) {
+		if (obj.GetMaterialId() >= materialId) {
+			obj.SetMaterialId(obj.GetMaterialId() + 1);
 		}
+	}
+}
+
+int SceneInformation::addObject(const string& meshName, const string& materialName, DXVector3 position,
+	DXVector3 rotation, DXVector3 scale) {
+
+	sceneObjects.push_back(createObject(meshName, materialName, position, rotation, scale));
+	objectMeshNames.push_back(meshName);
+	objectNames.push_back(string());
 
-		// otherwise we need to move on to the next object
-		currentSO++;
-		accTriCount += nextFaceAmount;
+	return (int)sceneObjects.size() - 1;
+}
+
+SceneObject SceneInformation::createObject(const string& meshName, const string& materialName, DXVector3 position,
+	DXVector3 rotation, DXVector3 scale) const {
+
+	map<string, Mesh>::const_iterator mesh = sceneMeshes.find(meshName);
+	map<string, Material>::const_iterator material = sceneMaterials.find(materialName);
+
+	if (mesh == sceneMeshes.end()) {
+		throw std::out_of_range("Unknown mesh '" + meshName + "'");
+	}
+	if (material == sceneMaterials.end()) {
+		throw std::out_of_range("Unknown material '" + materialName + "'");
 	}
-	//throw std::out_of_range("Triangle index out of range");
 
-	// this should never happen, but return 0 vectors so it doesn't crash
-	return make_tuple(Vector3(0, 0, 0), Vector3(0, 0, 0), Vector3(0, 0, 0));
+	SceneObject o;
+	o.SetMesh(mesh->second);
+	o.SetMaterial(material->second);
+	o.SetMaterialId((int)distance(sceneMaterials.begin(), material));
+	o.SetPosition(position);
+	o.SetRotation(rotation);
+	o.SetScale(scale);
+
+	return o;
 }
 
-int SceneInformation::getObjIndexbyGlobalIndex(int idx) {
-	int currentSO = 0;
-	int accTriCount = 0;
-	int nextFaceAmount;
-	Mesh objMesh;
+void SceneInformation::clearScene() {
+	sceneMeshes.clear();
+	meshFileHashes.clear();
+	sceneMaterials.clear();
+	sceneObjects.clear();
+	objectMeshNames.clear();
+	objectNames.clear();
 
-	for (SceneObject& obj : sceneObjects) {
-		objMesh = obj.GetMesh();
+	sceneName.clear();
+	sceneDescription.clear();
+	scenePath.clear();
 
-		nextFaceAmount = objMesh.GetFaceCount();
+	compiled = CompiledSceneGeometry();
+	rebuildGlobalIndex();
+}
 
-		// if the index is less than the accumulated tri count then we are in range
-		if (idx < accTriCount + nextFaceAmount) {
-			return currentSO;
-		}
+SceneDescription SceneInformation::describeScene() const {
+	SceneDescription desc;
+
+	desc.sceneName = sceneName;
+	desc.sceneDescription = sceneDescription;
+
+	switch (size) {
+	case KS_SCENESIZE_SMALL:
+		desc.sceneSize = "small";
+		break;
+	case KS_SCENESIZE_LARGE:
+		desc.sceneSize = "large";
+		break;
+	default:
+		desc.sceneSize = "medium";
+		break;
+	}
+
+	desc.meshes = getMeshNames();
 
-		// otherwise we need to move on to the next object
-		currentSO++;
-		accTriCount += nextFaceAmount;
+	// Material ids of the objects are positions in the material map
+	vector<string> materialNames;
+	for (const auto& material : sceneMaterials) {
+		desc.materials.push_back(DescribeMaterial(material.first, material.second));
+		materialNames.push_back(material.first);
+	}
+
+	desc.objects.resize(sceneObjects.size());
+	for (int i = 0; i < (int)sceneObjects.size(); i++) {
+		const SceneObject& obj = sceneObjects[i];
+		ObjectDescription& o = desc.objects[i];
+
+		int materialId = obj.GetMaterialId();
+
+		o.name = objectNames[i];
+		o.mesh = objectMeshNames[i];
+		if (materialId >= 0 && materialId < (int)materialNames.size()) {
+			o.material = materialNames[materialId];
+		}
+		else {
+			// Objects given their own material with SetMaterial get a material entry of their own
+			o.material = "object" + to_string(i);
+			while (sceneMaterials.count(o.material) != 0) {
+				o.material += "_";
+			}
+			desc.materials.push_back(DescribeMaterial(o.material, obj.GetMaterial()));
+		}
+		o.position = obj.GetPosition();
+		o.rotation = obj.GetRotation();
+		o.scale = obj.GetScale();
 	}
-	throw std::out_of_range("Triangle index out of range");
+
+	desc.camera.position = cam.Apos;
+	desc.camera.rotation = cam.rotation;
+	desc.camera.focalLength = cam.focalLength;
+
+	return desc;
+}
+
+bool SceneInformation::saveScene(const string& path, DocumentFormat format, string& error) const {
+	return WriteSceneDescription(path, describeScene(), format, error);
+}
+
+void SceneInformation::finishScene() {
+	rebuildGlobalIndex();
+	recomputeObjBVH();
+	compileScene();
+}
+
+void SceneInformation::setCamera(DXVector3 position, DXVector3 rotation, float focalLength) {
+	cam.Apos = position;
+	cam.Bpos = position + Vector3( 1, 1, 0);
+	cam.Cpos = position + Vector3(-1, 1, 0);
+	
+	cam.focalLength = focalLength;
+	cam.focalPoint = position + Vector3(0, 0, -focalLength);
+	cam.lookAt =     position + Vector3(0, 0,  focalLength);
+
+	rotateCamera(rotation);
 }
 
 void SceneInformation::setCameraPos(DXVector3 newPos) {
@@ -302,6 +700,7 @@ void SceneInformation::setCameraPos(DXVector3 newPos) {
 void SceneInformation::rotateCamera(DXVector3 newRot) {
 	XMVECTOR rotQuat = XMQuaternionRotationRollPitchYawFromVector(newRot);
 	cam.prevRotQuat = rotQuat;
+	cam.rotation = newRot;
 	
 	// Construct new camera vectors based off of Apos
 	Vector3 newBpos = (Vector3) XMVector3Rotate(Vector3{  1, 1, 0 }, rotQuat) + cam.Apos;
@@ -377,6 +776,30 @@ map<string, Mesh> SceneInformation::getSceneMeshes()
 	return sceneMeshes;
 }
 
+vector<string> SceneInformation::getMeshNames() const
+{
+	vector<string> names;
+	names.reserve(sceneMeshes.size());
+
+	for (auto& mesh : sceneMeshes) {
+		names.push_back(mesh.first);
+	}
+
+	return names;
+}
+
+bool SceneInformation::getMeshFileHash(const string& name, uint64_t& hash) const
+{
+	map<string, uint64_t>::const_iterator found = meshFileHashes.find(name);
+
+	if (found == meshFileHashes.end()) {
+		return false;
+	}
+
+	hash = found->second;
+	return true;
+}
+
 map<string, Material> SceneInformation::getSceneMaterials()
 {
 	return sceneMaterials;
@@ -2,12 +2,16 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <tuple>
 
 #include "EngineConstants.h"
 
 #include "Mesh.h"
 #include "Material.h"
+#include "MemoryUsage.h"
 #include "SceneObject.h"
+#include "SceneDescription.h"
 
 using DXVector3 = DirectX::SimpleMath::Vector3;
 
@@ -43,6 +47,9 @@ struct Camera {
 	// we need to store this to be able to recreate a new focal point
 	DirectX::XMVECTOR prevRotQuat;
 
+	// Last rotation given to rotateCamera, saved with the scene
+	DXVector3 rotation;
+
 	// Store the view and projection matrices here
 	DirectX::XMMATRIX viewMatrix;  // Store the view matrix here
 	DirectX::XMMATRIX projectionMatrix;  // Store the projection matrix here
@@ -60,9 +67,72 @@ enum SceneSize
 	KS_SCENESIZE_LARGE
 };
 
+/*
+Contiguous span of global triangle indices that belong to one scene object. Iterating it yields the
+global indices in order, so a whole object can be walked with for (int tri : scene.getObjectTris(i)).
+*/
+struct GlobalTriRange {
+	class iterator {
+	public:
+		explicit iterator(int idx) : current(idx) {}
+
+		int operator*() const { return current; }
+		iterator& operator++() { ++current; return *this; }
+		bool operator!=(const iterator& other) const { return current != other.current; }
+		bool operator==(const iterator& other) const { return current == other.current; }
+
+	private:
+		int current;
+	};
+
+	// First global index in the range
+	int first;
+	// One past the last global index in the range
+	int last;
+
+	iterator begin() const { return iterator(first); }
+	iterator end() const { return iterator(last); }
+	int size() const { return last - first; }
+};
+
+/*
+World space copy of the scene geometry built by SceneInformation::compileScene(). Everything is laid
+out as flat arrays so the lighting code can stream through it instead of transforming vertices on every
+lookup. All per triangle arrays are indexed by global triangle index.
+*/
+struct CompiledSceneGeometry {
+	// World space vertices of every object back to back in object order, vertex v of object i is at
+	// worldVertices[objVertexOffsets[i] + v].
+	std::vector<DirectX::XMFLOAT3> worldVertices;
+	std::vector<int> objVertexOffsets;
+
+	// Triangle corners with one stream per component, cornerX[k][tri] is the x coordinate of
+	// corner k of triangle tri. This is what the visibility code reads.
+	std::vector<float> cornerX[3];
+	std::vector<float> cornerY[3];
+	std::vector<float> cornerZ[3];
+
+	// Per triangle attributes
+	std::vector<DirectX::XMFLOAT3> normals;
+	std::vector<DirectX::XMFLOAT3> centroids;
+	std::vector<DirectX::XMFLOAT4> planes;
+	std::vector<float> areas;
+	std::vector<int> objectIds;
+	std::vector<int> materialIds;
+
+	// Materials indexed by materialIds
+	std::vector<Material> materials;
+
+	int triCount() const { return (int)normals.size(); }
+
+	// Write the world space corners of triangle idx to verts
+	void getTri(DXVector3 verts[3], int idx) const;
+};
+
 /*
 Contains all of the information for a scene. Usually used as a transition from scene.json to runtime
-and vise versa. This will eventually be used to save compute light tree and visibility data to disk.
+and vise versa. The light tree and visibility data computed from it are saved to disk separately, see
+SceneLightingInformation::SaveBake.
 */
 class SceneInformation
 {
@@ -77,26 +147,73 @@ public:
 	std::string getScenePath();
 
 	std::map<std::string, Mesh> getSceneMeshes();
+
+	// Names of every mesh in the scene, for meshes loaded from a scene file these are their file paths
+	std::vector<std::string> getMeshNames() const;
+
+	// HashFile of the file mesh name was loaded from, taken when the scene was loaded. Returns false for
+	// meshes that were added with addMesh or whose file could not be read.
+	bool getMeshFileHash(const std::string& name, uint64_t& hash) const;
 	std::map<std::string, Material> getSceneMaterials();
 	
 	std::vector<SceneObject>& getSceneObjects();
 
-	int getGlobalPolyCount();
+	int getGlobalPolyCount() const;
 
 	SceneSize getSceneSize();
 
+	// All of the global index lookups below are constant time, they read the offset tables built by
+	// rebuildGlobalIndex() and never allocate, so they are safe to call from multiple threads.
+
 	// return triangle at global index idx
-	std::tuple<DXVector3, DXVector3, DXVector3> getTribyGlobalIndex(int idx);
+	std::tuple<DXVector3, DXVector3, DXVector3> getTribyGlobalIndex(int idx) const;
 
-	// Write triangle at global index idx to verts. This is much faster than getTribyGlobalIndex
-	// but does not return anything and you have to provide a c style array to write to.
-	void getTribyGlobalIndexFast(DXVector3 verts[3], int idx);
+	// Write triangle at global index idx to verts. Same as getTribyGlobalIndex but you have to
+	// provide a c style array to write to.
+	void getTribyGlobalIndexFast(DXVector3 verts[3], int idx) const;
 
 	// reverse of getTribyGlobalIndex, returns the index of the object that contains 
 	// the triangle at global index idx
-	int getObjIndexbyGlobalIndex(int idx);
+	int getObjIndexbyGlobalIndex(int idx) const;
+
+	// Rebuild the global triangle index tables. This is done when the scene is loaded, call it again
+	// if objects are added or removed or an object gets a different mesh.
+	void rebuildGlobalIndex();
+
+	// In memory scene building, for scenes that do not come from a scene file (generated scenes, tools,
+	// benchmarks). Add meshes and materials by name, then the objects using them, then call
+	// finishScene(). Nothing touches the disk, built scenes have no path so they are never cached.
+	void setSceneName(const std::string& newName);
+	void setSceneDescription(const std::string& newDescription);
+	void setSceneSize(SceneSize newSize);
+
+	// Add a mesh or material, an existing one with the same name is replaced. Replacing a material
+	// also updates the objects using it, replacing a mesh only affects objects added afterwards.
+	void addMesh(const std::string& name, const Mesh& mesh);
+	void addMaterial(const std::string& name, const Material& material);
+
+	// Add an object using a mesh and material that were added before and return its index. Throws
+	// std::out_of_range if either name is unknown.
+	int addObject(const std::string& meshName, const std::string& materialName, DXVector3 position,
+		DXVector3 rotation, DXVector3 scale);
+
+	// Remove every mesh, material and object and forget the scene path
+	void clearScene();
+
+	// The scene as a scene file would describe it: materials, mesh names, objects with the names of
+	// their mesh and material, the camera and the scene size. Mesh names are only file paths for meshes
+	// loaded from a scene file, a built scene describes meshes that are not on disk.
+	SceneDescription describeScene() const;
+
+	// Write describeScene() to path in format. Returns false with the reason in error if it could not
+	// be written.
+	bool saveScene(const std::string& path, DocumentFormat format, std::string& error) const;
+
+	// Build the global index, the object BVs and the compiled geometry once all objects are added
+	void finishScene();
 
 	// camera functions
+	void setCamera(DXVector3 position, DXVector3 rotation, float focalLength);
 	void setCameraPos(DXVector3 newPos);
 	void rotateCamera(DXVector3 rotation);
 
@@ -117,16 +234,40 @@ public:
 	// Recopmute BVs for scene objects
 	void recomputeObjBVH();
 
-	std::pair<int, int> getObjectTrisRange(int objIdx);
+	// [start, end) global triangle indices of object objIdx
+	std::pair<int, int> getObjectTrisRange(int objIdx) const;
+	GlobalTriRange getObjectTris(int objIdx) const;
+
+	// Bring the compiled geometry up to date. Only objects that were moved, rotated, scaled or given
+	// a new mesh since the last compile are re-transformed, unless the triangle layout changed in
+	// which case everything is. Returns the number of objects that were recompiled.
+	int compileScene();
+
+	const CompiledSceneGeometry& getCompiledGeometry() const;
+
+	// Bytes held by the mesh and material tables, the scene objects (each has its own copy of its mesh),
+	// the global index tables and the compiled geometry
+	MemoryUsage getMemoryUsageTree() const;
 
 private:
+	// The object addObject would add, without adding it. Throws std::out_of_range like addObject.
+	SceneObject createObject(const std::string& meshName, const std::string& materialName, DXVector3 position,
+		DXVector3 rotation, DXVector3 scale) const;
+
 	// Scene object arrays
 	std::map<std::string, Mesh> sceneMeshes;
 	std::map<std::string, Material> sceneMaterials;
+
+	// HashFile of the file of every mesh loaded from a scene file, see getMeshFileHash
+	std::map<std::string, uint64_t> meshFileHashes;
 	
 	// scene objects are the only ones not in a map because naming scene objects doesnt always make sence
 	// this one is named "player" this one is a glossy chair and is named "bob"
 	std::vector<SceneObject> sceneObjects;
+
+	// Mesh name and (optional) name of every scene object, in the same order, for describeScene
+	std::vector<std::string> objectMeshNames;
+	std::vector<std::string> objectNames;
 	
 	std::string sceneName;
 	std::string sceneDescription;
@@ -137,4 +278,16 @@ private:
 	SceneSize size;
 
 	int globalPolyCount;
+
+	// Prefix sum of the object face counts, objTriOffsets[i] is the global index of the first
+	// triangle of object i and the last element is globalPolyCount.
+	std::vector<int> objTriOffsets;
+
+	// Object index of every global triangle so reverse lookups dont have to search for it.
+	std::vector<int> triObjIndex;
+
+	CompiledSceneGeometry compiled;
+
+	// Transform object objIdx into the compiled buffers and recompute its triangle attributes
+	void compileObject(int objIdx);
 };
\ No newline at end of file
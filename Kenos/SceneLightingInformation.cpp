@@ -1,20 +1,88 @@
 #include "pch.h"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "ProfilingLib.h"
 #include "SceneLightingInformation.h"
+#include "ThreadingLib.h"
+#include "VisibilityKernels.h"
 
 using namespace std;
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
+// Values of the engine constants that change what a bake contains, part of every bake key
+#define KS_STRINGIZE(x) #x
+#define KS_STRINGIZE_VALUE(x) KS_STRINGIZE(x)
+
+namespace
+{
+	const char bakeConstants[] =
+		KS_STRINGIZE_VALUE(KS_BAKE_VERSION) " "
+		KS_STRINGIZE_VALUE(KS_MAX_RAY_BOUNCES) " "
+		KS_STRINGIZE_VALUE(KS_MIN_LIGHTNESS) " "
+		KS_STRINGIZE_VALUE(KS_MAX_SURFACE_LIGHTS) " "
+		KS_STRINGIZE_VALUE(KS_MAX_SHADOWS) " "
+		KS_STRINGIZE_VALUE(KS_MAX_SHADOW_OBJS) " "
+		KS_STRINGIZE_VALUE(KS_VISIBILITY_MODE);
+
+	// Scalars of a bake, the whole META section
+	struct BakeMeta {
+		int globalPolyCount;
+		int objectCount;
+		int maxBounces;
+		float minLightness;
+		int visibilityMode;
+
+		// LightPackingMode of the packed buffers, they are only loaded if it matches
+		int lightPackingMode;
+	};
+
+	// SurfaceLightmapDirectory without its light list, the lists are one flat array in the bake
+	struct BakedDirectory {
+		Color color;
+		XMFLOAT4X4 flattenMatrix;
+		XMFLOAT4X4 toPlaneLocalMatrix;
+		XMFLOAT4X4 toWorldMatrix;
+	};
+}
+
 SceneLightingInformation::SceneLightingInformation() :
+	scene(*new SceneInformation()),
 	globalPolyCount(0),
-	scene(*new SceneInformation())
+	threadCount(KS_BAKE_THREADS),
+	visibilityMode((VisibilityMode)KS_VISIBILITY_MODE),
+	maxBounces(KS_MAX_RAY_BOUNCES),
+	minLightness(KS_MIN_LIGHTNESS),
+	treeMaxBounces(KS_MAX_RAY_BOUNCES),
+	treeMinLightness(KS_MIN_LIGHTNESS),
+	lightTreeStats(),
+	lightTreeUpdateStats(),
+	lightPackingMode((LightPackingMode)KS_LIGHT_PACKING_MODE),
+	finalPackingMode((LightPackingMode)KS_LIGHT_PACKING_MODE),
+	lightPackingStats(),
+	fullUploadFraction(KS_FULL_UPLOAD_FRACTION)
 {
 	// initialize memebr vars so vs dont complain
 }
 
 SceneLightingInformation::SceneLightingInformation(SceneInformation& newScene) : 
 	scene(newScene),
-	globalPolyCount(0)
+	globalPolyCount(0),
+	threadCount(KS_BAKE_THREADS),
+	visibilityMode((VisibilityMode)KS_VISIBILITY_MODE),
+	maxBounces(KS_MAX_RAY_BOUNCES),
+	minLightness(KS_MIN_LIGHTNESS),
+	treeMaxBounces(KS_MAX_RAY_BOUNCES),
+	treeMinLightness(KS_MIN_LIGHTNESS),
+	lightTreeStats(),
+	lightTreeUpdateStats(),
+	lightPackingMode((LightPackingMode)KS_LIGHT_PACKING_MODE),
+	finalPackingMode((LightPackingMode)KS_LIGHT_PACKING_MODE),
+	lightPackingStats(),
+	fullUploadFraction(KS_FULL_UPLOAD_FRACTION)
 {
 	// initialize memebr vars so vs dont complain
 }
@@ -28,12 +96,7 @@ void SceneLightingInformation::SetScene(SceneInformation& newScene)
 	scene = newScene;
 
 	// recalculate the global poly count
-	vector<SceneObject> sceneObjects = scene.getSceneObjects();
-
-	// count globalpolycount
-	for (SceneObject& obj : sceneObjects) {
-		globalPolyCount += (obj.GetMesh()).GetFaceCount();
-	}
+	globalPolyCount = scene.getGlobalPolyCount();
 }
 
 void SceneLightingInformation::SetScreenRatio(float ratio)
@@ -41,370 +104,1619 @@ void SceneLightingInformation::SetScreenRatio(float ratio)
 	screenRatio = ratio;
 }
 
-void SceneLightingInformation::BuildLightTree() {
-	// for now we will use stdev = 10 * dist for the FRDF
+void SceneLightingInformation::SetThreadCount(int count)
+{
+	threadCount = count;
+}
 
-	// loop through every triangle and create a lightmap directory for it
-	for (int i = 0; i < globalPolyCount; i++) {
-		// get the object that this poly belongs to
-		int objIdx = scene.getObjIndexbyGlobalIndex(i);
+int SceneLightingInformation::GetThreadCount() const
+{
+	return threadCount;
+}
+
+void SceneLightingInformation::SetVisibilityMode(VisibilityMode mode)
+{
+	visibilityMode = mode;
+}
+
+VisibilityMode SceneLightingInformation::GetVisibilityMode() const
+{
+	return visibilityMode;
+}
+
+void SceneLightingInformation::SetMaxBounces(int bounces)
+{
+	maxBounces = max(bounces, 0);
+}
+
+int SceneLightingInformation::GetMaxBounces() const
+{
+	return maxBounces;
+}
+
+void SceneLightingInformation::SetMinLightness(float lightness)
+{
+	minLightness = lightness;
+}
+
+float SceneLightingInformation::GetMinLightness() const
+{
+	return minLightness;
+}
+
+void SceneLightingInformation::SetLightPackingMode(LightPackingMode mode)
+{
+	lightPackingMode = mode;
+}
 
-		// get the object
-		SceneObject obj = scene.getSceneObjects()[objIdx];
+LightPackingMode SceneLightingInformation::GetLightPackingMode() const
+{
+	return lightPackingMode;
+}
 
-		// get the material
-		Material mat = obj.GetMaterial();
+void SceneLightingInformation::SetFullUploadFraction(float fraction)
+{
+	fullUploadFraction = fraction;
+}
 
-		SurfaceLightmapDirectory dir = {};
-		dir.color = mat.GetAlbedo();
+float SceneLightingInformation::GetFullUploadFraction() const
+{
+	return fullUploadFraction;
+}
 
-		tuple<Vector3, Vector3, Vector3> verts = scene.getTribyGlobalIndex(i);
+const LightTreeStats& SceneLightingInformation::GetLightTreeStats() const
+{
+	return lightTreeStats;
+}
 
-		XMVECTOR surfPLane = XMPlaneFromPoints(get<0>(verts), get<1>(verts), get<2>(verts));
-		dir.flattenMatrix = OrthographicProjectionOntoPlane(surfPLane);
-		dir.toPlaneLocalMatrix = CreateTransformTo2D(surfPLane, get<0>(verts) - get<1>(verts));
-		dir.toWorldMatrix = CreateTransformTo3D(surfPLane, get<0>(verts) - get<1>(verts));
+const LightTreeUpdateStats& SceneLightingInformation::GetLightTreeUpdateStats() const
+{
+	return lightTreeUpdateStats;
+}
 
-		// For now empty
-		dir.surfLights = vector<int>();
+const LightPackingStats& SceneLightingInformation::GetLightPackingStats() const
+{
+	return lightPackingStats;
+}
 
-		lightmapDirectories.push_back(dir);
+float SceneLightingInformation::GetDroppedLightEnergy(int dirIdx) const
+{
+	if (dirIdx < 0 || dirIdx >= (int)finalDroppedEnergy.size()) {
+		throw std::out_of_range("Surface index out of range of the packed lightmap");
 	}
 
-	// Compute normals for each triangle
-	for (int i = 0; i < globalPolyCount; i++) {
-		tuple<Vector3, Vector3, Vector3> currTri = scene.getTribyGlobalIndex(i);
-		Vector3 triNormal = XMVector3Normalize(XMVector3Cross(get<1>(currTri) - get<0>(currTri), get<2>(currTri) - get<0>(currTri)));
-		allNormals.push_back(triNormal);
+	return finalDroppedEnergy[dirIdx];
+}
+
+void SceneLightingInformation::BuildLightTree() {
+	KS_PROFILE_ZONE("BuildLightTree");
+
+	// for now we will use stdev = 10 * dist for the FRDF
+
+	// Make sure the world space geometry is up to date, this only re-transforms objects that moved.
+	// Everything below reads the compiled buffers instead of transforming vertices per lookup.
+	scene.compileScene();
+	const CompiledSceneGeometry& geo = scene.getCompiledGeometry();
+	globalPolyCount = geo.triCount();
+
+	// start from scratch
+	lightmapDirectories.clear();
+	allNormals.clear();
+	emissivePolygons.clear();
+	lightTree.clear();
+	jumbleMap.Clear();
+	processQueue = queue<int>();
+
+	MarkAllSurfacesDirty();
+
+	// loop through every triangle and create a lightmap directory for it, surfLights start empty
+	{
+		KS_PROFILE_ZONE("DirectorySetup");
+
+		lightmapDirectories.resize(globalPolyCount);
+
+		for (int i = 0; i < globalPolyCount; i++) {
+			UpdateDirectory(i, geo);
+		}
+
+		RecordMemoryHighWater("DirectorySetup");
 	}
 
-	// This is just to see how many surfaces are visible on average
-	float avgVisSurfs = 0.0f;
+	// Normals for each triangle were already computed when the scene was compiled
+	allNormals.assign(geo.normals.begin(), geo.normals.end());
 
 	// Go through all of the directories and determine visibility structure
-	// r_* is reciever, c_* is caster. Iterate over every surface (caster) and determine if it scatters
-	// onto what surfaces (reciever)
-	for (int dirIdx = 0; dirIdx < globalPolyCount; dirIdx++) {
-		SurfaceLightmapDirectory currentDir = lightmapDirectories[dirIdx];
-
-		tuple<Vector3, Vector3, Vector3> c_tri = scene.getTribyGlobalIndex(dirIdx);
-		Vector3 c_triNormal = allNormals[dirIdx];
-		Vector3 c_triMean = (get<0>(c_tri) + get<1>(c_tri) + get<2>(c_tri)) / 3.0f;
-
-
-		// Use scene object BV to determine which objects are visible
-		// (https://www.desmos.com/geometry-beta/twesb3a3o8)
-		vector<int> visibleObjects = {};
-		for (int i = 0; i < scene.getSceneObjects().size(); i++) {
-			SceneObject obj = scene.getSceneObjects()[i];
-
-			// If both the min and max are behind the current surface, then the object is not visible
-			Vector3 objMin = get<0>(obj.getBVH());
-			Vector3 objMax = get<1>(obj.getBVH());
-
-			vector<Vector3> objCorners = { objMin,
-							Vector3(objMin.x, objMin.y, objMax.z),
-							Vector3(objMin.x, objMax.y, objMin.z),
-							Vector3(objMin.x, objMax.y, objMax.z),
-							Vector3(objMax.x, objMin.y, objMin.z),
-							Vector3(objMax.x, objMin.y, objMax.z),
-							Vector3(objMax.x, objMax.y, objMin.z),
-							objMax };
-
-			for (Vector3 corner : objCorners) {
-				if (c_triNormal.Dot(corner - c_triMean) < 0.0f) {
-					visibleObjects.push_back(i);
-					break;
-				}
+	BuildVisibility(geo);
+
+	treeMaxBounces = maxBounces;
+	treeMinLightness = minLightness;
+
+	lightTreeStats.created.assign(maxBounces + 1, 0);
+	lightTreeStats.pruned.assign(maxBounces + 1, 0);
+
+	// loop through all the triangles and figure out which ones are emissive (emissive strength > 0.1)
+	// and add them to the emissivePolygons vector
+	{
+		KS_PROFILE_ZONE("EmissiveDiscovery");
+
+		for (int i = 0; i < globalPolyCount; i++) {
+			// get the material of the sceneobject this poly belongs to
+			const Material& mat = geo.materials[geo.materialIds[i]];
+
+			if (mat.GetEmissiveIntensity() > 0.1f) {
+				emissivePolygons.push_back(i);
 			}
+		}
 
-			// Object is invisible
+		// Loop over every emissive polygon and create a RDF for it and put it in the light tree roots, the
+		// roots are queued as they are added
+		for (int i: emissivePolygons) {
+			AddLightSource(i, geo);
 		}
 
-		currentDir.visibleObjects = visibleObjects;
+		RecordMemoryHighWater("EmissiveDiscovery");
+	}
 
-		vector<int> visibleSurfaces = {};
-		Vector3 r_Normal;
-		// Reciever triangle
-		Vector3 r_tri[3];
+	// The main loop (this is where ray tracing happens)
+	PropagateQueue(geo);
+	RecordMemoryHighWater("Propagation");
 
-		// Assemble all the visible surfaces
-		for (int i : visibleObjects) {
-			int objRangeStart = scene.getObjectTrisRange(i).first;
-			int objRangeEnd = scene.getObjectTrisRange(i).second;
+	KS_PROFILE_COUNT("rdfsCreated", jumbleMap.Size());
+	KS_PROFILE_COUNT("bytesAllocated", jumbleMap.GetMemoryUsage());
+}
 
-			for (int j = objRangeStart; j < objRangeEnd; j++) {
-				// Do visibility check per triangle
-				scene.getTribyGlobalIndexFast(r_tri, j);
+void SceneLightingInformation::BuildSceneVisibility() {
+	KS_PROFILE_ZONE("BuildSceneVisibility");
 
-				// TODO: why does this particular line take so much cpu time? Im acessing a 
-				// c style array?? VS profiler says it takes up ~70% of the cpu time in this function???
-				r_Normal = allNormals[j]; 
+	scene.compileScene();
+	const CompiledSceneGeometry& geo = scene.getCompiledGeometry();
+	globalPolyCount = geo.triCount();
 
-				// We cant do regular backface culling because we are using an area light model
-				// just becasue the normal is facing away from the camera doesnt mean it isnt visible
-				// from another part of the surface. Loop over every vertex and see if it is visible
-				// from the current surface. If all of them are not then the surface is not visible
-				bool r_isVis[3];
-				for (int vertIdx = 0; vertIdx < 3; vertIdx++) {
-					Vector3 r_triVertex = r_tri[vertIdx];
+	// The old tree does not match the compiled scene anymore
+	lightmapDirectories.clear();
+	emissivePolygons.clear();
+	lightTree.clear();
+	jumbleMap.Clear();
+	processQueue = queue<int>();
 
-					r_isVis[vertIdx] = c_triNormal.Dot(r_triVertex - c_triMean) > 0.0f;
-				}
-				
-				// if all of the vertices are not visible hen the surface is not visible
-				if (r_isVis[0] && r_isVis[1] && r_isVis[2]) {
-					continue;
-				}
-				
+	MarkAllSurfacesDirty();
 
-				// If the triangle is behind the current surface, it is not visible
-				for (int vertIdx = 0; vertIdx < 3; vertIdx++) {
-					Vector3 r_triVertex = r_tri[vertIdx];
+	allNormals.assign(geo.normals.begin(), geo.normals.end());
 
-					// if the vertex is in front of the surface, then the surface is visible
-					if (c_triNormal.Dot(r_triVertex - c_triMean) < 0.0f) {
-						visibleSurfaces.push_back(j);
-						break;
-					}
-				}
+	BuildVisibility(geo);
+}
 
-				// Surface is invisible
-			}
-		}
+void SceneLightingInformation::UpdateDirectory(int dirIdx, const CompiledSceneGeometry& geo) {
+	// get the material of the object this poly belongs to
+	const Material& mat = geo.materials[geo.materialIds[dirIdx]];
 
-		currentDir.visibleSurfaces = visibleSurfaces;
-		lightmapDirectories[dirIdx] = currentDir;
+	SurfaceLightmapDirectory& dir = lightmapDirectories[dirIdx];
+	dir.color = mat.GetAlbedo();
 
-		avgVisSurfs += visibleSurfaces.size();
-	}
+	MarkSurfaceDirty(dirIdx);
 
-	// Avg number of surfaces visible from each surface
-	avgVisSurfs /= globalPolyCount;
+	Vector3 verts[3];
+	geo.getTri(verts, dirIdx);
 
-	// What % of surfaces are visible from each surface
-	avgVisSurfs /= globalPolyCount;
+	XMVECTOR surfPLane = XMLoadFloat4(&geo.planes[dirIdx]);
+	dir.flattenMatrix = OrthographicProjectionOntoPlane(surfPLane);
+	dir.toPlaneLocalMatrix = CreateTransformTo2D(surfPLane, verts[0] - verts[1]);
+	dir.toWorldMatrix = CreateTransformTo3D(surfPLane, verts[0] - verts[1]);
+}
 
-	// We are now 1/avgVisSurfs times faster than the naive approach (usually 10x faster)
+RDFHandle SceneLightingInformation::AddLightSource(int dirIdx, const CompiledSceneGeometry& geo) {
+	// get the material of the object this poly belongs to
+	const Material& mat = geo.materials[geo.materialIds[dirIdx]];
 
-	// loop through all the triangles and figure out which ones are emissive (emissive strength > 0.1)
-	// and add them to the emissivePolygons vector
-	for (int i = 0; i < globalPolyCount; i++) {
-		// Check what sceneobject this poly belongs to
-		int objIdx = scene.getObjIndexbyGlobalIndex(i);
+	// create a RDF for this emissive polygon
+	RDF rdf = {};
 
-		// get the object
-		SceneObject obj = scene.getSceneObjects()[objIdx];
+	// this is equivalent to the global index of the polygon
+	rdf.parentDirectoryIndex = dirIdx;
+	rdf.bounce = 0;
+	rdf.parentRDF = -1;
+	// children will be created later in the main loop
+	rdf.color = mat.GetAlbedo();
+	rdf.lightBrightness = mat.GetEmissiveIntensity();
+	// At the source lightness is equivalent to the initial brightness
+	rdf.lightness = mat.GetEmissiveIntensity();
+	// A Light source cannot shadow itself, the pool starts it with no shadows
 
-		// get the material
-		Material mat = obj.GetMaterial();
+	RDFHandle root = jumbleMap.Add(rdf);
 
-		if (mat.GetEmissiveIntensity() > 0.1f) {
-			emissivePolygons.push_back(i);
-		}
+	lightmapDirectories[dirIdx].surfLights.push_back(root);
+	lightTree.push_back(root);
+	MarkSurfaceDirty(dirIdx);
+
+	lightTreeStats.created[0]++;
+
+	if (IsExpandable(root)) {
+		processQueue.push(root);
 	}
 
-	// Loop over every emissive polygon and create a RDF for it and put it in the light tree roots
-	for (int i: emissivePolygons) {
-		// get the object that this poly belongs to
-		int objIdx = scene.getObjIndexbyGlobalIndex(i);
+	return root;
+}
+
+RDFHandle SceneLightingInformation::AddReceiverRDF(RDFHandle caster, int receiverIdx, const CompiledSceneGeometry& geo) {
+	// c_* for caster, r_* for receiver
+	int c_globalIdx = jumbleMap.GetParentDirectoryIndex(caster);
 
-		// get the object
-		SceneObject obj = scene.getSceneObjects()[objIdx];
+	// construct the reciever rdf
+	RDF r_RDF = {};
+	r_RDF.parentDirectoryIndex = receiverIdx;
+	r_RDF.bounce = jumbleMap.GetBounce(caster) + 1;
+	r_RDF.parentRDF = caster; // !! index into jumbleMap, not global index !!
+	// children are assigned when the parent is processed
+	// ignore colour for now for testing
+	r_RDF.lightBrightness = jumbleMap.GetLightBrightness(caster);
 
-		// get the material
-		Material mat = obj.GetMaterial();
+	// Whatever part of the caster light reaches the reciever and is scattered again
+	r_RDF.lightness = jumbleMap.GetLightness(caster) * ComputeTransfer(c_globalIdx, receiverIdx, geo);
 
-		// create a RDF for this emissive polygon
-		RDF rdf = {};
+	// for now just ignore shadows, it is computed naivly in the pixel shader.
+	// we use dot target culling so it should be fast enough for now
 
-		// this is equivalent to the global index of the polygon
-		rdf.parentDirectoryIndex = i;
-		rdf.bounce = 0;
-		rdf.parentRDF = -1;
-		// children will be created later in the main loop
-		rdf.color = mat.GetAlbedo();
-		rdf.lightBrightness = mat.GetEmissiveIntensity();
-		// At the source lightness is equivalent to the initial brightness
-		rdf.lightness = mat.GetEmissiveIntensity();
-		// A Light source cannot shadow itself, empty vector
-		rdf.shadows = vector<int>();
+	RDFHandle r_RDFidx = jumbleMap.Add(r_RDF);
 
-		SurfaceLightmapDirectory parentDir = lightmapDirectories[i];
+	lightmapDirectories[receiverIdx].surfLights.push_back(r_RDFidx);
+	MarkSurfaceDirty(receiverIdx);
 
-		parentDir.surfLights.push_back((int) jumbleMap.size());
-		lightTree.push_back((int) jumbleMap.size());
+	lightTreeStats.created[r_RDF.bounce]++;
 
-		lightmapDirectories[i] = parentDir;
-		jumbleMap.push_back(rdf);
+	// The RDF is still drawn, but if too little light is left it is not allowed to have children
+	// of its own. This is what keeps the tree from growing as N^bounces.
+	if (IsExpandable(r_RDFidx)) {
+		processQueue.push(r_RDFidx);
 	}
+	else if (r_RDF.bounce < maxBounces) {
+		lightTreeStats.pruned[r_RDF.bounce]++;
+	}
+
+	return r_RDFidx;
+}
+
+bool SceneLightingInformation::IsExpandable(RDFHandle rdf) const {
+	int bounce = jumbleMap.GetBounce(rdf);
 
-	// add all of the light tree roots to the process queue
-	for (int i : lightTree) {
-		processQueue.push(i);
+	if (bounce >= maxBounces) {
+		return false;
 	}
-	
+
+	// light sources always get children
+	return bounce == 0 || jumbleMap.GetLightness(rdf) >= minLightness;
+}
+
+void SceneLightingInformation::PropagateQueue(const CompiledSceneGeometry& geo) {
+	KS_PROFILE_ZONE("Propagation");
+
 	// every surface scatters onto every other surface times number of bounces
-	int maxIterations = globalPolyCount * globalPolyCount * KS_MAX_RAY_BOUNCES + 100;
-	int iter = 0;
+	long long maxIterations = (long long)globalPolyCount * globalPolyCount * maxBounces + 100;
+	long long iter = 0;
 
-	// so we dont have to keep calling this
-	int sceneObjectsSize = scene.getSceneObjects().size();
+	// Children of the RDF being processed, handed to the pool in one go once they are all created
+	vector<RDFHandle> c_children;
 
-	// The main loop (this is where ray tracing happens)
 	while (!processQueue.empty()) {
-		// c_* for caster, r_* for receiver, s_* for shadow
-
 		int c_RDFidx = processQueue.front();
 		processQueue.pop();
 
-		// get all the stuff
-		RDF c_RDF = jumbleMap[c_RDFidx];
-		int c_globalIdx = c_RDF.parentDirectoryIndex;
-		SurfaceLightmapDirectory c_Dir = lightmapDirectories[c_globalIdx];
+		int c_globalIdx = jumbleMap.GetParentDirectoryIndex(c_RDFidx);
 
-		Vector3 c_tri[3];
-		scene.getTribyGlobalIndexFast(c_tri, c_globalIdx);
-		Vector3 c_triMean = (c_tri[0] + c_tri[1] + c_tri[2]) / 3.0f;
-		Vector3 c_Normal = allNormals[c_globalIdx];
-		
-		vector<int> c_visibleSurfaces = c_Dir.visibleSurfaces;
+		c_children.clear();
 
-		Vector3 r_tri[3];
+		// Loop over every visible surface and ray trace
+		for (int r_childIdx : visibleSurfaces.GetRow(c_globalIdx)) {
+			c_children.push_back(AddReceiverRDF(c_RDFidx, r_childIdx, geo));
+		}
 
-		int c_bounce = c_RDF.bounce;
+		jumbleMap.SetChildren(c_RDFidx, c_children);
 
-		// Loop over every visible surface and ray trace
-		for (int r_childIdx : c_visibleSurfaces) {
-			SurfaceLightmapDirectory r_Dir = lightmapDirectories[r_childIdx];
-
-			scene.getTribyGlobalIndexFast(r_tri, r_childIdx);
-			Vector3 r_triMean = (r_tri[0] + r_tri[1] + r_tri[2]) / 3.0f;
-			Vector3 r_Normal = allNormals[r_childIdx];
-
-			// construct the reciever rdf
-			RDF r_RDF = {};
-			r_RDF.parentDirectoryIndex = r_childIdx;
-			r_RDF.bounce = c_bounce + 1;
-			r_RDF.parentRDF = c_RDFidx; // !! index into jumbleMap, not global index !!
-			// children are assigned when the parent is processed
-			// ignore colour for now for testing
-			r_RDF.lightBrightness = c_RDF.lightBrightness;
-			r_RDF.lightness = 1.0f; // going to have to compute lightness here
-			
-			// for now just ignore shadows, it is computed naivly in the pixel shader.
-			// we use dot target culling so it should be fast enough for now
-
-			// assuming that this surface passes lightness cull
-			jumbleMap.push_back(r_RDF);
-			int r_RDFidx = (int) jumbleMap.size() - 1;
-			c_RDF.children.push_back(r_RDFidx);
-
-			r_Dir.surfLights.push_back(r_RDFidx);
-			lightmapDirectories[r_childIdx] = r_Dir;
-		}
-		
-		// We will then spawn children processes for each of the visible surfaces
-		// (minus lightness exclusions) and add them to the process queue.
 		// The actual ray tracing happens when we flatten the lightmap
 		// (for now in UpdateFinalRDFBuffer)
 
 		iter++;
 		if (iter > maxIterations) {
 			// we have exceeded the maximum number of iterations oh no
+			processQueue = queue<int>();
 			break;
 		}
 	}
 }
 
-void SceneLightingInformation::UpdateLightTree(int idx) {
-	idx;
+void SceneLightingInformation::ReleaseSubtree(RDFHandle rdf, vector<int>& touchedDirectories) {
+	vector<RDFHandle> stack(1, rdf);
+
+	while (!stack.empty()) {
+		RDFHandle current = stack.back();
+		stack.pop_back();
+
+		if (!jumbleMap.IsAlive(current)) {
+			continue;
+		}
+
+		// Take it out of the stats the same way AddReceiverRDF put it in
+		int bounce = jumbleMap.GetBounce(current);
+		lightTreeStats.created[bounce]--;
+
+		if (!IsExpandable(current) && bounce < maxBounces) {
+			lightTreeStats.pruned[bounce]--;
+		}
+
+		touchedDirectories.push_back(jumbleMap.GetParentDirectoryIndex(current));
+
+		for (RDFHandle child : jumbleMap.GetChildren(current)) {
+			stack.push_back(child);
+		}
+
+		jumbleMap.Release(current);
+	}
 }
 
-void SceneLightingInformation::UpdateFinalRDFBuffer() {
-	finalDirectoryBuffer.clear();
+void SceneLightingInformation::CompactLightTree() {
+	vector<RDFHandle> remap;
+	jumbleMap.Compact(remap);
 
-	// for now just loop through all of the polygons and assembly the directory buffer with the
-	// albedo material colour for each object
+	// Released RDFs were already taken out of the light tree and the directories
+	for (RDFHandle& root : lightTree) {
+		root = remap[root];
+	}
 
-	for (int i = 0; i < globalPolyCount; i++) {
-		// get the object that this poly belongs to
-		int objIdx = scene.getObjIndexbyGlobalIndex(i);
+	for (SurfaceLightmapDirectory& dir : lightmapDirectories) {
+		for (int& rdf : dir.surfLights) {
+			rdf = remap[rdf];
+		}
+	}
+}
 
-		// get the object
-		SceneObject obj = scene.getSceneObjects()[objIdx];
+float SceneLightingInformation::ComputeTransfer(int casterIdx, int receiverIdx, const CompiledSceneGeometry& geo) const {
+	// Centroid to centroid form factor with the reciever treated as a disk so it stays below 1 for
+	// close surfaces, times the reflectance of the reciever. Fronts face away from the normals, same
+	// as the visibility test.
+	Vector3 toReceiver = Vector3(geo.centroids[receiverIdx]) - Vector3(geo.centroids[casterIdx]);
+	float distSq = toReceiver.LengthSquared();
 
-		// get the material
-		Material mat = obj.GetMaterial();
+	if (distSq <= 0.0f) {
+		return 0.0f;
+	}
 
-		// get the albedo colour
-		Color albedo = mat.GetAlbedo();
+	toReceiver /= sqrtf(distSq);
 
-		SurfaceLightmapDirectoryPacked dir;
-		dir.color = XMFLOAT3(albedo.x, albedo.y, albedo.z)/255.0f; // convert to 0-1 range
+	float cosCaster = -allNormals[casterIdx].Dot(toReceiver);
+	float cosReceiver = allNormals[receiverIdx].Dot(toReceiver);
 
-		dir.normal = XMFLOAT3(allNormals[i].x, allNormals[i].y, allNormals[i].z);
+	if (cosCaster <= 0.0f || cosReceiver <= 0.0f) {
+		return 0.0f;
+	}
 
-		dir.emmissiveStrength = mat.GetEmissiveIntensity();
+	float area = geo.areas[receiverIdx];
+	float formFactor = cosCaster * cosReceiver * area / (XM_PI * distSq + area);
 
-		dir.numLights = min((int)lightmapDirectories[i].surfLights.size(), KS_MAX_SURFACE_LIGHTS);
+	// albedo is 0-255
+	const Color& albedo = geo.materials[geo.materialIds[receiverIdx]].GetAlbedo();
+	float reflectance = (albedo.x + albedo.y + albedo.z) / (3.0f * 255.0f);
 
-		// store the flatten matrix, to 2d and back to 3d matrices
-		// The constant buffer matrices are transposed so this also should be transposed???
-		// cos hlsl
-		XMStoreFloat4x4(&dir.flattenMatrix, XMMatrixTranspose(lightmapDirectories[i].flattenMatrix));
-		XMStoreFloat4x4(&dir.toPlaneLocalMatrix, XMMatrixTranspose(lightmapDirectories[i].toPlaneLocalMatrix));
-		XMStoreFloat4x4(&dir.toWorldMatrix, XMMatrixTranspose(lightmapDirectories[i].toWorldMatrix));
+	return formFactor * reflectance;
+}
 
-		// Store vertices
-		Vector3 tri[3];
-		scene.getTribyGlobalIndexFast(tri, i);
-		dir.vertices[0] = XMFLOAT3(tri[0].x, tri[0].y, tri[0].z);
-		dir.vertices[1] = XMFLOAT3(tri[1].x, tri[1].y, tri[1].z);
-		dir.vertices[2] = XMFLOAT3(tri[2].x, tri[2].y, tri[2].z);
+void SceneLightingInformation::BuildVisibility(const CompiledSceneGeometry& geo) {
+	KS_PROFILE_ZONE("Visibility");
+
+	int threads = ResolveThreadCount(threadCount);
+
+	// Every caster only writes to its own rows so tiles of casters can be split between threads
+	// freely. Each thread collects a tile into its own scratch lists, encodes them into a small store
+	// of its own and then copies that into the shared stores under a lock. Rows dont depend on the
+	// order the tiles land in, the result is the same no matter the thread count.
+	if (visibilityMode == KS_VISMODE_BVH) {
+		VisReceiverStreams tris;
+		for (int k = 0; k < 3; k++) {
+			tris.x[k] = geo.cornerX[k].data();
+			tris.y[k] = geo.cornerY[k].data();
+			tris.z[k] = geo.cornerZ[k].data();
+		}
+
+		sceneBVH.Build(tris, globalPolyCount);
+	}
+	else {
+		sceneBVH.Clear();
+	}
+
+	int objectCount = (int)scene.getSceneObjects().size();
+
+	visibleObjects.Reset(globalPolyCount, objectCount);
+	visibleSurfaces.Reset(globalPolyCount, globalPolyCount);
+
+	vector<vector<vector<int>>> threadVisibleObjects(threads, vector<vector<int>>(KS_VIS_CASTER_TILE));
+	vector<vector<vector<int>>> threadVisibleSurfaces(threads, vector<vector<int>>(KS_VIS_CASTER_TILE));
+	vector<VisibilityStore> threadObjectStores(threads);
+	vector<VisibilityStore> threadSurfaceStores(threads);
+
+	mutex storeLock;
+
+	ParallelFor(globalPolyCount, KS_VIS_CASTER_TILE, threads, [&](int chunkStart, int chunkEnd, int threadIdx) {
+		KS_PROFILE_ZONE("VisibilityTile");
+
+		vector<vector<int>>& tileObjects = threadVisibleObjects[threadIdx];
+		vector<vector<int>>& tileSurfaces = threadVisibleSurfaces[threadIdx];
 
-		XMVECTOR plane = XMPlaneFromPoints(tri[0], tri[1], tri[2]);
-		XMStoreFloat4(&dir.plane, plane);
+		if (visibilityMode == KS_VISMODE_BVH) {
+			ComputeTileVisibilityBVH(chunkStart, chunkEnd, geo, tileObjects, tileSurfaces);
+		}
+		else {
+			ComputeTileVisibility(chunkStart, chunkEnd, geo, tileObjects, tileSurfaces);
+		}
+
+		VisibilityStore& objectStore = threadObjectStores[threadIdx];
+		VisibilityStore& surfaceStore = threadSurfaceStores[threadIdx];
+
+		objectStore.Reset(chunkEnd - chunkStart, objectCount);
+		surfaceStore.Reset(chunkEnd - chunkStart, globalPolyCount);
+
+		for (int c = 0; c < chunkEnd - chunkStart; c++) {
+			objectStore.SetRow(c, tileObjects[c]);
+			surfaceStore.SetRow(c, tileSurfaces[c]);
+		}
+
+		lock_guard<mutex> guard(storeLock);
+		visibleObjects.SetRows(chunkStart, objectStore);
+		visibleSurfaces.SetRows(chunkStart, surfaceStore);
+	});
+
+	// The per thread tiles and stores are at their largest now and the shared stores still have their
+	// spare capacity
+	size_t scratchBytes = 0;
+	for (int t = 0; t < threads; t++) {
+		for (int c = 0; c < KS_VIS_CASTER_TILE; c++) {
+			scratchBytes += VectorBytes(threadVisibleObjects[t][c]) + VectorBytes(threadVisibleSurfaces[t][c]);
+		}
 
-		finalDirectoryBuffer.push_back(dir);
+		scratchBytes += threadObjectStores[t].GetMemoryUsage() + threadSurfaceStores[t].GetMemoryUsage();
 	}
 
-	// Time to pack the RDFs
-	for (int i = 0; i < globalPolyCount; i++) {
+	RecordMemoryHighWater("Visibility", scratchBytes);
 
-		SurfaceLightmapDirectory curddDir = lightmapDirectories[i];
-		vector<SurfLight> surfLights = {};
+	visibleObjects.ShrinkToFit();
+	visibleSurfaces.ShrinkToFit();
 
-		for (int j : lightmapDirectories[i].surfLights) {
-			RDF surfLightUnpacked = jumbleMap[j];
-			SurfLight surfLightPacked = {};
-			SurfaceLightmapDirectory parentDir;
+	// visiblePairs / (globalPolyCount^2) is how much of the naive all pairs work propagation still does,
+	// the tiles count the pairs as they go
+	KS_PROFILE_COUNT("bytesAllocated", visibleSurfaces.GetMemoryUsage() + visibleObjects.GetMemoryUsage());
+}
 
-			// If we are at a lightmap root we can ignore it
-			if (surfLightUnpacked.parentRDF == -1) {
-				continue;
-			}
+VisCasterPlane SceneLightingInformation::GetCasterPlane(int dirIdx, const CompiledSceneGeometry& geo) const {
+	VisCasterPlane caster = { allNormals[dirIdx].x, allNormals[dirIdx].y, allNormals[dirIdx].z,
+		geo.centroids[dirIdx].x, geo.centroids[dirIdx].y, geo.centroids[dirIdx].z };
+	return caster;
+}
+
+bool SceneLightingInformation::IsObjectInFront(int dirIdx, int objIdx, const CompiledSceneGeometry& geo) const {
+	// r_* is reciever, c_* is caster
+	Vector3 c_triNormal = allNormals[dirIdx];
+	Vector3 c_triMean = geo.centroids[dirIdx];
+
+	const SceneObject& obj = scene.getSceneObjects()[objIdx];
+
+	// If both the min and max are behind the current surface, then the object is not visible
+	// (https://www.desmos.com/geometry-beta/twesb3a3o8)
+	Vector3 objMin = get<0>(obj.getBVH());
+	Vector3 objMax = get<1>(obj.getBVH());
+
+	Vector3 objCorners[8] = { objMin,
+					Vector3(objMin.x, objMin.y, objMax.z),
+					Vector3(objMin.x, objMax.y, objMin.z),
+					Vector3(objMin.x, objMax.y, objMax.z),
+					Vector3(objMax.x, objMin.y, objMin.z),
+					Vector3(objMax.x, objMin.y, objMax.z),
+					Vector3(objMax.x, objMax.y, objMin.z),
+					objMax };
+
+	for (Vector3 corner : objCorners) {
+		if (c_triNormal.Dot(corner - c_triMean) < 0.0f) {
+			return true;
+		}
+	}
+
+	// Object is invisible
+	return false;
+}
+
+void SceneLightingInformation::ComputeVisibleObjects(int dirIdx, const CompiledSceneGeometry& geo, vector<int>& objects) const {
+	int objectCount = (int)scene.getSceneObjects().size();
+
+	// Use scene object BV to determine which objects are visible
+	objects.clear();
+	for (int i = 0; i < objectCount; i++) {
+		if (IsObjectInFront(dirIdx, i, geo)) {
+			objects.push_back(i);
+		}
+	}
+}
+
+void SceneLightingInformation::ComputeTileVisibility(int casterStart, int casterEnd, const CompiledSceneGeometry& geo,
+	vector<vector<int>>& tileObjects, vector<vector<int>>& tileSurfaces) const {
+	int casterCount = casterEnd - casterStart;
+
+	VisReceiverStreams receivers;
+	for (int k = 0; k < 3; k++) {
+		receivers.x[k] = geo.cornerX[k].data();
+		receivers.y[k] = geo.cornerY[k].data();
+		receivers.z[k] = geo.cornerZ[k].data();
+	}
+
+	VisCasterPlane casters[KS_VIS_CASTER_TILE];
+	long long tested = 0;
+
+	// Index of the first visible object of each caster that has not been fully tested yet, objects are
+	// in global index order so once the receiver tiles move past an object we never look at it again.
+	int objCursor[KS_VIS_CASTER_TILE];
+
+	for (int c = 0; c < casterCount; c++) {
+		int dirIdx = casterStart + c;
+
+		ComputeVisibleObjects(dirIdx, geo, tileObjects[c]);
+		tileSurfaces[c].clear();
+
+		casters[c] = GetCasterPlane(dirIdx, geo);
+		objCursor[c] = 0;
+	}
 
-			int parentRDFidx = surfLightUnpacked.parentRDF;
-			int parentRDFdirIdx = jumbleMap[parentRDFidx].parentDirectoryIndex;
-			parentDir = lightmapDirectories[parentRDFdirIdx];
+	// We cant do regular backface culling because we are using an area light model, just because the
+	// normal is facing away doesnt mean it isnt visible from another part of the surface. A reciever
+	// is visible if any of its vertices is in front of the caster (see VisibilityKernels.h).
+	//
+	// Recievers are processed in tiles small enough to stay in cache while the whole tile of casters
+	// is tested against them. Tiles are walked in order so every list still comes out sorted.
+	for (int tileStart = 0; tileStart < globalPolyCount; tileStart += KS_VIS_RECEIVER_TILE) {
+		int tileEnd = min(tileStart + KS_VIS_RECEIVER_TILE, globalPolyCount);
 
-			surfLightPacked.casterIdx = parentRDFdirIdx;
-			// colour will be later
-			surfLightPacked.lightBrightness = surfLightUnpacked.lightBrightness;
-			// shadows are later
+		for (int c = 0; c < casterCount; c++) {
+			const vector<int>& objs = tileObjects[c];
+			vector<int>& surfs = tileSurfaces[c];
 
-			surfLights.push_back(surfLightPacked);
+			for (int o = objCursor[c]; o < (int)objs.size(); o++) {
+				GlobalTriRange objTris = scene.getObjectTris(objs[o]);
+
+				if (objTris.first >= tileEnd) {
+					break;
+				}
+
+				int first = max(objTris.first, tileStart);
+				int last = min(objTris.last, tileEnd);
+
+				if (first < last) {
+					size_t oldSize = surfs.size();
+					surfs.resize(oldSize + (last - first));
+
+					int found = ClassifyReceivers(casters[c], receivers, first, last, surfs.data() + oldSize);
+					surfs.resize(oldSize + found);
+					tested += last - first;
+				}
+
+				// object continues in the next tile
+				if (objTris.last > tileEnd) {
+					break;
+				}
+
+				objCursor[c] = o + 1;
+			}
 		}
+	}
+
+	CountTileVisibility(casterCount, tested, tileSurfaces);
+}
+
+void SceneLightingInformation::ComputeTileVisibilityBVH(int casterStart, int casterEnd, const CompiledSceneGeometry& geo,
+	vector<vector<int>>& tileObjects, vector<vector<int>>& tileSurfaces) const {
+	// One bit per surface in front of the current caster
+	vector<uint64_t> frontMask(sceneBVH.GetMaskWords(), 0);
+	long long tested = 0;
 
-		finalLightmapBuffer[i] = surfLights;
+	for (int c = 0; c < casterEnd - casterStart; c++) {
+		int dirIdx = casterStart + c;
+
+		ComputeVisibleObjects(dirIdx, geo, tileObjects[c]);
+
+		VisCasterPlane caster = GetCasterPlane(dirIdx, geo);
+
+		fill(frontMask.begin(), frontMask.end(), 0);
+		sceneBVH.QueryFrontOfPlane(caster, frontMask);
+
+		// Only collect surfaces of objects that passed the BV test, the BV test can disagree with the
+		// per vertex test on surfaces lying right on the caster plane so this keeps both modes giving
+		// exactly the same lists. Objects are in global index order so the list comes out sorted.
+		vector<int>& surfs = tileSurfaces[c];
+		surfs.clear();
+
+		for (int obj : tileObjects[c]) {
+			GlobalTriRange objTris = scene.getObjectTris(obj);
+			TriangleBVH::CollectMaskRange(frontMask, objTris.first, objTris.last, surfs);
+			tested += objTris.last - objTris.first;
+		}
 	}
+
+	CountTileVisibility(casterEnd - casterStart, tested, tileSurfaces);
 }
 
-std::vector<SurfaceLightmapDirectoryPacked> SceneLightingInformation::GetDirectoryBuffer() {
-	return finalDirectoryBuffer;
+void SceneLightingInformation::CountTileVisibility(int casterCount, long long tested, const vector<vector<int>>& tileSurfaces) const {
+	// Every caster against every surface minus the pairs that reached a per surface test, the rest
+	// were culled by the object BV test
+	KS_PROFILE_COUNT("pairsTested", tested);
+	KS_PROFILE_COUNT("pairsCulled", (long long)casterCount * globalPolyCount - tested);
+
+#ifdef KS_PROFILING
+	long long visible = 0;
+	for (int c = 0; c < casterCount; c++) {
+		visible += tileSurfaces[c].size();
+	}
+
+	KS_PROFILE_COUNT("visiblePairs", visible);
+#else
+	(void)tileSurfaces;
+#endif
 }
 
-std::map<int, std::vector<SurfLight>> SceneLightingInformation::GetFinalLightmapBuffer() {
-	return finalLightmapBuffer;
+void SceneLightingInformation::UpdateLightTree(int idx) {
+	KS_PROFILE_ZONE("UpdateLightTree");
+
+	const vector<SceneObject>& sceneObjects = scene.getSceneObjects();
+	int objectCount = (int)sceneObjects.size();
+
+	if (idx < 0 || idx >= objectCount) {
+		throw std::out_of_range("Scene object index out of range");
+	}
+
+	lightTreeUpdateStats = LightTreeUpdateStats();
+
+	// Only object idx is allowed to have changed since the tree was built, anything else needs a full
+	// rebuild
+	bool fullRebuild = lightmapDirectories.empty() || treeMaxBounces != maxBounces ||
+		treeMinLightness != minLightness || visibleObjects.GetColumnCount() != objectCount;
+
+	vector<pair<int, int>> oldRanges(objectCount);
+	for (int i = 0; i < objectCount && !fullRebuild; i++) {
+		oldRanges[i] = scene.getObjectTrisRange(i);
+		fullRebuild = i != idx && sceneObjects[i].IsTransformDirty();
+	}
+
+	if (!fullRebuild) {
+		scene.compileScene();
+
+		fullRebuild = scene.getCompiledGeometry().triCount() != globalPolyCount;
+		for (int i = 0; i < objectCount && !fullRebuild; i++) {
+			fullRebuild = scene.getObjectTrisRange(i) != oldRanges[i];
+		}
+	}
+
+	if (fullRebuild) {
+		BuildLightTree();
+
+		lightTreeUpdateStats.rebuilt = jumbleMap.Size();
+		lightTreeUpdateStats.fullRebuild = true;
+		return;
+	}
+
+	const CompiledSceneGeometry& geo = scene.getCompiledGeometry();
+	GlobalTriRange objTris = scene.getObjectTris(idx);
+
+	for (int i : objTris) {
+		UpdateDirectory(i, geo);
+		allNormals[i] = geo.normals[i];
+	}
+
+	// rangeValues[rangeOffsets[dirIdx], rangeOffsets[dirIdx + 1]) are the surfaces of the object
+	// visible from dirIdx now
+	vector<int> rangeOffsets;
+	vector<int> rangeValues;
+	lightTreeUpdateStats.visibilityRowsUpdated = UpdateVisibility(idx, geo, rangeOffsets, rangeValues);
+
+	// The BVH still has the old triangles, it is rebuilt by the next BuildLightTree
+	sceneBVH.Clear();
+
+	// Every RDF on the object changes (its lightness depends on where the surface is) and so does
+	// everything lit by it. Release all of them, the rest of the tree only depends on surfaces that did
+	// not move.
+	int aliveBefore = jumbleMap.Size() - jumbleMap.GetReleasedCount();
+
+	vector<int> touchedDirectories;
+	for (int i : objTris) {
+		for (RDFHandle rdf : lightmapDirectories[i].surfLights) {
+			ReleaseSubtree(rdf, touchedDirectories);
+		}
+	}
+
+	sort(touchedDirectories.begin(), touchedDirectories.end());
+	touchedDirectories.erase(unique(touchedDirectories.begin(), touchedDirectories.end()), touchedDirectories.end());
+
+	for (int dirIdx : touchedDirectories) {
+		vector<int>& surfLights = lightmapDirectories[dirIdx].surfLights;
+		surfLights.erase(remove_if(surfLights.begin(), surfLights.end(),
+			[&](int rdf) { return !jumbleMap.IsAlive(rdf); }), surfLights.end());
+
+		MarkSurfaceDirty(dirIdx);
+	}
+
+	lightTree.erase(remove_if(lightTree.begin(), lightTree.end(),
+		[&](RDFHandle root) { return !jumbleMap.IsAlive(root); }), lightTree.end());
+
+	lightTreeUpdateStats.removed = aliveBefore - (jumbleMap.Size() - jumbleMap.GetReleasedCount());
+	lightTreeUpdateStats.reused = aliveBefore - lightTreeUpdateStats.removed;
+
+	// RDFs from here on are new
+	int firstNew = jumbleMap.Size();
+
+	// The material of the object may have changed too, so the light sources on it are redone
+	emissivePolygons.erase(remove_if(emissivePolygons.begin(), emissivePolygons.end(),
+		[&](int i) { return i >= objTris.first && i < objTris.last; }), emissivePolygons.end());
+
+	for (int i : objTris) {
+		if (geo.materials[geo.materialIds[i]].GetEmissiveIntensity() > 0.1f) {
+			emissivePolygons.push_back(i);
+			AddLightSource(i, geo);
+		}
+	}
+
+	sort(emissivePolygons.begin(), emissivePolygons.end());
+	sort(lightTree.begin(), lightTree.end(), [&](RDFHandle a, RDFHandle b) {
+		return jumbleMap.GetParentDirectoryIndex(a) < jumbleMap.GetParentDirectoryIndex(b);
+	});
+
+	// Reconnect the RDFs that were kept to the surfaces of the object. They lost every child on the
+	// object above, the new children are created and queued like in BuildLightTree.
+	vector<RDFHandle> children;
+
+	for (RDFHandle rdf = 0; rdf < firstNew; rdf++) {
+		if (!jumbleMap.IsAlive(rdf) || !IsExpandable(rdf)) {
+			continue;
+		}
+
+		int dirIdx = jumbleMap.GetParentDirectoryIndex(rdf);
+		int newCount = rangeOffsets[dirIdx + 1] - rangeOffsets[dirIdx];
+
+		RDFRange oldChildren = jumbleMap.GetChildren(rdf);
+
+		// Children are in receiver order so the new ones go between the ones before and after the object
+		children.clear();
+		for (RDFHandle child : oldChildren) {
+			if (jumbleMap.IsAlive(child) && jumbleMap.GetParentDirectoryIndex(child) < objTris.first) {
+				children.push_back(child);
+			}
+		}
+
+		for (int r = rangeOffsets[dirIdx]; r < rangeOffsets[dirIdx + 1]; r++) {
+			children.push_back(AddReceiverRDF(rdf, rangeValues[r], geo));
+		}
+
+		// GetChildren is only valid until the next SetChildren, AddReceiverRDF leaves it alone
+		for (RDFHandle child : oldChildren) {
+			if (jumbleMap.IsAlive(child) && jumbleMap.GetParentDirectoryIndex(child) >= objTris.last) {
+				children.push_back(child);
+			}
+		}
+
+		if (newCount == 0 && (int)children.size() == oldChildren.size()) {
+			continue;
+		}
+
+		jumbleMap.SetChildren(rdf, children);
+	}
+
+	PropagateQueue(geo);
+	RecordMemoryHighWater("UpdateLightTree", VectorBytes(rangeOffsets) + VectorBytes(rangeValues));
+
+	lightTreeUpdateStats.rebuilt = jumbleMap.Size() - firstNew;
+
+	KS_PROFILE_COUNT("rdfsCreated", lightTreeUpdateStats.rebuilt);
+
+	if (jumbleMap.GetReleasedCount() > jumbleMap.Size() * KS_RDF_COMPACT_FRACTION) {
+		CompactLightTree();
+		lightTreeUpdateStats.compacted = true;
+	}
+
+	if (visibleSurfaces.GetGarbageBytes() > visibleSurfaces.GetMemoryUsage() * KS_RDF_COMPACT_FRACTION) {
+		visibleSurfaces.Compact();
+		visibleSurfaces.ShrinkToFit();
+	}
+
+	if (visibleObjects.GetGarbageBytes() > visibleObjects.GetMemoryUsage() * KS_RDF_COMPACT_FRACTION) {
+		visibleObjects.Compact();
+		visibleObjects.ShrinkToFit();
+	}
+}
+
+int SceneLightingInformation::UpdateVisibility(int objIdx, const CompiledSceneGeometry& geo,
+	vector<int>& rangeOffsets, vector<int>& rangeValues) {
+	KS_PROFILE_ZONE("UpdateVisibility");
+
+	int threads = ResolveThreadCount(threadCount);
+	GlobalTriRange objTris = scene.getObjectTris(objIdx);
+	int objTriCount = objTris.last - objTris.first;
+
+	VisReceiverStreams receivers;
+	for (int k = 0; k < 3; k++) {
+		receivers.x[k] = geo.cornerX[k].data();
+		receivers.y[k] = geo.cornerY[k].data();
+		receivers.z[k] = geo.cornerZ[k].data();
+	}
+
+	// Object rows first. Outside of the object only the column of the object can change. Rows that never
+	// had the object in front of them cant have had any of its surfaces either, so those are skipped below.
+	vector<uint8_t> sawObject(globalPolyCount, 0);
+	vector<int> objects;
+
+	for (int dirIdx = 0; dirIdx < globalPolyCount; dirIdx++) {
+		bool before = visibleObjects.Contains(dirIdx, objIdx);
+		bool after;
+
+		if (dirIdx >= objTris.first && dirIdx < objTris.last) {
+			ComputeVisibleObjects(dirIdx, geo, objects);
+			visibleObjects.SetRow(dirIdx, objects);
+			after = visibleObjects.Contains(dirIdx, objIdx);
+		}
+		else {
+			after = IsObjectInFront(dirIdx, objIdx, geo);
+			if (after != before) {
+				visibleObjects.ReplaceRange(dirIdx, objIdx, objIdx + 1, &objIdx, after ? 1 : 0);
+			}
+		}
+
+		sawObject[dirIdx] = before || after;
+	}
+
+	// Surface rows of the object from scratch, the same way BuildVisibility does them
+	vector<vector<int>> objectRows(objTriCount);
+
+	// BVH mode gives the same rows as brute force, and the BVH is out of date anyway
+	vector<vector<vector<int>>> threadVisibleObjects(threads, vector<vector<int>>(KS_VIS_CASTER_TILE));
+	vector<vector<vector<int>>> threadVisibleSurfaces(threads, vector<vector<int>>(KS_VIS_CASTER_TILE));
+
+	ParallelFor(objTriCount, KS_VIS_CASTER_TILE, threads, [&](int chunkStart, int chunkEnd, int threadIdx) {
+		vector<vector<int>>& tileSurfaces = threadVisibleSurfaces[threadIdx];
+
+		ComputeTileVisibility(objTris.first + chunkStart, objTris.first + chunkEnd, geo,
+			threadVisibleObjects[threadIdx], tileSurfaces);
+
+		for (int c = chunkStart; c < chunkEnd; c++) {
+			objectRows[c].swap(tileSurfaces[c - chunkStart]);
+		}
+	});
+
+	// Every other row only changes in the columns of the object. Each chunk collects its new columns on
+	// its own and the chunks are joined in order afterwards.
+	int chunkCount = (globalPolyCount + KS_VIS_CASTER_TILE - 1) / KS_VIS_CASTER_TILE;
+	vector<vector<int>> chunkValues(chunkCount);
+	vector<vector<int>> chunkChanged(chunkCount);
+
+	rangeOffsets.assign(globalPolyCount + 1, 0);
+
+	ParallelFor(globalPolyCount, KS_VIS_CASTER_TILE, threads, [&](int chunkStart, int chunkEnd, int) {
+		vector<int>& values = chunkValues[chunkStart / KS_VIS_CASTER_TILE];
+		vector<int>& changed = chunkChanged[chunkStart / KS_VIS_CASTER_TILE];
+		vector<int> oldValues;
+
+		for (int dirIdx = chunkStart; dirIdx < chunkEnd; dirIdx++) {
+			size_t start = values.size();
+
+			if (dirIdx >= objTris.first && dirIdx < objTris.last) {
+				const vector<int>& row = objectRows[dirIdx - objTris.first];
+				values.insert(values.end(), lower_bound(row.begin(), row.end(), objTris.first),
+					lower_bound(row.begin(), row.end(), objTris.last));
+			}
+			else if (sawObject[dirIdx]) {
+				if (visibleObjects.Contains(dirIdx, objIdx)) {
+					VisCasterPlane caster = GetCasterPlane(dirIdx, geo);
+					values.resize(start + objTriCount);
+
+					int found = ClassifyReceivers(caster, receivers, objTris.first, objTris.last, values.data() + start);
+					values.resize(start + found);
+				}
+
+				oldValues.clear();
+				visibleSurfaces.GetRowRange(dirIdx, objTris.first, objTris.last, oldValues);
+
+				if (oldValues.size() != values.size() - start || !equal(oldValues.begin(), oldValues.end(), values.begin() + start)) {
+					changed.push_back(dirIdx);
+				}
+			}
+
+			rangeOffsets[dirIdx + 1] = (int)(values.size() - start);
+		}
+	});
+
+	for (int dirIdx = 0; dirIdx < globalPolyCount; dirIdx++) {
+		rangeOffsets[dirIdx + 1] += rangeOffsets[dirIdx];
+	}
+
+	rangeValues.clear();
+	rangeValues.reserve(rangeOffsets[globalPolyCount]);
+	for (vector<int>& values : chunkValues) {
+		rangeValues.insert(rangeValues.end(), values.begin(), values.end());
+	}
+
+	// Write the rows back, the stores are not thread safe to modify
+	int rowsUpdated = objTriCount;
+
+	for (int c = 0; c < objTriCount; c++) {
+		visibleSurfaces.SetRow(objTris.first + c, objectRows[c]);
+	}
+
+	for (vector<int>& changed : chunkChanged) {
+		for (int dirIdx : changed) {
+			visibleSurfaces.ReplaceRange(dirIdx, objTris.first, objTris.last,
+				rangeValues.data() + rangeOffsets[dirIdx], rangeOffsets[dirIdx + 1] - rangeOffsets[dirIdx]);
+		}
+
+		rowsUpdated += (int)changed.size();
+	}
+
+	return rowsUpdated;
+}
+
+void SceneLightingInformation::UpdateFinalRDFBuffer() {
+	KS_PROFILE_ZONE("Packing");
+
+	const CompiledSceneGeometry& geo = scene.getCompiledGeometry();
+
+	// Surfaces can only be kept from buffers packed the same way for the same triangles
+	if ((int)surfaceDirtyFlags.size() != globalPolyCount || (int)finalDirectoryBuffer.size() != globalPolyCount ||
+		(int)finalLightOffsets.size() != globalPolyCount + 1 || finalPackingMode != lightPackingMode) {
+		MarkAllSurfacesDirty();
+	}
+
+	finalDirectoryBuffer.resize(globalPolyCount);
+	finalTotalEnergy.resize(globalPolyCount);
+	finalDroppedEnergy.resize(globalPolyCount);
+
+	int repacked = 0;
+
+	// for now just loop through all of the polygons and assembly the directory buffer with the
+	// albedo material colour for each object
+
+	for (int i = 0; i < globalPolyCount; i++) {
+		if ((surfaceDirtyFlags[i] & KS_SURFACE_REPACK) == 0) {
+			continue;
+		}
+
+		repacked++;
+
+		// get the material of the object this poly belongs to
+		const Material& mat = geo.materials[geo.materialIds[i]];
+
+		// get the albedo colour
+		Color albedo = mat.GetAlbedo();
+
+		SurfaceLightmapDirectoryPacked dir;
+		dir.color = XMFLOAT3(albedo.x, albedo.y, albedo.z)/255.0f; // convert to 0-1 range
+
+		dir.normal = XMFLOAT3(allNormals[i].x, allNormals[i].y, allNormals[i].z);
+
+		dir.emmissiveStrength = mat.GetEmissiveIntensity();
+
+		dir.numLights = min((int)lightmapDirectories[i].surfLights.size(), KS_MAX_SURFACE_LIGHTS);
+
+		// store the flatten matrix, to 2d and back to 3d matrices
+		// The constant buffer matrices are transposed so this also should be transposed???
+		// cos hlsl
+		XMStoreFloat4x4(&dir.flattenMatrix, XMMatrixTranspose(lightmapDirectories[i].flattenMatrix));
+		XMStoreFloat4x4(&dir.toPlaneLocalMatrix, XMMatrixTranspose(lightmapDirectories[i].toPlaneLocalMatrix));
+		XMStoreFloat4x4(&dir.toWorldMatrix, XMMatrixTranspose(lightmapDirectories[i].toWorldMatrix));
+
+		// Store vertices
+		Vector3 tri[3];
+		geo.getTri(tri, i);
+		dir.vertices[0] = XMFLOAT3(tri[0].x, tri[0].y, tri[0].z);
+		dir.vertices[1] = XMFLOAT3(tri[1].x, tri[1].y, tri[1].z);
+		dir.vertices[2] = XMFLOAT3(tri[2].x, tri[2].y, tri[2].z);
+
+		dir.plane = geo.planes[i];
+
+		finalDirectoryBuffer[i] = dir;
+	}
+
+	// The lights of the clean surfaces are copied over from the buffers packed before, only used when
+	// some surfaces are clean
+	vector<int> keptOffsets;
+	vector<SurfLight> keptLights;
+
+	if (repacked > 0) {
+		size_t lightCount = 0;
+		for (int i = 0; i < globalPolyCount; i++) {
+			if (surfaceDirtyFlags[i] & KS_SURFACE_REPACK) {
+				lightCount += lightmapDirectories[i].surfLights.size();
+			}
+			else {
+				lightCount += finalLightOffsets[i + 1] - finalLightOffsets[i];
+			}
+		}
+
+		if (repacked < globalPolyCount) {
+			keptOffsets.swap(finalLightOffsets);
+			keptLights.swap(finalLights);
+		}
+
+		// Time to pack the RDFs, every surface after the one before in one flat array. In importance mode
+		// the lights of a surface are ranked as they are packed, ranked[k] is (importance, creation order).
+		vector<pair<float, int>> ranked;
+		vector<SurfLight> surfaceLights;
+
+		finalLightOffsets.assign(1, 0);
+		finalLightOffsets.reserve(globalPolyCount + 1);
+
+		finalLights.clear();
+		finalLights.reserve(lightCount);
+
+		for (int i = 0; i < globalPolyCount; i++) {
+			if ((surfaceDirtyFlags[i] & KS_SURFACE_REPACK) == 0) {
+				finalLights.insert(finalLights.end(), keptLights.begin() + keptOffsets[i], keptLights.begin() + keptOffsets[i + 1]);
+				finalLightOffsets.push_back((int)finalLights.size());
+				continue;
+			}
+
+			// Only the parent and brightness columns of the pool are touched here
+			for (int j : lightmapDirectories[i].surfLights) {
+				RDFHandle parentRDFidx = jumbleMap.GetParentRDF(j);
+
+				// If we are at a lightmap root we can ignore it
+				if (parentRDFidx == -1) {
+					continue;
+				}
+
+				SurfLight surfLightPacked = {};
+
+				int parentRDFdirIdx = jumbleMap.GetParentDirectoryIndex(parentRDFidx);
+
+				surfLightPacked.casterIdx = parentRDFdirIdx;
+				// colour will be later
+				surfLightPacked.lightBrightness = jumbleMap.GetLightBrightness(j);
+				// shadows are later
+
+				finalLights.push_back(surfLightPacked);
+			}
+
+			int first = finalLightOffsets.back();
+			int count = (int)finalLights.size() - first;
+
+			if (lightPackingMode == KS_LIGHTPACK_IMPORTANCE && count > 1) {
+				ranked.resize(count);
+				for (int j = 0; j < count; j++) {
+					ranked[j] = make_pair(ComputeLightImportance(finalLights[first + j], i, geo), j);
+				}
+
+				// Only the first KS_MAX_SURFACE_LIGHTS need to be in order, the rest keep creation order so
+				// the result does not depend on how the standard library sorts
+				int kept = min(count, KS_MAX_SURFACE_LIGHTS);
+
+				partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(),
+					[](const pair<float, int>& a, const pair<float, int>& b) {
+					return a.first > b.first || (a.first == b.first && a.second < b.second);
+				});
+
+				sort(ranked.begin() + kept, ranked.end(), [](const pair<float, int>& a, const pair<float, int>& b) {
+					return a.second < b.second;
+				});
+
+				surfaceLights.assign(finalLights.begin() + first, finalLights.end());
+				for (int j = 0; j < count; j++) {
+					finalLights[first + j] = surfaceLights[ranked[j].second];
+				}
+			}
+
+			finalLightOffsets.push_back((int)finalLights.size());
+
+			UpdateSurfaceEnergy(i, geo);
+
+			// Packed, what is left is uploading it
+			surfaceDirtyFlags[i] = KS_SURFACE_UPLOAD;
+		}
+	}
+
+	finalPackingMode = lightPackingMode;
+
+	UpdateLightPackingStats();
+	lightPackingStats.repackedSurfaces = repacked;
+
+	UpdateDirtyRanges();
+
+	KS_PROFILE_COUNT("surfacesRepacked", repacked);
+
+	RecordMemoryHighWater("Packing", VectorBytes(keptOffsets) + VectorBytes(keptLights));
+}
+
+void SceneLightingInformation::MarkSurfaceDirty(int dirIdx) {
+	surfaceDirtyFlags[dirIdx] |= (uint8_t)(KS_SURFACE_REPACK | KS_SURFACE_UPLOAD);
+}
+
+void SceneLightingInformation::MarkAllSurfacesDirty() {
+	surfaceDirtyFlags.assign(globalPolyCount, (uint8_t)(KS_SURFACE_REPACK | KS_SURFACE_UPLOAD));
+}
+
+void SceneLightingInformation::UpdateDirtyRanges() {
+	dirtyRanges.clear();
+
+	int surfaceCount = (int)surfaceDirtyFlags.size();
+	int dirtyCount = 0;
+
+	for (int i = 0; i < surfaceCount; i++) {
+		if ((surfaceDirtyFlags[i] & KS_SURFACE_UPLOAD) == 0) {
+			continue;
+		}
+
+		dirtyCount++;
+
+		if (!dirtyRanges.empty() && i - (dirtyRanges.back().first + dirtyRanges.back().count) <= KS_DIRTY_RANGE_MERGE_GAP) {
+			dirtyRanges.back().count = i + 1 - dirtyRanges.back().first;
+		}
+		else {
+			PackedSurfaceRange range = { i, 1 };
+			dirtyRanges.push_back(range);
+		}
+	}
+
+	if (dirtyCount > 0 && dirtyCount > fullUploadFraction * surfaceCount) {
+		PackedSurfaceRange all = { 0, surfaceCount };
+		dirtyRanges.assign(1, all);
+	}
+
+	KS_PROFILE_COUNT("surfacesDirty", dirtyCount);
+}
+
+const vector<PackedSurfaceRange>& SceneLightingInformation::GetDirtyRanges() const {
+	return dirtyRanges;
+}
+
+void SceneLightingInformation::ClearDirtyRanges() {
+	// Every surface flagged for upload is inside a range, surfaces flagged since then are still flagged
+	// for repacking and get flagged for upload again when they are packed
+	for (const PackedSurfaceRange& range : dirtyRanges) {
+		for (int i = range.first; i < range.first + range.count; i++) {
+			surfaceDirtyFlags[i] &= (uint8_t)~KS_SURFACE_UPLOAD;
+		}
+	}
+
+	dirtyRanges.clear();
+}
+
+std::vector<SurfaceLightmapDirectoryPacked> SceneLightingInformation::GetDirectoryBuffer() {
+	return finalDirectoryBuffer;
+}
+
+std::map<int, std::vector<SurfLight>> SceneLightingInformation::GetFinalLightmapBuffer() {
+	map<int, vector<SurfLight>> lightmap;
+
+	for (int i = 0; i + 1 < (int)finalLightOffsets.size(); i++) {
+		SurfLightRange lights = GetFinalLights(i);
+		lightmap[i].assign(lights.begin(), lights.end());
+	}
+
+	return lightmap;
+}
+
+const vector<SurfaceLightmapDirectoryPacked>& SceneLightingInformation::GetDirectoryBufferView() const {
+	return finalDirectoryBuffer;
+}
+
+SurfLightRange SceneLightingInformation::GetFinalLights(int dirIdx) const {
+	if (dirIdx < 0 || dirIdx + 1 >= (int)finalLightOffsets.size()) {
+		throw std::out_of_range("Surface index out of range of the packed lightmap");
+	}
+
+	const SurfLight* lights = finalLights.data();
+	SurfLightRange range = { lights + finalLightOffsets[dirIdx], lights + finalLightOffsets[dirIdx + 1] };
+	return range;
+}
+
+float SceneLightingInformation::ComputeLightImportance(const SurfLight& light, int receiverIdx, const CompiledSceneGeometry& geo) const {
+	int casterIdx = light.casterIdx;
+
+	// Fronts face away from the normals, same as ComputeTransfer
+	Vector3 toReceiver = Vector3(geo.centroids[receiverIdx]) - Vector3(geo.centroids[casterIdx]);
+	float dist = toReceiver.Length();
+
+	if (dist <= 0.0f) {
+		return 0.0f;
+	}
+
+	toReceiver /= dist;
+
+	float cosCaster = max(-allNormals[casterIdx].Dot(toReceiver), 0.0f);
+	float cosReceiver = max(allNormals[receiverIdx].Dot(toReceiver), 0.0f);
+
+	return Attenuate(dist, light.lightBrightness * cosCaster * cosReceiver * geo.areas[casterIdx]);
+}
+
+void SceneLightingInformation::UpdateSurfaceEnergy(int dirIdx, const CompiledSceneGeometry& geo) {
+	double total = 0.0;
+	double dropped = 0.0;
+
+	for (int j = finalLightOffsets[dirIdx]; j < finalLightOffsets[dirIdx + 1]; j++) {
+		float importance = ComputeLightImportance(finalLights[j], dirIdx, geo);
+
+		total += importance;
+		if (j - finalLightOffsets[dirIdx] >= KS_MAX_SURFACE_LIGHTS) {
+			dropped += importance;
+		}
+	}
+
+	finalTotalEnergy[dirIdx] = (float)total;
+	finalDroppedEnergy[dirIdx] = (float)dropped;
+}
+
+void SceneLightingInformation::UpdateLightPackingStats() {
+	lightPackingStats = LightPackingStats();
+
+	for (int i = 0; i < (int)finalTotalEnergy.size(); i++) {
+		float total = finalTotalEnergy[i];
+		float dropped = finalDroppedEnergy[i];
+
+		if (finalLightOffsets[i + 1] - finalLightOffsets[i] > KS_MAX_SURFACE_LIGHTS) {
+			lightPackingStats.truncatedSurfaces++;
+		}
+
+		if (total > 0.0f) {
+			lightPackingStats.maxDroppedFraction = max(lightPackingStats.maxDroppedFraction, dropped / total);
+		}
+
+		lightPackingStats.totalEnergy += total;
+		lightPackingStats.droppedEnergy += dropped;
+	}
+}
+
+size_t SceneLightingInformation::PackDirectoryBuffer(void* dest, size_t stride) const {
+	PackedSurfaceRange all = { 0, (int)finalDirectoryBuffer.size() };
+	return PackDirectoryBuffer(dest, stride, all);
+}
+
+size_t SceneLightingInformation::PackLightmapBuffer(void* dest, size_t stride) const {
+	PackedSurfaceRange all = { 0, max((int)finalLightOffsets.size() - 1, 0) };
+	return PackLightmapBuffer(dest, stride, all);
+}
+
+size_t SceneLightingInformation::PackDirectoryBuffer(void* dest, size_t stride, PackedSurfaceRange range) const {
+	if (stride < sizeof(SurfaceLightmapDirectoryPacked)) {
+		throw std::invalid_argument("Directory buffer stride is smaller than a directory");
+	}
+
+	if (range.first < 0 || range.count < 0 || range.first + range.count > (int)finalDirectoryBuffer.size()) {
+		throw std::out_of_range("Surface range out of range of the packed directories");
+	}
+
+	uint8_t* out = (uint8_t*)dest;
+
+	for (int i = range.first; i < range.first + range.count; i++) {
+		memcpy(out, &finalDirectoryBuffer[i], sizeof(SurfaceLightmapDirectoryPacked));
+		out += stride;
+	}
+
+	return range.count * stride;
+}
+
+size_t SceneLightingInformation::PackLightmapBuffer(void* dest, size_t stride, PackedSurfaceRange range) const {
+	size_t slotBytes = sizeof(SurfLight) * KS_MAX_SURFACE_LIGHTS;
+
+	if (stride < slotBytes) {
+		throw std::invalid_argument("Lightmap buffer stride is smaller than KS_MAX_SURFACE_LIGHTS lights");
+	}
+
+	int surfaceCount = max((int)finalLightOffsets.size() - 1, 0);
+
+	if (range.first < 0 || range.count < 0 || range.first + range.count > surfaceCount) {
+		throw std::out_of_range("Surface range out of range of the packed lightmap");
+	}
+
+	uint8_t* out = (uint8_t*)dest;
+
+	for (int i = range.first; i < range.first + range.count; i++) {
+		// Only the first KS_MAX_SURFACE_LIGHTS lights fit, the shader ignores the zeroed slots after them
+		size_t count = min(finalLightOffsets[i + 1] - finalLightOffsets[i], KS_MAX_SURFACE_LIGHTS);
+		size_t bytes = count * sizeof(SurfLight);
+
+		memcpy(out, finalLights.data() + finalLightOffsets[i], bytes);
+		memset(out + bytes, 0, slotBytes - bytes);
+
+		out += stride;
+	}
+
+	return range.count * stride;
+}
+
+const VisibilityStore& SceneLightingInformation::GetVisibleSurfaces() const {
+	return visibleSurfaces;
+}
+
+const VisibilityStore& SceneLightingInformation::GetVisibleObjects() const {
+	return visibleObjects;
+}
+
+MemoryUsage SceneLightingInformation::GetMemoryUsageTree() const {
+	MemoryUsage usage("lighting");
+
+	MemoryUsage& directories = usage.Add("lightmapDirectories", VectorBytes(lightmapDirectories));
+
+	size_t surfLightBytes = 0;
+	for (const SurfaceLightmapDirectory& dir : lightmapDirectories) {
+		surfLightBytes += VectorBytes(dir.surfLights);
+	}
+
+	directories.Add("surfLights", surfLightBytes);
+
+	usage.Add(jumbleMap.GetMemoryUsageTree("jumbleMap"));
+	usage.Add(visibleSurfaces.GetMemoryUsageTree("visibleSurfaces"));
+	usage.Add(visibleObjects.GetMemoryUsageTree("visibleObjects"));
+	usage.Add(sceneBVH.GetMemoryUsageTree("sceneBVH"));
+
+	usage.Add("allNormals", VectorBytes(allNormals));
+	usage.Add("lightTree", VectorBytes(emissivePolygons) + VectorBytes(lightTree) + processQueue.size() * sizeof(int));
+
+	usage.Add("finalDirectoryBuffer", VectorBytes(finalDirectoryBuffer));
+
+	usage.Add("finalLightmapBuffer", VectorBytes(finalLightOffsets) + VectorBytes(finalLights) +
+		VectorBytes(finalTotalEnergy) + VectorBytes(finalDroppedEnergy));
+
+	usage.Add("dirtyRanges", VectorBytes(surfaceDirtyFlags) + VectorBytes(dirtyRanges));
+
+	usage.Add(scene.getMemoryUsageTree());
+
+	return usage;
+}
+
+const map<string, size_t>& SceneLightingInformation::GetMemoryHighWater() const {
+	return memoryHighWater;
+}
+
+void SceneLightingInformation::ResetMemoryHighWater() {
+	memoryHighWater.clear();
+}
+
+void SceneLightingInformation::RecordMemoryHighWater(const char* phase, size_t scratchBytes) {
+	size_t& highWater = memoryHighWater[phase];
+	highWater = max(highWater, GetMemoryUsageTree().GetTotalBytes() + scratchBytes);
+}
+
+uint64_t SceneLightingInformation::ComputeBakeKey() const {
+	string scenePath = scene.getScenePath();
+
+	uint64_t key = KS_HASH_SEED;
+	if (scenePath.empty() || !HashFile(scenePath, key)) {
+		return 0;
+	}
+
+	// The mesh files were hashed when the scene loaded them, reading them again would double the cost
+	// of a cache hit on large meshes
+	for (const string& mesh : scene.getMeshNames()) {
+		uint64_t fileHash;
+		if (!scene.getMeshFileHash(mesh, fileHash)) {
+			return 0;
+		}
+
+		key = HashBytes(&fileHash, sizeof(fileHash), key);
+	}
+
+	key = HashBytes(bakeConstants, sizeof(bakeConstants), key);
+
+	BakeMeta settings = {};
+	settings.maxBounces = maxBounces;
+	settings.minLightness = minLightness;
+	settings.visibilityMode = visibilityMode;
+	key = HashBytes(&settings, sizeof(settings), key);
+
+	// Objects may have been moved or given other materials since the scene file was loaded
+	for (const SceneObject& obj : scene.getSceneObjects()) {
+		XMFLOAT4X4 world;
+		XMStoreFloat4x4(&world, obj.GetWorldMatrix());
+
+		const Material& mat = obj.GetMaterial();
+		float material[6] = { mat.GetAlbedo().x, mat.GetAlbedo().y, mat.GetAlbedo().z,
+			mat.GetEmissiveIntensity(), mat.GetRoughness(), (float)obj.GetMaterialId() };
+
+		key = HashBytes(&world, sizeof(world), key);
+		key = HashBytes(material, sizeof(material), key);
+	}
+
+	// 0 is kept for no key
+	return key == 0 ? 1 : key;
+}
+
+bool SceneLightingInformation::SaveBake(const string& path) const {
+	KS_PROFILE_ZONE("SaveBake");
+
+	uint64_t key = ComputeBakeKey();
+
+	if (key == 0 || lightmapDirectories.empty()) {
+		return false;
+	}
+
+	BakeFileWriter out;
+	if (!out.Open(path, key)) {
+		return false;
+	}
+
+	BakeMeta meta = { globalPolyCount, visibleObjects.GetColumnCount(), treeMaxBounces, treeMinLightness, visibilityMode,
+		finalPackingMode };
+	out.WriteSection(KS_BAKESECTION_META, &meta, sizeof(meta), 1);
+
+	vector<BakedDirectory> directories(globalPolyCount);
+	vector<int> surfLightOffsets(globalPolyCount + 1, 0);
+	vector<int> surfLights;
+
+	for (int i = 0; i < globalPolyCount; i++) {
+		const SurfaceLightmapDirectory& dir = lightmapDirectories[i];
+
+		directories[i].color = dir.color;
+		XMStoreFloat4x4(&directories[i].flattenMatrix, dir.flattenMatrix);
+		XMStoreFloat4x4(&directories[i].toPlaneLocalMatrix, dir.toPlaneLocalMatrix);
+		XMStoreFloat4x4(&directories[i].toWorldMatrix, dir.toWorldMatrix);
+
+		surfLights.insert(surfLights.end(), dir.surfLights.begin(), dir.surfLights.end());
+		surfLightOffsets[i + 1] = (int)surfLights.size();
+	}
+
+	out.WriteSection(KS_BAKESECTION_DIRECTORIES, directories);
+	out.WriteSection(KS_BAKESECTION_SURFLIGHT_OFFSETS, surfLightOffsets);
+	out.WriteSection(KS_BAKESECTION_SURFLIGHTS, surfLights);
+	out.WriteSection(KS_BAKESECTION_NORMALS, allNormals);
+	out.WriteSection(KS_BAKESECTION_EMISSIVE, emissivePolygons);
+	out.WriteSection(KS_BAKESECTION_LIGHTTREE, lightTree);
+	out.WriteSection(KS_BAKESECTION_STATS_CREATED, lightTreeStats.created);
+	out.WriteSection(KS_BAKESECTION_STATS_PRUNED, lightTreeStats.pruned);
+
+	visibleSurfaces.Save(out, KS_BAKESECTION_VISIBLE_SURFACES);
+	visibleObjects.Save(out, KS_BAKESECTION_VISIBLE_OBJECTS);
+	jumbleMap.Save(out, KS_BAKESECTION_RDFS);
+
+	// The packed buffers only if UpdateFinalRDFBuffer has been run, they are kept in the file layout
+	if ((int)finalDirectoryBuffer.size() == globalPolyCount && (int)finalLightOffsets.size() == globalPolyCount + 1) {
+		out.WriteSection(KS_BAKESECTION_PACKED_DIRECTORIES, finalDirectoryBuffer);
+		out.WriteSection(KS_BAKESECTION_PACKED_LIGHT_OFFSETS, finalLightOffsets);
+		out.WriteSection(KS_BAKESECTION_PACKED_LIGHTS, finalLights);
+	}
+
+	return out.Close();
+}
+
+bool SceneLightingInformation::LoadBake(const string& path) {
+	KS_PROFILE_ZONE("LoadBake");
+
+	uint64_t key = ComputeBakeKey();
+
+	BakeFile in;
+	if (key == 0 || !in.Open(path, key)) {
+		return false;
+	}
+
+	scene.compileScene();
+	const CompiledSceneGeometry& geo = scene.getCompiledGeometry();
+	int polyCount = geo.triCount();
+	int objectCount = (int)scene.getSceneObjects().size();
+
+	uint64_t metaCount;
+	const BakeMeta* meta = in.GetSection<BakeMeta>(KS_BAKESECTION_META, metaCount);
+
+	if (meta == nullptr || metaCount != 1 || meta->globalPolyCount != polyCount || meta->objectCount != objectCount ||
+		meta->maxBounces != maxBounces || meta->minLightness != minLightness || meta->visibilityMode != visibilityMode) {
+		return false;
+	}
+
+	// Start from scratch, from here on a failure leaves no tree behind
+	globalPolyCount = polyCount;
+	treeMaxBounces = maxBounces;
+	treeMinLightness = minLightness;
+
+	lightmapDirectories.clear();
+	processQueue = queue<int>();
+	sceneBVH.Clear();
+	lightTreeUpdateStats = LightTreeUpdateStats();
+
+	MarkAllSurfacesDirty();
+
+	vector<BakedDirectory> directories;
+	vector<int> surfLightOffsets;
+	vector<int> surfLights;
+
+	bool valid = in.ReadSection(KS_BAKESECTION_DIRECTORIES, directories) &&
+		in.ReadSection(KS_BAKESECTION_SURFLIGHT_OFFSETS, surfLightOffsets) &&
+		in.ReadSection(KS_BAKESECTION_SURFLIGHTS, surfLights) &&
+		in.ReadSection(KS_BAKESECTION_NORMALS, allNormals) &&
+		in.ReadSection(KS_BAKESECTION_EMISSIVE, emissivePolygons) &&
+		in.ReadSection(KS_BAKESECTION_LIGHTTREE, lightTree) &&
+		in.ReadSection(KS_BAKESECTION_STATS_CREATED, lightTreeStats.created) &&
+		in.ReadSection(KS_BAKESECTION_STATS_PRUNED, lightTreeStats.pruned) &&
+		visibleSurfaces.Load(in, KS_BAKESECTION_VISIBLE_SURFACES) &&
+		visibleObjects.Load(in, KS_BAKESECTION_VISIBLE_OBJECTS) &&
+		jumbleMap.Load(in, KS_BAKESECTION_RDFS);
+
+	// Everything has to line up with the scene, handles have to be inside the pool
+	int rdfCount = jumbleMap.Size();
+
+	valid = valid && (int)directories.size() == polyCount && (int)surfLightOffsets.size() == polyCount + 1 &&
+		(int)allNormals.size() == polyCount && surfLightOffsets[0] == 0 && surfLightOffsets[polyCount] == (int)surfLights.size() &&
+		(int)lightTreeStats.created.size() == maxBounces + 1 && (int)lightTreeStats.pruned.size() == maxBounces + 1 &&
+		visibleSurfaces.GetRowCount() == polyCount && visibleSurfaces.GetColumnCount() == polyCount &&
+		visibleObjects.GetRowCount() == polyCount && visibleObjects.GetColumnCount() == objectCount;
+
+	for (int i = 0; i < polyCount && valid; i++) {
+		valid = surfLightOffsets[i] <= surfLightOffsets[i + 1];
+	}
+
+	for (int rdf : surfLights) {
+		valid = valid && rdf >= 0 && rdf < rdfCount;
+	}
+
+	for (int rdf : lightTree) {
+		valid = valid && rdf >= 0 && rdf < rdfCount;
+	}
+
+	for (int i : emissivePolygons) {
+		valid = valid && i >= 0 && i < polyCount;
+	}
+
+	for (RDFHandle rdf = 0; rdf < rdfCount && valid; rdf++) {
+		int dirIdx = jumbleMap.GetParentDirectoryIndex(rdf);
+		int bounce = jumbleMap.GetBounce(rdf);
+
+		valid = dirIdx >= 0 && dirIdx < polyCount && bounce >= 0 && bounce <= maxBounces;
+	}
+
+	if (valid) {
+		lightmapDirectories.resize(polyCount);
+
+		for (int i = 0; i < polyCount; i++) {
+			SurfaceLightmapDirectory& dir = lightmapDirectories[i];
+
+			dir.color = directories[i].color;
+			dir.flattenMatrix = XMLoadFloat4x4(&directories[i].flattenMatrix);
+			dir.toPlaneLocalMatrix = XMLoadFloat4x4(&directories[i].toPlaneLocalMatrix);
+			dir.toWorldMatrix = XMLoadFloat4x4(&directories[i].toWorldMatrix);
+			dir.surfLights.assign(surfLights.begin() + surfLightOffsets[i], surfLights.begin() + surfLightOffsets[i + 1]);
+		}
+
+		// Packed buffers are optional, without them (or if they were packed in another mode)
+		// UpdateFinalRDFBuffer has to be run as usual. They are read straight into place.
+		bool packed = meta->lightPackingMode == lightPackingMode &&
+			in.ReadSection(KS_BAKESECTION_PACKED_DIRECTORIES, finalDirectoryBuffer) &&
+			in.ReadSection(KS_BAKESECTION_PACKED_LIGHT_OFFSETS, finalLightOffsets) &&
+			in.ReadSection(KS_BAKESECTION_PACKED_LIGHTS, finalLights) &&
+			(int)finalDirectoryBuffer.size() == polyCount && (int)finalLightOffsets.size() == polyCount + 1 &&
+			finalLightOffsets[0] == 0 && finalLightOffsets[polyCount] == (int)finalLights.size();
+
+		for (int i = 0; i < polyCount && packed; i++) {
+			packed = finalLightOffsets[i] <= finalLightOffsets[i + 1];
+		}
+
+		// The energies below read the geometry of every caster
+		for (const SurfLight& light : finalLights) {
+			packed = packed && light.casterIdx >= 0 && light.casterIdx < polyCount;
+		}
+
+		if (!packed) {
+			finalDirectoryBuffer.clear();
+			finalLightOffsets.clear();
+			finalLights.clear();
+		}
+
+		finalPackingMode = lightPackingMode;
+		finalTotalEnergy.assign(packed ? polyCount : 0, 0.0f);
+		finalDroppedEnergy.assign(packed ? polyCount : 0, 0.0f);
+
+		// Loaded buffers are as good as packed ones, only the upload is left
+		for (int i = 0; i < polyCount && packed; i++) {
+			UpdateSurfaceEnergy(i, geo);
+			surfaceDirtyFlags[i] = KS_SURFACE_UPLOAD;
+		}
+
+		UpdateLightPackingStats();
+		UpdateDirtyRanges();
+
+		RecordMemoryHighWater("LoadBake");
+
+		return true;
+	}
+
+	lightmapDirectories.clear();
+	allNormals.clear();
+	emissivePolygons.clear();
+	lightTree.clear();
+	jumbleMap.Clear();
+	visibleSurfaces.Clear();
+	visibleObjects.Clear();
+
+	return false;
 }
\ No newline at end of file
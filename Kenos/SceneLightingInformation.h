@@ -12,6 +12,10 @@
 
 #include "SceneInformation.h"
 #include "CoreFuncsLib.h"
+#include "TriangleBVH.h"
+#include "VisibilityStore.h"
+#include "RDFPool.h"
+#include "BakeCache.h"
 
 using DXVector3 = DirectX::SimpleMath::Vector3;
 using DXVector2 = DirectX::SimpleMath::Vector2;
@@ -29,39 +33,6 @@ using DXColor = DirectX::SimpleMath::Color;
 *
 */
 
-// Representaiton of the the radiance distribution function. This is what gets traced through the scene
-// 
-struct RDF {
-	// Index of the SurfaceLightmapDirectory struct that this RDF belongs to.
-	int parentDirectoryIndex;
-
-	// Every time we process an rdf, if the bounce < maxBounces we spawn children
-	int bounce;
-
-	// When backtracing, index into the jumblemap of the parent RDF. If this is -1
-	// then it has no parent and we are at a light source.
-	int parentRDF;
-
-	std::vector<int> children;
-
-	// This is the corrected colour, so we dont have to sample the surface and mix it with the
-	// light colour in the shader.
-	DirectX::SimpleMath::Color color;
-
-	// This stays the same through all bounces because of how the shader works maybe we can optimize
-	// this but 4 extra bytes per structure isnt that bad. (we probably will have more padding anyway)
-	float lightBrightness;
-
-	// This is the per surface lightness multiplier. 1.0 is the default, that means that 100% of the
-	// the light from the parent scatters onto the surface. 
-	float lightness;
-
-	// Indeces of objects that shadow this surface. Shadows are not stored per surface, they are stored
-	// per mesh, the pixel shader iterates through all the provided ranges and checks. This should be
-	// done in a better way.
-	std::vector<int> shadows;
-};
-
 // A "directory" of all of the lightmap information for a surface. This is a per-surface structure
 // that contains all of the information needed to render the surface. This is not the lightmap itself,
 // as that is usually not per surface as light may bounce between surfaces any amount of times.
@@ -78,10 +49,8 @@ struct SurfaceLightmapDirectory {
 
 	std::vector<int> surfLights;
 
-	// vector of all of the surfaces that are visible from this surface.
-	std::vector<int> visibleSurfaces;
-
-	std::vector<int> visibleObjects;
+	// The surfaces and objects visible from this surface are kept in the visibleSurfaces and
+	// visibleObjects stores of SceneLightingInformation, row i belongs to directory i.
 
 	// not sure what else would go here, probaby stuff for deferred shading.
 };
@@ -112,6 +81,17 @@ struct SurfLight {
 	// acceleration structure
 };
 
+// The packed lights of one surface, a view into the final lightmap buffer
+struct SurfLightRange {
+	const SurfLight* first;
+	const SurfLight* last;
+
+	const SurfLight* begin() const { return first; }
+	const SurfLight* end() const { return last; }
+	int size() const { return (int)(last - first); }
+	bool empty() const { return first == last; }
+};
+
 // The same as SurfaceLightmapDirectory, but uses c style arrays to get ready to copy to buffers.
 struct SurfaceLightmapDirectoryPacked {
 
@@ -159,6 +139,83 @@ struct SurfaceLightmapDirectoryPacked {
 // enable padding warnings again
 #pragma warning(default: 4324)
 
+// How the visibility pass finds the surfaces in front of each caster. Both modes give exactly the same
+// visibleSurfaces and only differ in speed.
+enum VisibilityMode {
+	// Test every triangle of every object whose BV is in front of the caster
+	KS_VISMODE_BRUTEFORCE,
+
+	// Query a BVH over every triangle in the scene, whole subtrees are rejected or accepted against
+	// the caster plane and only the straddling leaves are tested per triangle
+	KS_VISMODE_BVH
+};
+
+// Number of RDFs at every bounce of the last BuildLightTree, indexed by bounce. Bounce 0 are the
+// light sources.
+struct LightTreeStats {
+	// RDFs created at this bounce
+	std::vector<int> created;
+
+	// RDFs at this bounce that were not given children because their lightness was below the minimum
+	std::vector<int> pruned;
+};
+
+// How UpdateFinalRDFBuffer orders the packed lights of each surface. Only the first
+// KS_MAX_SURFACE_LIGHTS of a surface reach the GPU, the rest are dropped.
+enum LightPackingMode {
+	// In the order the RDFs were created, what is dropped is arbitrary
+	KS_LIGHTPACK_CREATION_ORDER,
+
+	// Highest estimated contribution first (brightness of the caster times the form factor over the
+	// squared distance, see ComputeLightImportance), so the lights that are dropped are the dimmest and
+	// the light loop can stop early. Lights with the same estimate stay in creation order.
+	KS_LIGHTPACK_IMPORTANCE
+};
+
+// What the last UpdateFinalRDFBuffer (or LoadBake) packed. Energies are summed light importances.
+struct LightPackingStats {
+	// Surfaces with more than KS_MAX_SURFACE_LIGHTS lights
+	int truncatedSurfaces;
+
+	// Importance of every packed light and of the ones past KS_MAX_SURFACE_LIGHTS
+	double totalEnergy;
+	double droppedEnergy;
+
+	// Largest fraction of the energy of one surface that was dropped
+	float maxDroppedFraction;
+
+	// Surfaces whose lights and directory were packed again, the rest were kept from the packing before
+	int repackedSurfaces;
+};
+
+// Surfaces [first, first + count) of the packed buffers. In a buffer with stride bytes per surface that
+// is the bytes [first * stride, (first + count) * stride).
+struct PackedSurfaceRange {
+	int first;
+	int count;
+};
+
+// What the last UpdateLightTree did
+struct LightTreeUpdateStats {
+	// RDFs from before the update that were kept as is
+	int reused;
+
+	// RDFs created by the update
+	int rebuilt;
+
+	// RDFs released by the update, every RDF on the object and everything lit by them
+	int removed;
+
+	// visibleSurfaces rows that were rewritten, every row of the object plus the others that changed
+	int visibilityRowsUpdated;
+
+	// The update could not be done incrementally and fell back to BuildLightTree
+	bool fullRebuild;
+
+	// The jumble map was compacted at the end of the update
+	bool compacted;
+};
+
 class SceneLightingInformation
 {
 public:
@@ -172,19 +229,129 @@ public:
 	// so input width/height.
 	void SetScreenRatio(float ratio);
 
+	// Number of threads used when baking the light tree, 0 (the default from KS_BAKE_THREADS) uses
+	// every hardware thread. The result is the same for any thread count.
+	void SetThreadCount(int count);
+	int GetThreadCount() const;
+
+	// How surface visibility is computed when baking, KS_VISIBILITY_MODE by default.
+	void SetVisibilityMode(VisibilityMode mode);
+	VisibilityMode GetVisibilityMode() const;
+
+	// Highest bounce an RDF can have, KS_MAX_RAY_BOUNCES by default.
+	void SetMaxBounces(int bounces);
+	int GetMaxBounces() const;
+
+	// RDFs with a lightness below this dont get children, KS_MIN_LIGHTNESS by default.
+	void SetMinLightness(float lightness);
+	float GetMinLightness() const;
+
+	// How the lights of each surface are ordered when packing, KS_LIGHT_PACKING_MODE by default. Takes
+	// effect on the next UpdateFinalRDFBuffer.
+	void SetLightPackingMode(LightPackingMode mode);
+	LightPackingMode GetLightPackingMode() const;
+
+	// Fraction of dirty surfaces above which GetDirtyRanges is one range over every surface,
+	// KS_FULL_UPLOAD_FRACTION by default. 0 always uploads everything.
+	void SetFullUploadFraction(float fraction);
+	float GetFullUploadFraction() const;
+
+	const LightTreeStats& GetLightTreeStats() const;
+	const LightTreeUpdateStats& GetLightTreeUpdateStats() const;
+	const LightPackingStats& GetLightPackingStats() const;
+
+	// Summed importance of the lights of surface dirIdx past KS_MAX_SURFACE_LIGHTS, the light it loses on
+	// the GPU. Throws std::out_of_range for surfaces that were not packed.
+	float GetDroppedLightEnergy(int dirIdx) const;
+
 	// Rebuilds the entire light tree, this is usually only done at startup.
 	void BuildLightTree();
 
+	// Only compute the visibility lists (GetVisibleSurfaces, GetVisibleObjects), the first step of
+	// BuildLightTree. Drops the light tree since it no longer matches the compiled scene, the next
+	// UpdateLightTree rebuilds it. Used by tools that only need visibility, like kenos-bench.
+	void BuildSceneVisibility();
+
 	// Update the light tree, used when an emissive surface changes or when scene geometry changes
 	// (such as a new model being added or animating). This recomputes the light tree using the given
 	// model index as an entry point, deletes everything lower in the tree, and then recomputes the tree.
+	//
+	// Only the visibility rows and RDFs that touch the triangles of object idx are redone, the rest of
+	// the tree is reused. The result holds the same RDFs as a BuildLightTree would, only in a different
+	// order. Falls back to BuildLightTree when there is no tree yet, when other objects also moved, when
+	// the triangle layout changed or when the bounce settings changed since the tree was built.
 	void UpdateLightTree(int idx);
 
 	// Constructs and flattens the final buffers. This has to be redone if you update the light tree.
+	//
+	// Only the surfaces whose directory or lights changed since they were last packed are packed again,
+	// the rest are kept. Everything is packed when the buffers are empty, when BuildLightTree was run or
+	// when the light packing mode changed.
 	void UpdateFinalRDFBuffer();
 
+	// Have the next UpdateFinalRDFBuffer pack and upload every surface, for when the GPU buffers were
+	// lost or the scene changed behind our back
+	void MarkAllSurfacesDirty();
+
+	// Coalesced ranges of packed surfaces that changed since the last ClearDirtyRanges, in surface
+	// order. Filled by UpdateFinalRDFBuffer and LoadBake, these are what has to be uploaded again. Once
+	// more than the full upload fraction of the surfaces is dirty this is one range over all of them.
+	const std::vector<PackedSurfaceRange>& GetDirtyRanges() const;
+
+	// Call once the dirty ranges have been uploaded
+	void ClearDirtyRanges();
+
+	// Key of everything a bake depends on: the scene file, the mesh files, the engine constants, the
+	// bounce and visibility settings and the current object transforms and materials. 0 if the scene
+	// was not loaded from a file or a file could not be read, such scenes are never cached.
+	uint64_t ComputeBakeKey() const;
+
+	// Save the light tree, the visibility and the packed buffers to a bake file.
+	bool SaveBake(const std::string& path) const;
+
+	// Load a bake saved by SaveBake in place of BuildLightTree. Returns false if there is no bake or it
+	// was made for a different key, the caller should build the tree then. The tree is left empty if
+	// anything in the file does not fit the scene.
+	bool LoadBake(const std::string& path);
+
+	// Surfaces and objects visible from each surface, row i is directory i. Filled by BuildLightTree.
+	const VisibilityStore& GetVisibleSurfaces() const;
+	const VisibilityStore& GetVisibleObjects() const;
+
+	// Copies of the packed buffers. The views and the Pack functions below dont copy anything, use
+	// those for anything done more than once.
 	std::vector<SurfaceLightmapDirectoryPacked> GetDirectoryBuffer();
 	std::map<int, std::vector<SurfLight>> GetFinalLightmapBuffer();
+
+	// Read only views of the packed buffers, valid until the next UpdateFinalRDFBuffer or LoadBake.
+	// Both are empty until the buffers have been packed. GetFinalLights has every light
+	// of a surface, also the ones past KS_MAX_SURFACE_LIGHTS, and throws std::out_of_range for surfaces
+	// that were not packed.
+	const std::vector<SurfaceLightmapDirectoryPacked>& GetDirectoryBufferView() const;
+	SurfLightRange GetFinalLights(int dirIdx) const;
+
+	// Write the packed buffers straight into dest, a mapped structured buffer for example. Directory i
+	// goes to dest + i * stride. Surface i of the lightmap gets KS_MAX_SURFACE_LIGHTS slots from
+	// dest + i * stride, slots past its light count are zeroed. The stride has to fit one element
+	// (throws std::invalid_argument otherwise) and dest has to hold packed surfaces * stride bytes,
+	// which is what both return. Nothing is written before the buffers have been packed.
+	size_t PackDirectoryBuffer(void* dest, size_t stride) const;
+	size_t PackLightmapBuffer(void* dest, size_t stride) const;
+
+	// The same for only the surfaces of range, surface range.first goes to dest. Throws
+	// std::out_of_range if the range is not inside the packed surfaces.
+	size_t PackDirectoryBuffer(void* dest, size_t stride, PackedSurfaceRange range) const;
+	size_t PackLightmapBuffer(void* dest, size_t stride, PackedSurfaceRange range) const;
+
+	// Bytes held by the light tree, the visibility, the packed buffers and the scene, as a tree of
+	// categories. Walks every directory so it is linear in the triangle count.
+	MemoryUsage GetMemoryUsageTree() const;
+
+	// Highest GetMemoryUsageTree() total seen during each bake phase since the last reset, including
+	// the scratch buffers the phase had at the time. Phases are named like the profiling zones:
+	// DirectorySetup, Visibility, EmissiveDiscovery, Propagation, Packing, UpdateLightTree and LoadBake.
+	const std::map<std::string, size_t>& GetMemoryHighWater() const;
+	void ResetMemoryHighWater();
 	
 	
 private:
@@ -195,6 +362,24 @@ private:
 
 	int globalPolyCount;
 
+	int threadCount;
+
+	VisibilityMode visibilityMode;
+
+	int maxBounces;
+	float minLightness;
+
+	// maxBounces and minLightness the current tree was built with
+	int treeMaxBounces;
+	float treeMinLightness;
+
+	LightTreeStats lightTreeStats;
+	LightTreeUpdateStats lightTreeUpdateStats;
+
+	// BVH over every triangle in the scene, rebuilt by BuildVisibility when visibilityMode is
+	// KS_VISMODE_BVH.
+	TriangleBVH sceneBVH;
+
 	std::vector<DirectX::SimpleMath::Vector3> allNormals;
 
 	std::vector<int> emissivePolygons;
@@ -206,14 +391,129 @@ private:
 	// Contains all of the RDFs in the scene. It is called the jumble map because it is not sorted
 	// or organized in any way, if you want to use this either enter from a directory or trace from
 	// a lightTree root.
-	std::vector<RDF> jumbleMap;
+	RDFPool jumbleMap;
 
 	std::vector<SurfaceLightmapDirectory> lightmapDirectories;
 
+	// All of the surfaces visible from each surface, one row per directory
+	VisibilityStore visibleSurfaces;
+
+	// All of the objects whose BV is in front of each surface, one row per directory
+	VisibilityStore visibleObjects;
+
 	std::vector<SurfaceLightmapDirectoryPacked> finalDirectoryBuffer;
-	std::map<int, std::vector<SurfLight>> finalLightmapBuffer;
+
+	// Packed lights of every surface back to back, the lights of surface i are
+	// finalLights[finalLightOffsets[i], finalLightOffsets[i + 1]). Same layout as the bake file.
+	std::vector<int> finalLightOffsets;
+	std::vector<SurfLight> finalLights;
+
+	LightPackingMode lightPackingMode;
+
+	// Mode the packed buffers were made with and what was dropped from them, see GetDroppedLightEnergy
+	LightPackingMode finalPackingMode;
+	LightPackingStats lightPackingStats;
+	std::vector<float> finalDroppedEnergy;
+
+	// Summed importance of every packed light of each surface
+	std::vector<float> finalTotalEnergy;
+
+	// Per surface KS_SURFACE_* flags of what still has to happen to it
+	enum SurfaceDirtyFlags {
+		// The directory or the lights changed since it was packed
+		KS_SURFACE_REPACK = 1,
+
+		// The packed surface changed since the last ClearDirtyRanges
+		KS_SURFACE_UPLOAD = 2
+	};
+
+	std::vector<uint8_t> surfaceDirtyFlags;
+
+	float fullUploadFraction;
+
+	// See GetDirtyRanges
+	std::vector<PackedSurfaceRange> dirtyRanges;
+
+	// Flag surface dirIdx to be packed and uploaded again
+	void MarkSurfaceDirty(int dirIdx);
+
+	// Rebuild dirtyRanges from the KS_SURFACE_UPLOAD flags
+	void UpdateDirtyRanges();
+
+	// Estimated light reaching surface receiverIdx from a packed light: its brightness times the form
+	// factor of the caster seen from the receiver, centroid to centroid, attenuated by the squared
+	// distance. Only used to rank lights, it is not the light the shader computes.
+	float ComputeLightImportance(const SurfLight& light, int receiverIdx, const CompiledSceneGeometry& geo) const;
+
+	// Recompute finalTotalEnergy and finalDroppedEnergy of surface dirIdx from its packed lights
+	void UpdateSurfaceEnergy(int dirIdx, const CompiledSceneGeometry& geo);
+
+	// Sum lightPackingStats up from the energies of every surface
+	void UpdateLightPackingStats();
 
 	// Queue of the 
 	std::queue<int> processQueue;
+
+	// See GetMemoryHighWater
+	std::map<std::string, size_t> memoryHighWater;
+
+	// Raise the high water mark of phase to the current total plus scratchBytes held by the phase
+	void RecordMemoryHighWater(const char* phase, size_t scratchBytes = 0);
+
+	// Fraction of the light leaving caster that reaches receiver and is scattered again
+	float ComputeTransfer(int casterIdx, int receiverIdx, const CompiledSceneGeometry& geo) const;
+
+	// Fill in the colour and matrices of directory dirIdx, surfLights are left alone
+	void UpdateDirectory(int dirIdx, const CompiledSceneGeometry& geo);
+
+	// Create the root RDF of emissive surface dirIdx and add it to the light tree
+	RDFHandle AddLightSource(int dirIdx, const CompiledSceneGeometry& geo);
+
+	// Create the RDF of the light from caster reaching surface receiverIdx, queue it if it gets children
+	RDFHandle AddReceiverRDF(RDFHandle caster, int receiverIdx, const CompiledSceneGeometry& geo);
+
+	// If an RDF gets children, false once maxBounces is reached or too little light is left
+	bool IsExpandable(RDFHandle rdf) const;
+
+	// Give every queued RDF its children until the queue is empty
+	void PropagateQueue(const CompiledSceneGeometry& geo);
+
+	// Release rdf and everything below it, the directories of the released RDFs are added to
+	// touchedDirectories
+	void ReleaseSubtree(RDFHandle rdf, std::vector<int>& touchedDirectories);
+
+	// Compact the jumble map and remap every handle held outside of it
+	void CompactLightTree();
+
+	// Redo the visibility rows after object objIdx changed. Rows of the object are recomputed, every
+	// other row only in the columns of the object. The new columns of the object in every row are written
+	// to rangeValues[rangeOffsets[row], rangeOffsets[row + 1]). Returns the number of changed rows.
+	int UpdateVisibility(int objIdx, const CompiledSceneGeometry& geo, std::vector<int>& rangeOffsets,
+		std::vector<int>& rangeValues);
+
+	// Fill the visibleObjects and visibleSurfaces stores, casters are split between threads
+	void BuildVisibility(const CompiledSceneGeometry& geo);
+
+	// Normal and mean point of surface dirIdx for the visibility kernels
+	VisCasterPlane GetCasterPlane(int dirIdx, const CompiledSceneGeometry& geo) const;
+
+	// If the BV of object objIdx is at least partly in front of surface dirIdx
+	bool IsObjectInFront(int dirIdx, int objIdx, const CompiledSceneGeometry& geo) const;
+
+	// Determine the objects whose BV is at least partly in front of surface dirIdx
+	void ComputeVisibleObjects(int dirIdx, const CompiledSceneGeometry& geo, std::vector<int>& objects) const;
+
+	// Determine the objects and surfaces visible from casters [casterStart, casterEnd) and write them to
+	// tileObjects[caster - casterStart] and tileSurfaces[caster - casterStart]. At most
+	// KS_VIS_CASTER_TILE casters at a time. Only reads shared state so it can run on many threads at once.
+	void ComputeTileVisibility(int casterStart, int casterEnd, const CompiledSceneGeometry& geo,
+		std::vector<std::vector<int>>& tileObjects, std::vector<std::vector<int>>& tileSurfaces) const;
+
+	// Same as ComputeTileVisibility but finds the surfaces with a query on sceneBVH for each caster.
+	void ComputeTileVisibilityBVH(int casterStart, int casterEnd, const CompiledSceneGeometry& geo,
+		std::vector<std::vector<int>>& tileObjects, std::vector<std::vector<int>>& tileSurfaces) const;
+
+	// Add the pair counters of a finished tile, tested is how many pairs reached a per surface test
+	void CountTileVisibility(int casterCount, long long tested, const std::vector<std::vector<int>>& tileSurfaces) const;
 };
 
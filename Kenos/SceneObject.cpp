@@ -1,6 +1,5 @@
-#pragma once
-
 #include "pch.h"
+#include <utility>
 #include <vector>
 #include <SimpleMath.h>
 
@@ -12,11 +11,16 @@
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
-using Microsoft::WRL::ComPtr;
-
 #include "SceneObject.h"
 
-SceneObject::SceneObject() {
+SceneObject::SceneObject() :
+    m_position(Vector3::Zero),
+    m_rotation(Vector3::Zero),
+    m_rotQuat(XMQuaternionIdentity()),
+    m_scale(Vector3::One),
+    m_materialId(-1),
+    m_transformDirty(true)
+{
 	// init material reference
 	
 }
@@ -29,6 +33,7 @@ SceneObject::~SceneObject()
 void SceneObject::SetPosition(const Vector3 position)
 {
     m_position = position;
+    m_transformDirty = true;
 }
 
 const Vector3& SceneObject::GetPosition() const
@@ -40,6 +45,7 @@ void SceneObject::SetRotation(const Vector3 rotation)
 {
     m_rotation = rotation;
     m_rotQuat = XMQuaternionRotationRollPitchYaw(m_rotation.x, m_rotation.y, m_rotation.z);
+    m_transformDirty = true;
 }
 
 const Vector3& SceneObject::GetRotation() const
@@ -50,39 +56,55 @@ const Vector3& SceneObject::GetRotation() const
 void SceneObject::SetScale(const Vector3 scale)
 {
     m_scale = scale;
+    m_transformDirty = true;
 }
 
-const Vector3& SceneObject::GetScale()
+const Vector3& SceneObject::GetScale() const
 {
     return m_scale;
 }
 
 void SceneObject::SetMesh(Mesh mesh)
 {
-    m_mesh = mesh;
+    m_mesh = std::move(mesh);
+    m_transformDirty = true;
 }
 
-const Mesh& SceneObject::GetMesh()
+const Mesh& SceneObject::GetMesh() const
 {
     return m_mesh;
 }
 
-void SceneObject::SetMaterial(Material& material)
+void SceneObject::SetMaterial(const Material& material)
 {
     m_material = material;
+
+    // The material may not be the one in the scene's table any more, the scene gives objects without
+    // an id their own entry when it is compiled
+    m_materialId = -1;
 }
 
-const Material& SceneObject::GetMaterial()
+const Material& SceneObject::GetMaterial() const
 {
     return m_material;
 }
 
+void SceneObject::SetMaterialId(int materialId)
+{
+    m_materialId = materialId;
+}
+
+int SceneObject::GetMaterialId() const
+{
+    return m_materialId;
+}
+
 int SceneObject::GetFaceCount() const{
     return m_mesh.GetFaceCount();
 }
 
-Vector3  SceneObject::GetMeshIndex(int idx) {
-    return m_mesh.m_indices[idx];
+MeshFace SceneObject::GetMeshIndex(int idx) const {
+    return m_mesh.GetIndex(idx);
 }
 
 // get the final (transformed/scaled/rotated) vertex at index idx
@@ -100,6 +122,23 @@ const Vector3 SceneObject::GetFinalVtx(int idx) const
     return vertex;
 }
 
+XMMATRIX SceneObject::GetWorldMatrix() const
+{
+    return XMMatrixScalingFromVector(m_scale)
+        * XMMatrixRotationQuaternion(m_rotQuat)
+        * XMMatrixTranslationFromVector(m_position);
+}
+
+bool SceneObject::IsTransformDirty() const
+{
+    return m_transformDirty;
+}
+
+void SceneObject::ClearTransformDirty()
+{
+    m_transformDirty = false;
+}
+
 void SceneObject::computeBVH() {
     // loop through all the verts and find the max and min x, y, and z values
     int numVerts = m_mesh.GetVertexCount();
@@ -14,6 +14,12 @@ public:
     SceneObject();
     ~SceneObject();
 
+    // Moves are kept so objects built on other threads are not copied with their mesh
+    SceneObject(const SceneObject&) = default;
+    SceneObject(SceneObject&&) = default;
+    SceneObject& operator=(const SceneObject&) = default;
+    SceneObject& operator=(SceneObject&&) = default;
+
     void SetPosition(const DirectX::SimpleMath::Vector3 position);
     const DirectX::SimpleMath::Vector3& GetPosition() const;
 
@@ -21,19 +27,33 @@ public:
     const DirectX::SimpleMath::Vector3& GetRotation() const;
 
     void SetScale(const DirectX::SimpleMath::Vector3 scale);
-    const DirectX::SimpleMath::Vector3& GetScale();
+    const DirectX::SimpleMath::Vector3& GetScale() const;
 
     void SetMesh(Mesh mesh);
-    const Mesh& GetMesh();
+    const Mesh& GetMesh() const;
+
+    // Also clears the material id, set it after this if the material is the one in the scene's table
+    void SetMaterial(const Material& material);
+    const Material& GetMaterial() const;
 
-    void SetMaterial(Material& material);
-    const Material& GetMaterial();
+    // Index of the material in the owning scene's material table, -1 if it has its own material
+    void SetMaterialId(int materialId);
+    int GetMaterialId() const;
 
     // get the final (transformed/scaled/rotated) vertex at index idx
     const DirectX::SimpleMath::Vector3 GetFinalVtx(int idx) const;
 
     int GetFaceCount() const;
-    DirectX::SimpleMath::Vector3 GetMeshIndex(int idx);
+    MeshFace GetMeshIndex(int idx) const;
+
+    // Scale, rotation and translation as a single matrix, transforming a mesh vertex by this is
+    // the same as GetFinalVtx
+    DirectX::XMMATRIX GetWorldMatrix() const;
+
+    // Set whenever the position, rotation, scale or mesh changes so the scene knows which objects
+    // have to be re-transformed when it is compiled.
+    bool IsTransformDirty() const;
+    void ClearTransformDirty();
 
     void computeBVH();
 
@@ -46,6 +66,9 @@ private:
     DirectX::SimpleMath::Vector3 m_scale;
     Mesh m_mesh;
     Material m_material;
+    int m_materialId;
+
+    bool m_transformDirty;
 
     DirectX::SimpleMath::Vector3 m_BVHmax;
     DirectX::SimpleMath::Vector3 m_BVHmin;
@@ -0,0 +1,63 @@
+#include "pch.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ThreadingLib.h"
+
+using namespace std;
+
+int ResolveThreadCount(int requested) {
+	if (requested > 0) {
+		return requested;
+	}
+
+	// hardware_concurrency is allowed to return 0 if it doesnt know
+	int hardwareThreads = (int)thread::hardware_concurrency();
+	return max(hardwareThreads, 1);
+}
+
+void ParallelFor(int count, int chunkSize, int threadCount, const function<void(int, int, int)>& body) {
+	if (count <= 0) {
+		return;
+	}
+
+	chunkSize = max(chunkSize, 1);
+
+	int chunkCount = (count + chunkSize - 1) / chunkSize;
+	threadCount = min(ResolveThreadCount(threadCount), chunkCount);
+
+	// not worth spinning up threads, still go chunk by chunk so the body can rely on chunkSize
+	if (threadCount == 1) {
+		for (int chunkStart = 0; chunkStart < count; chunkStart += chunkSize) {
+			body(chunkStart, min(chunkStart + chunkSize, count), 0);
+		}
+		return;
+	}
+
+	atomic<int> nextChunk(0);
+
+	auto worker = [&](int threadIdx) {
+		for (int chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+			int chunkStart = chunk * chunkSize;
+			int chunkEnd = min(chunkStart + chunkSize, count);
+
+			body(chunkStart, chunkEnd, threadIdx);
+		}
+	};
+
+	vector<thread> threads;
+	threads.reserve(threadCount - 1);
+
+	for (int i = 1; i < threadCount; i++) {
+		threads.emplace_back(worker, i);
+	}
+
+	// the calling thread does work too
+	worker(0);
+
+	for (thread& t : threads) {
+		t.join();
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+
+/*
+* Kenos threading library, small helpers for splitting bake work between threads.
+*/
+
+// Turn a requested thread count into the number of threads to actually use. 0 or less means use
+// every hardware thread.
+int ResolveThreadCount(int requested);
+
+// Run body over [0, count) split into chunks of chunkSize. Chunks are handed out to threads
+// dynamically so uneven work still balances, the body gets (chunkStart, chunkEnd, threadIdx) where
+// threadIdx is in [0, threadCount) and can be used to index per-thread scratch buffers. A chunk is
+// never larger than chunkSize. If only one thread is used everything runs on the calling thread.
+//
+// Params:
+//		count: Number of items
+//		chunkSize: Number of items handed to a thread at a time
+//		threadCount: Number of threads, see ResolveThreadCount
+//		body: Function called for every chunk
+void ParallelFor(int count, int chunkSize, int threadCount, const std::function<void(int, int, int)>& body);
@@ -0,0 +1,275 @@
+#include "pch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "EngineConstants.h"
+#include "TriangleBVH.h"
+
+using namespace std;
+
+// Index of the lowest set bit, word must not be 0
+static inline int LowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64(&idx, word);
+	return (int)idx;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+static inline void SetMaskBit(vector<uint64_t>& mask, int idx) {
+	mask[idx >> 6] |= (uint64_t)1 << (idx & 63);
+}
+
+TriangleBVH::TriangleBVH() {
+
+}
+
+TriangleBVH::~TriangleBVH() {
+
+}
+
+void TriangleBVH::Clear() {
+	nodes.clear();
+	triIndices.clear();
+
+	for (int k = 0; k < 3; k++) {
+		cornerX[k].clear();
+		cornerY[k].clear();
+		cornerZ[k].clear();
+	}
+}
+
+bool TriangleBVH::Empty() const {
+	return nodes.empty();
+}
+
+int TriangleBVH::GetNodeCount() const {
+	return (int)nodes.size();
+}
+
+int TriangleBVH::GetTriCount() const {
+	return (int)triIndices.size();
+}
+
+MemoryUsage TriangleBVH::GetMemoryUsageTree(const string& name) const {
+	MemoryUsage usage(name);
+
+	size_t corners = 0;
+	for (int k = 0; k < 3; k++) {
+		corners += VectorBytes(cornerX[k]) + VectorBytes(cornerY[k]) + VectorBytes(cornerZ[k]);
+	}
+
+	usage.Add("nodes", VectorBytes(nodes));
+	usage.Add("triIndices", VectorBytes(triIndices));
+	usage.Add("corners", corners);
+
+	return usage;
+}
+
+int TriangleBVH::GetMaskWords() const {
+	return ((int)triIndices.size() + 63) / 64;
+}
+
+void TriangleBVH::CollectMaskRange(const vector<uint64_t>& mask, int first, int last, vector<int>& out) {
+	if (first >= last) {
+		return;
+	}
+
+	int firstWord = first >> 6;
+	int lastWord = (last - 1) >> 6;
+
+	for (int w = firstWord; w <= lastWord; w++) {
+		uint64_t word = mask[w];
+
+		// trim the bits outside of the range off the end words
+		if (w == firstWord) {
+			word &= ~(uint64_t)0 << (first & 63);
+		}
+		if (w == lastWord && (last & 63) != 0) {
+			word &= ~(uint64_t)0 >> (64 - (last & 63));
+		}
+
+		while (word != 0) {
+			out.push_back((w << 6) + LowestSetBit(word));
+			word &= word - 1;
+		}
+	}
+}
+
+void TriangleBVH::Build(const VisReceiverStreams& tris, int triCount) {
+	Clear();
+
+	if (triCount <= 0) {
+		return;
+	}
+
+	// Centroids are only needed to sort triangles while building
+	vector<float> centroids(3 * (size_t)triCount);
+	for (int i = 0; i < triCount; i++) {
+		centroids[3 * i + 0] = (tris.x[0][i] + tris.x[1][i] + tris.x[2][i]) / 3.0f;
+		centroids[3 * i + 1] = (tris.y[0][i] + tris.y[1][i] + tris.y[2][i]) / 3.0f;
+		centroids[3 * i + 2] = (tris.z[0][i] + tris.z[1][i] + tris.z[2][i]) / 3.0f;
+	}
+
+	triIndices.resize(triCount);
+	for (int i = 0; i < triCount; i++) {
+		triIndices[i] = i;
+	}
+
+	// a binary tree with leaves of at least half the leaf size has less than this many nodes
+	nodes.reserve(2 * (triCount / max(KS_BVH_LEAF_SIZE / 2, 1)) + 1);
+
+	// copy the corners over first so BuildNode can compute boxes straight from the BVH order streams,
+	// they get reordered to match triIndices once the tree is done
+	for (int k = 0; k < 3; k++) {
+		cornerX[k].assign(tris.x[k], tris.x[k] + triCount);
+		cornerY[k].assign(tris.y[k], tris.y[k] + triCount);
+		cornerZ[k].assign(tris.z[k], tris.z[k] + triCount);
+	}
+
+	BuildNode(0, triCount, centroids);
+
+	for (int k = 0; k < 3; k++) {
+		for (int i = 0; i < triCount; i++) {
+			cornerX[k][i] = tris.x[k][triIndices[i]];
+			cornerY[k][i] = tris.y[k][triIndices[i]];
+			cornerZ[k][i] = tris.z[k][triIndices[i]];
+		}
+	}
+}
+
+int TriangleBVH::BuildNode(int first, int last, const vector<float>& centroids) {
+	int nodeIdx = (int)nodes.size();
+	nodes.push_back(Node());
+
+	Node node;
+	node.first = first;
+	node.count = last - first;
+	node.rightChild = -1;
+
+	// Box over every vertex of the triangles, and over the centroids to pick the split axis
+	float centroidMin[3] = { INFINITY, INFINITY, INFINITY };
+	float centroidMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+	for (int a = 0; a < 3; a++) {
+		node.boxMin[a] = INFINITY;
+		node.boxMax[a] = -INFINITY;
+	}
+
+	for (int i = first; i < last; i++) {
+		int tri = triIndices[i];
+
+		for (int k = 0; k < 3; k++) {
+			const float corner[3] = { cornerX[k][tri], cornerY[k][tri], cornerZ[k][tri] };
+
+			for (int a = 0; a < 3; a++) {
+				node.boxMin[a] = min(node.boxMin[a], corner[a]);
+				node.boxMax[a] = max(node.boxMax[a], corner[a]);
+			}
+		}
+
+		for (int a = 0; a < 3; a++) {
+			centroidMin[a] = min(centroidMin[a], centroids[3 * tri + a]);
+			centroidMax[a] = max(centroidMax[a], centroids[3 * tri + a]);
+		}
+	}
+
+	if (node.count > KS_BVH_LEAF_SIZE) {
+		// Median split along the axis the centroids are most spread out on
+		int axis = 0;
+		for (int a = 1; a < 3; a++) {
+			if (centroidMax[a] - centroidMin[a] > centroidMax[axis] - centroidMin[axis]) {
+				axis = a;
+			}
+		}
+
+		int mid = first + node.count / 2;
+		nth_element(triIndices.begin() + first, triIndices.begin() + mid, triIndices.begin() + last,
+			[&](int a, int b) { return centroids[3 * a + axis] < centroids[3 * b + axis]; });
+
+		// left child is always nodeIdx + 1
+		BuildNode(first, mid, centroids);
+		node.rightChild = BuildNode(mid, last, centroids);
+	}
+
+	nodes[nodeIdx] = node;
+	return nodeIdx;
+}
+
+void TriangleBVH::QueryFrontOfPlane(const VisCasterPlane& caster, vector<uint64_t>& frontMask) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	const float normal[3] = { caster.nx, caster.ny, caster.nz };
+	const float mean[3] = { caster.mx, caster.my, caster.mz };
+
+	VisReceiverStreams streams;
+	for (int k = 0; k < 3; k++) {
+		streams.x[k] = cornerX[k].data();
+		streams.y[k] = cornerY[k].data();
+		streams.z[k] = cornerZ[k].data();
+	}
+
+	// Scratch for leaf results, these are BVH order positions
+	int leafHits[KS_BVH_LEAF_SIZE];
+
+	// Depth is log2 of the triangle count, 64 is plenty
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = nodes[stack[--stackSize]];
+
+		// Range of normal . (p - mean) over the box. Done in double with a margin for the rounding of
+		// the float per vertex test so a box is only decided when every vertex in it certainly agrees.
+		double dotMin = 0.0;
+		double dotMax = 0.0;
+		double magnitude = 0.0;
+
+		for (int a = 0; a < 3; a++) {
+			double lo = (double)node.boxMin[a] - mean[a];
+			double hi = (double)node.boxMax[a] - mean[a];
+
+			dotMin += normal[a] * (normal[a] >= 0.0f ? lo : hi);
+			dotMax += normal[a] * (normal[a] >= 0.0f ? hi : lo);
+			magnitude += fabs(normal[a]) * max(fabs(lo), fabs(hi));
+		}
+
+		double margin = 1e-5 * magnitude + 1e-30;
+
+		// every vertex is behind the plane, nothing here is visible
+		if (dotMin > margin) {
+			continue;
+		}
+
+		// every vertex is in front, all of it is visible
+		if (dotMax < -margin) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				SetMaskBit(frontMask, triIndices[i]);
+			}
+			continue;
+		}
+
+		if (node.rightChild < 0) {
+			int found = ClassifyReceivers(caster, streams, node.first, node.first + node.count, leafHits);
+
+			for (int i = 0; i < found; i++) {
+				SetMaskBit(frontMask, triIndices[leafHits[i]]);
+			}
+			continue;
+		}
+
+		int nodeIdx = (int)(&node - nodes.data());
+		stack[stackSize++] = node.rightChild;
+		stack[stackSize++] = nodeIdx + 1;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "MemoryUsage.h"
+#include "VisibilityKernels.h"
+
+/*
+* Bounding volume hierarchy over all of the triangles in a scene, used to answer "which triangles have
+* any vertex in front of this plane" without testing every triangle. Subtrees whose box is entirely
+* behind the plane are rejected and subtrees entirely in front are accepted in bulk, only the leaves
+* that straddle the plane are tested per triangle.
+*
+* The box tests keep a small margin so they never decide a triangle the per triangle test would decide
+* differently, queries return exactly the same set as running ClassifyReceivers over every triangle.
+*/
+class TriangleBVH
+{
+public:
+	TriangleBVH();
+	~TriangleBVH();
+
+	// Build the tree over triangles [0, triCount) of the given corner streams. The corners are copied
+	// into BVH order so the streams dont have to outlive the tree.
+	void Build(const VisReceiverStreams& tris, int triCount);
+
+	void Clear();
+	bool Empty() const;
+
+	int GetNodeCount() const;
+	int GetTriCount() const;
+
+	// Bytes of the nodes, the triangle order and the reordered corners
+	MemoryUsage GetMemoryUsageTree(const std::string& name) const;
+
+	// Set the bit of every triangle with any vertex in front of the caster plane in frontMask. The mask
+	// holds one bit per global triangle index and must be at least GetMaskWords() long, bits that are
+	// already set are left alone. A mask instead of a list so results dont have to be sorted afterwards.
+	void QueryFrontOfPlane(const VisCasterPlane& caster, std::vector<uint64_t>& frontMask) const;
+
+	int GetMaskWords() const;
+
+	// Append the set bits of mask in [first, last) to out in ascending order.
+	static void CollectMaskRange(const std::vector<uint64_t>& mask, int first, int last, std::vector<int>& out);
+
+private:
+	struct Node {
+		float boxMin[3];
+		float boxMax[3];
+
+		// Triangles under this node are [first, first + count) in BVH order
+		int first;
+		int count;
+
+		// Index of the right child, the left child is always the next node. -1 for leaves.
+		int rightChild;
+	};
+
+	// Recursively build the subtree over BVH order triangles [first, last), returns the node index
+	int BuildNode(int first, int last, const std::vector<float>& centroids);
+
+	std::vector<Node> nodes;
+
+	// Global triangle index of every triangle in BVH order
+	std::vector<int> triIndices;
+
+	// Corner streams in BVH order, see VisReceiverStreams
+	std::vector<float> cornerX[3];
+	std::vector<float> cornerY[3];
+	std::vector<float> cornerZ[3];
+};
@@ -0,0 +1,205 @@
+#include "pch.h"
+
+#include <atomic>
+
+#include "VisibilityKernels.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KS_VISKERNEL_X86
+#endif
+
+#ifdef KS_VISKERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets any function use AVX intrinsics
+#define KS_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define KS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	// Index of the lowest set bit, mask must not be 0
+	inline int LowestBit(unsigned int mask) {
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return (int)idx;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// Write first + bit for every set bit in mask
+	inline int EmitMask(unsigned int mask, int first, int* out) {
+		int count = 0;
+		while (mask != 0) {
+			out[count++] = first + LowestBit(mask);
+			mask &= mask - 1;
+		}
+		return count;
+	}
+
+	int ClassifyScalar(const VisCasterPlane& c, const VisReceiverStreams& r, int first, int last, int* out) {
+		int count = 0;
+		for (int tri = first; tri < last; tri++) {
+			if (IsReceiverVisible(c, r, tri)) {
+				out[count++] = tri;
+			}
+		}
+		return count;
+	}
+
+#ifdef KS_VISKERNEL_X86
+	int ClassifySSE(const VisCasterPlane& c, const VisReceiverStreams& r, int first, int last, int* out) {
+		const __m128 nx = _mm_set1_ps(c.nx), ny = _mm_set1_ps(c.ny), nz = _mm_set1_ps(c.nz);
+		const __m128 mx = _mm_set1_ps(c.mx), my = _mm_set1_ps(c.my), mz = _mm_set1_ps(c.mz);
+		const __m128 zero = _mm_setzero_ps();
+
+		int count = 0;
+		int tri = first;
+
+		for (; tri + 4 <= last; tri += 4) {
+			__m128 anyFront = zero;
+
+			for (int k = 0; k < 3; k++) {
+				__m128 dx = _mm_sub_ps(_mm_loadu_ps(r.x[k] + tri), mx);
+				__m128 dy = _mm_sub_ps(_mm_loadu_ps(r.y[k] + tri), my);
+				__m128 dz = _mm_sub_ps(_mm_loadu_ps(r.z[k] + tri), mz);
+
+				__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz));
+				anyFront = _mm_or_ps(anyFront, _mm_cmplt_ps(dot, zero));
+			}
+
+			count += EmitMask((unsigned int)_mm_movemask_ps(anyFront), tri, out + count);
+		}
+
+		// leftovers that dont fill a register
+		return count + ClassifyScalar(c, r, tri, last, out + count);
+	}
+
+	KS_TARGET_AVX2
+	int ClassifyAVX2(const VisCasterPlane& c, const VisReceiverStreams& r, int first, int last, int* out) {
+		const __m256 nx = _mm256_set1_ps(c.nx), ny = _mm256_set1_ps(c.ny), nz = _mm256_set1_ps(c.nz);
+		const __m256 mx = _mm256_set1_ps(c.mx), my = _mm256_set1_ps(c.my), mz = _mm256_set1_ps(c.mz);
+		const __m256 zero = _mm256_setzero_ps();
+
+		int count = 0;
+		int tri = first;
+
+		for (; tri + 8 <= last; tri += 8) {
+			__m256 anyFront = zero;
+
+			for (int k = 0; k < 3; k++) {
+				__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(r.x[k] + tri), mx);
+				__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(r.y[k] + tri), my);
+				__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(r.z[k] + tri), mz);
+
+				__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, dx), _mm256_mul_ps(ny, dy)), _mm256_mul_ps(nz, dz));
+				anyFront = _mm256_or_ps(anyFront, _mm256_cmp_ps(dot, zero, _CMP_LT_OQ));
+			}
+
+			count += EmitMask((unsigned int)_mm256_movemask_ps(anyFront), tri, out + count);
+		}
+
+		// the tail goes through the SSE kernel which finishes with scalar
+		return count + ClassifySSE(c, r, tri, last, out + count);
+	}
+
+	bool CpuSupportsAVX2() {
+		int regs[4] = { 0, 0, 0, 0 };
+
+#if defined(_MSC_VER)
+		__cpuid(regs, 0);
+		if (regs[0] < 7) {
+			return false;
+		}
+
+		__cpuid(regs, 1);
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+
+		__cpuidex(regs, 7, 0);
+		bool avx2 = (regs[1] & (1 << 5)) != 0;
+
+		// The OS also has to save the ymm registers on context switches
+		bool osSavesYmm = osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+		if (__get_cpuid_max(0, nullptr) < 7) {
+			return false;
+		}
+
+		__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+		bool osxsave = (ecx & (1u << 27)) != 0;
+		bool avx = (ecx & (1u << 28)) != 0;
+
+		__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+		bool avx2 = (ebx & (1u << 5)) != 0;
+
+		// The OS also has to save the ymm registers on context switches
+		bool osSavesYmm = false;
+		if (osxsave) {
+			unsigned int xcr0Lo, xcr0Hi;
+			__asm__("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+			osSavesYmm = (xcr0Lo & 0x6) == 0x6;
+		}
+#endif
+		(void)regs;
+
+		return avx && avx2 && osSavesYmm;
+	}
+#endif
+
+	VisKernelLevel DetectVisKernelLevel() {
+#ifdef KS_VISKERNEL_X86
+		// SSE2 is the minimum the engine builds for
+		return CpuSupportsAVX2() ? KS_VISKERNEL_AVX2 : KS_VISKERNEL_SSE;
+#else
+		return KS_VISKERNEL_SCALAR;
+#endif
+	}
+
+	// -1 until the first call sets it to the supported level
+	std::atomic<int> g_visKernelLevel(-1);
+}
+
+VisKernelLevel GetSupportedVisKernelLevel() {
+	// thread safe lazy init
+	static const VisKernelLevel supported = DetectVisKernelLevel();
+	return supported;
+}
+
+VisKernelLevel GetVisKernelLevel() {
+	int level = g_visKernelLevel.load();
+	if (level < 0) {
+		level = GetSupportedVisKernelLevel();
+		g_visKernelLevel = level;
+	}
+	return (VisKernelLevel)level;
+}
+
+void SetVisKernelLevel(VisKernelLevel level) {
+	VisKernelLevel supported = GetSupportedVisKernelLevel();
+	g_visKernelLevel = level > supported ? supported : level;
+}
+
+int ClassifyReceivers(const VisCasterPlane& caster, const VisReceiverStreams& receivers, int first, int last, int* out) {
+	if (last <= first) {
+		return 0;
+	}
+
+	switch (GetVisKernelLevel()) {
+#ifdef KS_VISKERNEL_X86
+	case KS_VISKERNEL_AVX2:
+		return ClassifyAVX2(caster, receivers, first, last, out);
+	case KS_VISKERNEL_SSE:
+		return ClassifySSE(caster, receivers, first, last, out);
+#endif
+	default:
+		return ClassifyScalar(caster, receivers, first, last, out);
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+* Kenos visibility kernels, classify batches of receiver triangles against a caster plane.
+*
+* A receiver vertex v is in front of (visible from) a caster when normal . (v - mean) < 0, and a
+* receiver triangle is visible when any of its vertices is. This is the same test BuildLightTree
+* always did, the kernels just do it 4 (SSE) or 8 (AVX2) triangles at a time over SoA corner streams.
+* Every level evaluates the dot product in the same order as XMVector3Dot ((x + y) + z) without
+* fused multiply adds, so all of them return exactly the same visible set.
+*/
+
+// Caster plane, the normal and mean point of the caster triangle
+struct VisCasterPlane {
+	float nx, ny, nz;
+	float mx, my, mz;
+};
+
+// Receiver triangle corners with one stream per component, x[k][tri] is the x coordinate of corner k
+// of triangle tri. Usually points straight into CompiledSceneGeometry.
+struct VisReceiverStreams {
+	const float* x[3];
+	const float* y[3];
+	const float* z[3];
+};
+
+enum VisKernelLevel
+{
+	// Plain c++, works everywhere
+	KS_VISKERNEL_SCALAR,
+	// 4 receivers per instruction
+	KS_VISKERNEL_SSE,
+	// 8 receivers per instruction
+	KS_VISKERNEL_AVX2
+};
+
+// Test a single receiver, the same test every kernel level does. Inline for callers that only need the
+// odd triangle and dont want the dispatch of ClassifyReceivers.
+inline bool IsReceiverVisible(const VisCasterPlane& c, const VisReceiverStreams& r, int tri) {
+	for (int k = 0; k < 3; k++) {
+		float dx = r.x[k][tri] - c.mx;
+		float dy = r.y[k][tri] - c.my;
+		float dz = r.z[k][tri] - c.mz;
+
+		if ((c.nx * dx + c.ny * dy) + c.nz * dz < 0.0f) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Best kernel level supported by this cpu, detected once on first use.
+VisKernelLevel GetSupportedVisKernelLevel();
+
+// Kernel level ClassifyReceivers uses. Defaults to the best supported level, setting a level higher
+// than the supported one clamps it. Mostly useful for testing the fallbacks.
+VisKernelLevel GetVisKernelLevel();
+void SetVisKernelLevel(VisKernelLevel level);
+
+// Test receivers [first, last) against the caster plane and write the indices of the visible ones to
+// out in increasing order.
+//
+// Params:
+//		caster: The caster plane
+//		receivers: Receiver corner streams
+//		first: First receiver index to test
+//		last: One past the last receiver index to test
+//		out: Output array, must have room for last - first indices
+// Returns:
+//		Number of indices written to out (int)
+int ClassifyReceivers(const VisCasterPlane& caster, const VisReceiverStreams& receivers, int first, int last, int* out);
+
@@ -0,0 +1,564 @@
+#include "pch.h"
+
+#include <algorithm>
+
+#include "VisibilityStore.h"
+
+using namespace std;
+
+namespace
+{
+	inline int PopCount(uint64_t word) {
+#ifdef _MSC_VER
+		return (int)__popcnt64(word);
+#else
+		return __builtin_popcountll(word);
+#endif
+	}
+
+	// Bytes needed to varint encode value
+	inline int VarintSize(uint32_t value) {
+		int size = 1;
+		while (value >= 0x80) {
+			value >>= 7;
+			size++;
+		}
+		return size;
+	}
+
+	inline void WriteVarint(uint32_t value, uint8_t*& out) {
+		while (value >= 0x80) {
+			*out++ = (uint8_t)(value | 0x80);
+			value >>= 7;
+		}
+		*out++ = (uint8_t)value;
+	}
+}
+
+VisibilityStore::VisibilityStore() :
+	columnCount(0),
+	wordsPerRow(0),
+	garbageWords(0),
+	garbageBytes(0)
+{
+}
+
+VisibilityStore::~VisibilityStore() {
+
+}
+
+void VisibilityStore::Reset(int rowCount, int newColumnCount) {
+	columnCount = newColumnCount;
+	wordsPerRow = (newColumnCount + 63) / 64;
+
+	RowInfo empty = { 0, 0, 0, 0 };
+	rows.assign(rowCount, empty);
+
+	denseWords.clear();
+	sparseBytes.clear();
+
+	garbageWords = 0;
+	garbageBytes = 0;
+}
+
+void VisibilityStore::Clear() {
+	columnCount = 0;
+	wordsPerRow = 0;
+
+	vector<RowInfo>().swap(rows);
+	vector<uint64_t>().swap(denseWords);
+	vector<uint8_t>().swap(sparseBytes);
+
+	garbageWords = 0;
+	garbageBytes = 0;
+}
+
+void VisibilityStore::ReleaseRow(const RowInfo& info) {
+	if (info.dense) {
+		garbageWords += wordsPerRow;
+	}
+	else {
+		garbageBytes += info.size;
+	}
+}
+
+void VisibilityStore::SetRow(int row, const vector<int>& values) {
+	SetRow(row, values.data(), (int)values.size());
+}
+
+void VisibilityStore::SetRow(int row, const int* values, int count) {
+	RowInfo& info = rows[row];
+	ReleaseRow(info);
+
+	info.count = count;
+
+	if (count == 0) {
+		info.offset = 0;
+		info.size = 0;
+		info.dense = 0;
+		return;
+	}
+
+	// Pick whichever representation is smaller
+	size_t sparseSize = 0;
+	int prev = 0;
+	for (int i = 0; i < count; i++) {
+		sparseSize += VarintSize((uint32_t)(values[i] - prev));
+		prev = values[i];
+	}
+
+	size_t denseSize = (size_t)wordsPerRow * sizeof(uint64_t);
+
+	if (denseSize < sparseSize) {
+		info.dense = 1;
+		info.size = 0;
+		info.offset = denseWords.size();
+
+		denseWords.resize(denseWords.size() + wordsPerRow, 0);
+		uint64_t* words = denseWords.data() + info.offset;
+
+		for (int i = 0; i < count; i++) {
+			words[values[i] >> 6] |= (uint64_t)1 << (values[i] & 63);
+		}
+	}
+	else {
+		info.dense = 0;
+		info.size = (int)sparseSize;
+		info.offset = sparseBytes.size();
+
+		sparseBytes.resize(sparseBytes.size() + sparseSize);
+		uint8_t* out = sparseBytes.data() + info.offset;
+
+		prev = 0;
+		for (int i = 0; i < count; i++) {
+			WriteVarint((uint32_t)(values[i] - prev), out);
+			prev = values[i];
+		}
+	}
+}
+
+void VisibilityStore::SetRows(int firstRow, const VisibilityStore& other) {
+	// Rows of other only reference its own arenas, so the arenas are appended as a whole and the
+	// offsets shifted
+	uint64_t wordBase = denseWords.size();
+	uint64_t byteBase = sparseBytes.size();
+
+	denseWords.insert(denseWords.end(), other.denseWords.begin(), other.denseWords.end());
+	sparseBytes.insert(sparseBytes.end(), other.sparseBytes.begin(), other.sparseBytes.end());
+
+	for (int i = 0; i < (int)other.rows.size(); i++) {
+		RowInfo info = other.rows[i];
+		info.offset += info.dense ? wordBase : byteBase;
+
+		ReleaseRow(rows[firstRow + i]);
+		rows[firstRow + i] = info;
+	}
+}
+
+bool VisibilityStore::ReplaceRange(int row, int first, int last, const vector<int>& values) {
+	return ReplaceRange(row, first, last, values.data(), (int)values.size());
+}
+
+bool VisibilityStore::ReplaceRange(int row, int first, int last, const int* values, int count) {
+	if (first >= last) {
+		return false;
+	}
+
+	RowInfo& info = rows[row];
+
+	if (info.dense) {
+		uint64_t* words = denseWords.data() + info.offset;
+
+		int firstWord = first >> 6;
+		int lastWord = (last - 1) >> 6;
+
+		bool changed = false;
+		int v = 0;
+
+		for (int w = firstWord; w <= lastWord; w++) {
+			// bits of this word that are inside the range
+			uint64_t mask = ~(uint64_t)0;
+			if (w == firstWord) {
+				mask &= ~(uint64_t)0 << (first & 63);
+			}
+			if (w == lastWord && (last & 63) != 0) {
+				mask &= ~(uint64_t)0 >> (64 - (last & 63));
+			}
+
+			uint64_t bits = 0;
+			while (v < count && (values[v] >> 6) == w) {
+				bits |= (uint64_t)1 << (values[v] & 63);
+				v++;
+			}
+
+			uint64_t old = words[w] & mask;
+			if (old != bits) {
+				changed = true;
+				info.count += PopCount(bits) - PopCount(old);
+				words[w] = (words[w] & ~mask) | bits;
+			}
+		}
+
+		return changed;
+	}
+
+	// Sparse rows are decoded, spliced and written again if anything in the range differs
+	vector<int> current;
+	GetRowValues(row, current);
+
+	vector<int>::iterator rangeFirst = lower_bound(current.begin(), current.end(), first);
+	vector<int>::iterator rangeLast = lower_bound(rangeFirst, current.end(), last);
+
+	if (rangeLast - rangeFirst == count && equal(rangeFirst, rangeLast, values)) {
+		return false;
+	}
+
+	vector<int> merged;
+	merged.reserve(current.size() - (rangeLast - rangeFirst) + count);
+	merged.insert(merged.end(), current.begin(), rangeFirst);
+	merged.insert(merged.end(), values, values + count);
+	merged.insert(merged.end(), rangeLast, current.end());
+
+	SetRow(row, merged);
+	return true;
+}
+
+int VisibilityStore::GetRowCount() const {
+	return (int)rows.size();
+}
+
+int VisibilityStore::GetColumnCount() const {
+	return columnCount;
+}
+
+VisibilityStore::Row VisibilityStore::GetRow(int row) const {
+	const RowInfo& info = rows[row];
+
+	Row result;
+	result.count = info.count;
+
+	if (info.count == 0) {
+		return result;
+	}
+
+	iterator& it = result.first;
+	it.remaining = info.count;
+
+	if (info.dense) {
+		it.words = denseWords.data() + info.offset;
+		it.wordIdx = 0;
+		while (it.words[it.wordIdx] == 0) {
+			it.wordIdx++;
+		}
+
+		it.bits = it.words[it.wordIdx];
+		it.current = (it.wordIdx << 6) + LowestSetBit(it.bits);
+	}
+	else {
+		// the first value is stored as a delta from 0, decoding it is the same as a step from 0
+		it.bytes = sparseBytes.data() + info.offset;
+		it.current = 0;
+		it.remaining++;
+		++it;
+	}
+
+	return result;
+}
+
+int VisibilityStore::GetRowSize(int row) const {
+	return rows[row].count;
+}
+
+bool VisibilityStore::IsRowDense(int row) const {
+	return rows[row].dense != 0;
+}
+
+void VisibilityStore::GetRowValues(int row, vector<int>& out) const {
+	Row values = GetRow(row);
+
+	out.clear();
+	out.reserve(values.size());
+	for (int value : values) {
+		out.push_back(value);
+	}
+}
+
+void VisibilityStore::GetRowRange(int row, int first, int last, vector<int>& out) const {
+	const RowInfo& info = rows[row];
+
+	if (info.count == 0 || first >= last) {
+		return;
+	}
+
+	if (info.dense) {
+		const uint64_t* words = denseWords.data() + info.offset;
+
+		int firstWord = first >> 6;
+		int lastWord = (last - 1) >> 6;
+
+		for (int w = firstWord; w <= lastWord; w++) {
+			uint64_t word = words[w];
+
+			if (w == firstWord) {
+				word &= ~(uint64_t)0 << (first & 63);
+			}
+			if (w == lastWord && (last & 63) != 0) {
+				word &= ~(uint64_t)0 >> (64 - (last & 63));
+			}
+
+			while (word != 0) {
+				out.push_back((w << 6) + LowestSetBit(word));
+				word &= word - 1;
+			}
+		}
+		return;
+	}
+
+	for (int value : GetRow(row)) {
+		if (value >= last) {
+			break;
+		}
+		if (value >= first) {
+			out.push_back(value);
+		}
+	}
+}
+
+bool VisibilityStore::Contains(int row, int column) const {
+	const RowInfo& info = rows[row];
+
+	if (info.count == 0 || column < 0 || column >= columnCount) {
+		return false;
+	}
+
+	if (info.dense) {
+		return (denseWords[info.offset + (column >> 6)] >> (column & 63)) & 1;
+	}
+
+	for (int value : GetRow(row)) {
+		if (value >= column) {
+			return value == column;
+		}
+	}
+	return false;
+}
+
+int VisibilityStore::CountCommon(int rowA, int rowB) const {
+	const RowInfo& a = rows[rowA];
+	const RowInfo& b = rows[rowB];
+
+	if (a.count == 0 || b.count == 0) {
+		return 0;
+	}
+
+	if (a.dense && b.dense) {
+		const uint64_t* wordsA = denseWords.data() + a.offset;
+		const uint64_t* wordsB = denseWords.data() + b.offset;
+
+		int common = 0;
+		for (int w = 0; w < wordsPerRow; w++) {
+			common += PopCount(wordsA[w] & wordsB[w]);
+		}
+		return common;
+	}
+
+	// one dense, look the sparse one up in the bitset
+	if (a.dense || b.dense) {
+		int denseRow = a.dense ? rowA : rowB;
+		int sparseRow = a.dense ? rowB : rowA;
+		const uint64_t* words = denseWords.data() + rows[denseRow].offset;
+
+		int common = 0;
+		for (int value : GetRow(sparseRow)) {
+			common += (int)((words[value >> 6] >> (value & 63)) & 1);
+		}
+		return common;
+	}
+
+	// both sparse, merge
+	Row valuesA = GetRow(rowA);
+	Row valuesB = GetRow(rowB);
+	iterator itA = valuesA.begin();
+	iterator itB = valuesB.begin();
+
+	int common = 0;
+	while (itA != valuesA.end() && itB != valuesB.end()) {
+		if (*itA < *itB) {
+			++itA;
+		}
+		else if (*itB < *itA) {
+			++itB;
+		}
+		else {
+			common++;
+			++itA;
+			++itB;
+		}
+	}
+	return common;
+}
+
+size_t VisibilityStore::GetMemoryUsage() const {
+	return VectorBytes(rows) + VectorBytes(denseWords) + VectorBytes(sparseBytes);
+}
+
+MemoryUsage VisibilityStore::GetMemoryUsageTree(const string& name) const {
+	MemoryUsage usage(name);
+
+	usage.Add("rows", VectorBytes(rows));
+	usage.Add("denseWords", VectorBytes(denseWords));
+	usage.Add("sparseBytes", VectorBytes(sparseBytes));
+
+	return usage;
+}
+
+size_t VisibilityStore::GetGarbageBytes() const {
+	return garbageWords * sizeof(uint64_t) + garbageBytes;
+}
+
+void VisibilityStore::Compact() {
+	vector<uint64_t> newWords;
+	vector<uint8_t> newBytes;
+
+	newWords.reserve(denseWords.size() - garbageWords);
+	newBytes.reserve(sparseBytes.size() - garbageBytes);
+
+	for (RowInfo& info : rows) {
+		if (info.dense) {
+			uint64_t offset = newWords.size();
+			newWords.insert(newWords.end(), denseWords.begin() + info.offset, denseWords.begin() + info.offset + wordsPerRow);
+			info.offset = offset;
+		}
+		else if (info.size > 0) {
+			uint64_t offset = newBytes.size();
+			newBytes.insert(newBytes.end(), sparseBytes.begin() + info.offset, sparseBytes.begin() + info.offset + info.size);
+			info.offset = offset;
+		}
+	}
+
+	denseWords.swap(newWords);
+	sparseBytes.swap(newBytes);
+
+	garbageWords = 0;
+	garbageBytes = 0;
+}
+
+void VisibilityStore::Save(BakeFileWriter& out, uint32_t firstSection) const {
+	vector<int> shape = { (int)rows.size(), columnCount };
+
+	out.WriteSection(firstSection, shape);
+	out.WriteSection(firstSection + 1, rows);
+	out.WriteSection(firstSection + 2, denseWords);
+	out.WriteSection(firstSection + 3, sparseBytes);
+}
+
+bool VisibilityStore::IsRowValid(const RowInfo& info) const {
+	if (info.count < 0 || info.size < 0) {
+		return false;
+	}
+
+	if (info.dense) {
+		if (info.offset > denseWords.size() || denseWords.size() - info.offset < (size_t)wordsPerRow) {
+			return false;
+		}
+
+		// The iterator stops after count set bits, more or fewer would run it off the row
+		const uint64_t* words = denseWords.data() + info.offset;
+		int bits = 0;
+		for (int w = 0; w < wordsPerRow; w++) {
+			bits += PopCount(words[w]);
+		}
+
+		uint64_t pastEnd = (columnCount & 63) != 0 ? ~(uint64_t)0 << (columnCount & 63) : 0;
+		return bits == info.count && (wordsPerRow == 0 || (words[wordsPerRow - 1] & pastEnd) == 0);
+	}
+
+	if (info.offset > sparseBytes.size() || sparseBytes.size() - info.offset < (size_t)info.size) {
+		return false;
+	}
+
+	// Decode the row the way the iterator does, every value has to end inside the row's bytes and
+	// every delta after the first has to be positive
+	const uint8_t* bytes = sparseBytes.data() + info.offset;
+	const uint8_t* end = bytes + info.size;
+	int64_t value = 0;
+
+	for (int i = 0; i < info.count; i++) {
+		uint64_t delta = 0;
+		int shift = 0;
+		uint8_t byte;
+
+		do {
+			if (bytes == end || shift > 28) {
+				return false;
+			}
+
+			byte = *bytes++;
+			delta |= (uint64_t)(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+
+		if (i > 0 && delta == 0) {
+			return false;
+		}
+
+		value += (int64_t)delta;
+		if (value >= columnCount) {
+			return false;
+		}
+	}
+
+	return bytes == end;
+}
+
+bool VisibilityStore::Load(const BakeFile& in, uint32_t firstSection) {
+	vector<int> shape;
+	if (!in.ReadSection(firstSection, shape) || shape.size() != 2 || shape[0] < 0 || shape[1] < 0) {
+		return false;
+	}
+
+	Reset(0, shape[1]);
+
+	if (!in.ReadSection(firstSection + 1, rows) || (int)rows.size() != shape[0] ||
+		!in.ReadSection(firstSection + 2, denseWords) || !in.ReadSection(firstSection + 3, sparseBytes)) {
+		Clear();
+		return false;
+	}
+
+	// Anything in the arenas that no row points at was garbage when the store was saved. Rows pointing
+	// outside of the arenas or holding something other than count sorted columns mean the file is
+	// broken.
+	size_t liveWords = 0;
+	size_t liveBytes = 0;
+	bool valid = true;
+
+	for (const RowInfo& info : rows) {
+		valid = valid && IsRowValid(info);
+		if (!valid) {
+			break;
+		}
+
+		if (info.dense) {
+			liveWords += wordsPerRow;
+		}
+		else {
+			liveBytes += info.size;
+		}
+	}
+
+	if (!valid || liveWords > denseWords.size() || liveBytes > sparseBytes.size()) {
+		Clear();
+		return false;
+	}
+
+	garbageWords = denseWords.size() - liveWords;
+	garbageBytes = sparseBytes.size() - liveBytes;
+
+	return true;
+}
+
+void VisibilityStore::ShrinkToFit() {
+	rows.shrink_to_fit();
+	denseWords.shrink_to_fit();
+	sparseBytes.shrink_to_fit();
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BakeCache.h"
+#include "MemoryUsage.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+* Visibility lists of every surface in one place. Each row is a sorted list of columns (surfaces or
+* objects) and is stored either as a packed bitset or as delta + varint encoded bytes, whichever is
+* smaller for that row. Dense rows are good for lists that see a large part of the scene and allow
+* popcount queries, sparse rows are a byte or two per entry.
+*
+* All rows share two arenas so a whole scene is a handful of allocations instead of one per list.
+* Rows can be set in any order, setting a row that already has data leaves the old data behind as
+* garbage in the arenas until the next Compact(). ReplaceRange on a dense row works in place.
+*/
+class VisibilityStore
+{
+public:
+	// Forward iterator over the columns of a row in ascending order, the same for both representations
+	class iterator {
+	public:
+		iterator();
+
+		int operator*() const { return current; }
+		iterator& operator++();
+		bool operator!=(const iterator& other) const { return remaining != other.remaining; }
+		bool operator==(const iterator& other) const { return remaining == other.remaining; }
+
+	private:
+		friend class VisibilityStore;
+
+		// Number of columns left including the current one, 0 at the end
+		int remaining;
+		int current;
+
+		// dense rows
+		const uint64_t* words;
+		uint64_t bits;
+		int wordIdx;
+
+		// sparse rows
+		const uint8_t* bytes;
+	};
+
+	// Lightweight view of a single row, only valid until the store is modified
+	struct Row {
+		iterator first;
+		int count;
+
+		iterator begin() const { return first; }
+		iterator end() const { return iterator(); }
+		int size() const { return count; }
+		bool empty() const { return count == 0; }
+	};
+
+	VisibilityStore();
+	~VisibilityStore();
+
+	// Drop every row and make room for rowCount empty rows of columns in [0, columnCount). Keeps the
+	// allocated memory so stores can be reused as scratch.
+	void Reset(int rowCount, int columnCount);
+
+	// Set a row, values must be sorted ascending, unique and in [0, GetColumnCount())
+	void SetRow(int row, const int* values, int count);
+	void SetRow(int row, const std::vector<int>& values);
+
+	// Copy every row of other into rows [firstRow, firstRow + other.GetRowCount()). Both stores must
+	// have the same column count.
+	void SetRows(int firstRow, const VisibilityStore& other);
+
+	// Replace the columns of a row that are in [first, last) with values, which must be sorted and in
+	// [first, last). Returns if the row changed. Dense rows are updated in place.
+	bool ReplaceRange(int row, int first, int last, const int* values, int count);
+	bool ReplaceRange(int row, int first, int last, const std::vector<int>& values);
+
+	int GetRowCount() const;
+	int GetColumnCount() const;
+
+	Row GetRow(int row) const;
+	int GetRowSize(int row) const;
+	bool IsRowDense(int row) const;
+
+	// Decode a row into out
+	void GetRowValues(int row, std::vector<int>& out) const;
+
+	// Append the columns of a row that are in [first, last) to out. Dense rows only look at the words
+	// covering the range.
+	void GetRowRange(int row, int first, int last, std::vector<int>& out) const;
+
+	// If column is in the row. Constant time for dense rows, sparse rows are decoded up to column.
+	bool Contains(int row, int column) const;
+
+	// Number of columns in both rows, popcount of the AND when both rows are dense.
+	int CountCommon(int rowA, int rowB) const;
+
+	// Bytes used by the rows and arenas, including unused capacity
+	size_t GetMemoryUsage() const;
+
+	// GetMemoryUsage split into the row table and the two arenas, garbage is part of the arenas
+	MemoryUsage GetMemoryUsageTree(const std::string& name) const;
+
+	// Bytes in the arenas that belong to rows that have since been set again
+	size_t GetGarbageBytes() const;
+
+	// Rewrite the arenas with only the data of the current rows, in row order
+	void Compact();
+
+	// Free unused arena capacity
+	void ShrinkToFit();
+
+	// Write the store to sections [firstSection, firstSection + 4) of a bake file and read it back
+	void Save(BakeFileWriter& out, uint32_t firstSection) const;
+	bool Load(const BakeFile& in, uint32_t firstSection);
+
+	void Clear();
+
+private:
+	struct RowInfo {
+		// Index into denseWords for dense rows, into sparseBytes for sparse rows
+		uint64_t offset;
+		int count;
+
+		// Encoded size in bytes of sparse rows, dense rows are always wordsPerRow words
+		int size;
+		int dense;
+	};
+
+	// Mark the arena data of a row as garbage before it is overwritten
+	void ReleaseRow(const RowInfo& info);
+
+	// If a row read from a file is inside the arenas and holds exactly count sorted columns below
+	// columnCount, so iterating it stays inside its own data
+	bool IsRowValid(const RowInfo& info) const;
+
+	static inline int LowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward64(&idx, word);
+		return (int)idx;
+#else
+		return __builtin_ctzll(word);
+#endif
+	}
+
+	int columnCount;
+
+	// Number of 64 bit words in a dense row
+	int wordsPerRow;
+
+	std::vector<RowInfo> rows;
+
+	std::vector<uint64_t> denseWords;
+	std::vector<uint8_t> sparseBytes;
+
+	size_t garbageWords;
+	size_t garbageBytes;
+};
+
+inline VisibilityStore::iterator::iterator() :
+	remaining(0),
+	current(0),
+	words(nullptr),
+	bits(0),
+	wordIdx(0),
+	bytes(nullptr)
+{
+}
+
+inline VisibilityStore::iterator& VisibilityStore::iterator::operator++() {
+	if (--remaining <= 0) {
+		remaining = 0;
+		return *this;
+	}
+
+	if (words != nullptr) {
+		bits &= bits - 1;
+		while (bits == 0) {
+			bits = words[++wordIdx];
+		}
+
+		current = (wordIdx << 6) + VisibilityStore::LowestSetBit(bits);
+	}
+	else {
+		// varint, 7 bits at a time with the high bit set on every byte but the last
+		uint32_t delta = 0;
+		int shift = 0;
+		uint8_t byte;
+
+		do {
+			byte = *bytes++;
+			delta |= (uint32_t)(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+
+		current += (int)delta;
+	}
+
+	return *this;
+}
@@ -5,6 +5,33 @@
 
 #pragma once
 
+#ifdef KS_HEADLESS
+
+// Headless builds (kenos-bake, see CMakeLists.txt) only use the math libraries, there is no window
+// or Direct3D device.
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+#include <DirectXMath.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+
+#include "SimpleMath.h"
+
+#else
+
 #include <winsdkver.h>
 #ifndef _WIN32_WINNT
 #define _WIN32_WINNT 0x0601
@@ -77,4 +104,6 @@ namespace DX
 #include "SpriteBatch.h"
 #include "SpriteFont.h"
 #include "VertexTypes.h"
-#include "WICTextureLoader.h"
\ No newline at end of file
+#include "WICTextureLoader.h"
+
+#endif
\ No newline at end of file